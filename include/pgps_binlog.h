@@ -0,0 +1,273 @@
+#ifndef PGPS_BINLOG_H
+#define PGPS_BINLOG_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "cimpl_string.h"
+#include "pgps_intern.h"
+#include "pgps_pose.h"
+#include "pgps_time.h"
+
+// Binary pose log, version 3.  Host byte order, which `byte_order` records.
+//
+//   PoseLogHeader           64 bytes
+//   id table                id_capacity * POSE_LOG_ID_SIZE bytes
+//   PoseSample[]            record_count * 72 bytes
+//
+// Records are PoseSamples exactly as the listener holds them, and their id
+// handle indexes the id table.  A name is written the first time a file sees
+// its handle, so handles a file never saw leave empty entries.  The header
+// is kept current while recording, so a log cut short by a crash is readable
+// up to the last record appended.
+#define POSE_LOG_MAGIC "PGPSLOG"
+#define POSE_LOG_VERSION 3
+#define POSE_LOG_BYTE_ORDER 0x01020304u
+#define POSE_LOG_ID_SIZE ID_KEY_SIZE
+#define POSE_LOG_ID_CAPACITY ID_TABLE_CAPACITY
+// The file is preallocated and mapped in steps of this size
+#define POSE_LOG_GROW_BYTES (16 * 1024 * 1024)
+
+typedef struct PoseLogHeader {
+    char magic[8];
+    u32 byte_order;
+    u16 version;
+    u16 header_size;
+    u16 record_size;
+    u16 id_size;
+    u32 id_capacity;
+    // One past the highest handle in the id table
+    u32 id_count;
+    u32 records_offset;
+    u64 record_count;
+    // CLOCK_REALTIME ns the log was created
+    u64 created_ns;
+    u8 reserved[16];
+} PoseLogHeader;
+
+// A log mapped for appending, or read-only for conversion
+typedef struct PoseLog {
+    int fd;
+    bool writable;
+    u8* map;
+    usize map_size;
+    PoseLogHeader* header;
+    char (*ids)[POSE_LOG_ID_SIZE];
+    PoseSample* records;
+    // Handles whose name is already in this file's id table
+    u64 named[POSE_LOG_ID_CAPACITY / 64];
+    // Record count at the last msync
+    u64 synced_count;
+} PoseLog;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn PoseLog_create(PoseLog*, const char*);
+CimplReturn PoseLog_append(PoseLog*, const PoseSample*, StringView);
+CimplReturn PoseLog_sync(PoseLog*);
+CimplReturn PoseLog_open_read(PoseLog*, const char*);
+StringView PoseLog_id(const PoseLog*, IdHandle);
+void PoseLog_close(PoseLog*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+static usize PoseLog_records_offset(void) {
+    return sizeof(PoseLogHeader) + POSE_LOG_ID_CAPACITY * POSE_LOG_ID_SIZE;
+}
+
+// Points the header, id table and records into the current mapping
+static void PoseLog_bind(PoseLog* log) {
+    log->header = (PoseLogHeader*)log->map;
+    log->ids = (char (*)[POSE_LOG_ID_SIZE])(log->map + sizeof(PoseLogHeader));
+    log->records = (PoseSample*)(log->map + log->header->records_offset);
+}
+
+// Preallocates the file up to `size` bytes and maps all of it
+static CimplReturn PoseLog_grow(PoseLog* log, usize size) {
+    int result = fallocate(log->fd, 0, 0, (off_t)size);
+    if (result != 0 && (errno == EOPNOTSUPP || errno == ENOSYS)) {
+        // Not every filesystem can preallocate, a sparse file still works
+        result = ftruncate(log->fd, (off_t)size);
+    }
+    if (result != 0) {
+        log_error("Failed to grow pose log: %s", strerror(errno));
+        return RETURN_ERR;
+    }
+    void* map;
+    if (log->map == NULL) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    } else {
+        map = mremap(log->map, log->map_size, size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED) {
+        log_error("Failed to map pose log: %s", strerror(errno));
+        return RETURN_ERR;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    log->map = map;
+    log->map_size = size;
+    PoseLog_bind(log);
+    return RETURN_OK;
+}
+
+CimplReturn PoseLog_create(PoseLog* log, const char* path) {
+    memset(log, 0, sizeof(*log));
+    log->writable = true;
+    log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (log->fd < 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return RETURN_ERR;
+    }
+    // The header must be in place before PoseLog_bind reads records_offset
+    PoseLogHeader header = {
+        .byte_order = POSE_LOG_BYTE_ORDER,
+        .version = POSE_LOG_VERSION,
+        .header_size = sizeof(PoseLogHeader),
+        .record_size = sizeof(PoseSample),
+        .id_size = POSE_LOG_ID_SIZE,
+        .id_capacity = POSE_LOG_ID_CAPACITY,
+        .records_offset = (u32)PoseLog_records_offset(),
+        .created_ns = realtime_ns(),
+    };
+    memcpy(header.magic, POSE_LOG_MAGIC, sizeof(POSE_LOG_MAGIC));
+    if (pwrite(log->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        log_error("Failed to write %s: %s", path, strerror(errno));
+        close(log->fd);
+        return RETURN_ERR;
+    }
+    if (PoseLog_grow(log, POSE_LOG_GROW_BYTES) != RETURN_OK) {
+        close(log->fd);
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// Appends `sample`.  `name` is the id behind its handle, only copied into
+// the id table the first time this file sees the handle.
+CimplReturn PoseLog_append(
+    PoseLog* log, const PoseSample* sample, StringView name
+) {
+    IdHandle id = sample->id;
+    u64 bit = 1ull << (id % 64);
+    if ((log->named[id / 64] & bit) == 0) {
+        // The mapping starts zeroed, so the name stays NUL padded
+        memcpy(log->ids[id], name.items, name.count);
+        if (id >= log->header->id_count) log->header->id_count = id + 1u;
+        log->named[id / 64] |= bit;
+    }
+    u64 count = log->header->record_count;
+    usize end = log->header->records_offset +
+                (usize)(count + 1) * sizeof(PoseSample);
+    if (end > log->map_size &&
+        PoseLog_grow(log, log->map_size + POSE_LOG_GROW_BYTES) != RETURN_OK) {
+        return RETURN_ERR;
+    }
+    log->records[count] = *sample;
+    log->header->record_count = count + 1;
+    return RETURN_OK;
+}
+
+// Starts writeback of everything appended since the last sync without
+// waiting for it
+CimplReturn PoseLog_sync(PoseLog* log) {
+    if (log->header->record_count == log->synced_count) return RETURN_OK;
+    if (msync(log->map, log->map_size, MS_ASYNC) != 0) {
+        log_error("msync: %s", strerror(errno));
+        return RETURN_ERR;
+    }
+    log->synced_count = log->header->record_count;
+    return RETURN_OK;
+}
+
+// Maps an existing log read-only and checks it can be understood
+CimplReturn PoseLog_open_read(PoseLog* log, const char* path) {
+    memset(log, 0, sizeof(*log));
+    log->fd = open(path, O_RDONLY);
+    if (log->fd < 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return RETURN_ERR;
+    }
+    struct stat st;
+    if (fstat(log->fd, &st) != 0 ||
+        (usize)st.st_size < sizeof(PoseLogHeader)) {
+        log_error("%s is not a pose log", path);
+        close(log->fd);
+        return RETURN_ERR;
+    }
+    log->map_size = (usize)st.st_size;
+    log->map = mmap(NULL, log->map_size, PROT_READ, MAP_PRIVATE, log->fd, 0);
+    if (log->map == MAP_FAILED) {
+        log_error("Failed to map %s: %s", path, strerror(errno));
+        log->map = NULL;
+        close(log->fd);
+        return RETURN_ERR;
+    }
+
+    const PoseLogHeader* header = (const PoseLogHeader*)log->map;
+    const char* problem = NULL;
+    if (memcmp(header->magic, POSE_LOG_MAGIC, sizeof(POSE_LOG_MAGIC)) != 0) {
+        problem = "not a pose log";
+    } else if (header->byte_order != POSE_LOG_BYTE_ORDER) {
+        problem = "written with a different byte order";
+    } else if (header->version != POSE_LOG_VERSION) {
+        problem = "unsupported version";
+    } else if (header->header_size != sizeof(PoseLogHeader) ||
+               header->record_size != sizeof(PoseSample) ||
+               header->id_size != POSE_LOG_ID_SIZE ||
+               header->id_count > header->id_capacity ||
+               header->records_offset !=
+                   sizeof(PoseLogHeader) +
+                       (usize)header->id_capacity * POSE_LOG_ID_SIZE) {
+        problem = "unexpected layout";
+    } else if (header->records_offset > log->map_size ||
+               header->record_count >
+                   (log->map_size - header->records_offset) /
+                       sizeof(PoseSample)) {
+        // Divided rather than multiplied, a huge count can't wrap around
+        problem = "truncated";
+    }
+    if (problem != NULL) {
+        log_error("%s: %s", path, problem);
+        PoseLog_close(log);
+        return RETURN_ERR;
+    }
+    PoseLog_bind(log);
+    return RETURN_OK;
+}
+
+// The name a record's id handle stands for, empty if the file has none
+StringView PoseLog_id(const PoseLog* log, IdHandle id) {
+    StringView view = {0};
+    if (id < log->header->id_count) {
+        view.items = log->ids[id];
+        view.count = (u32)strnlen(log->ids[id], POSE_LOG_ID_SIZE);
+    }
+    return view;
+}
+
+// Trims the preallocated tail off a log being written
+void PoseLog_close(PoseLog* log) {
+    usize size = 0;
+    if (log->writable && log->header != NULL) {
+        size = log->header->records_offset +
+               (usize)log->header->record_count * sizeof(PoseSample);
+    }
+    if (log->map != NULL) munmap(log->map, log->map_size);
+    if (log->fd >= 0) {
+        if (size > 0 && ftruncate(log->fd, (off_t)size) != 0) {
+            log_error("Failed to trim pose log: %s", strerror(errno));
+        }
+        close(log->fd);
+    }
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_BINLOG_H */
@@ -0,0 +1,284 @@
+#ifndef PGPS_DASHBOARD_H
+#define PGPS_DASHBOARD_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "pgps_intern.h"
+#include "pgps_latency.h"
+#include "pgps_recv.h"
+#include "pgps_ring.h"
+#include "pgps_time.h"
+
+#define DASHBOARD_DEFAULT_HZ 5
+#define DASHBOARD_MAX_HZ 30
+// Bodies listed on a terminal, the rest are summed up in one line
+#define DASHBOARD_BODY_ROWS 16
+#define DASHBOARD_FRAME_SIZE 4096
+
+// Counters the receive/write loop bumps and a console thread redraws a few
+// times a second.  The loop is the only writer and every store is relaxed,
+// so counting a pose is a handful of plain instructions and a slow terminal
+// only ever stalls the drawing thread.
+typedef struct Dashboard {
+    // Loop side, `enabled` is only read
+    CACHE_ALIGNED bool enabled;
+    u64 received;
+    u64 rejected;
+    u64 kernel_drops;
+    u64 ring_overflows;
+    u64 written;
+    // Monotonic receive to written, which includes any reorder hold
+    LatencyHist lag;
+    u64 bodies[ID_TABLE_CAPACITY];
+
+    // Drawing side
+    CACHE_ALIGNED bool running;
+    bool tty;
+    u32 hz;
+    FILE* fp;
+    const IdTable* ids;
+    pthread_t thread;
+    u64 start_ns;
+    // Counters as of the previous frame, for rates and interval percentiles
+    u64 last_ns;
+    u64 last_received;
+    u64 last_lag[LATENCY_BUCKETS];
+    u64 last_bodies[ID_TABLE_CAPACITY];
+    // Lines drawn last frame, moved back over on a terminal
+    u32 lines;
+} Dashboard;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn Dashboard_start(Dashboard*, const IdTable*, u32, FILE*);
+void Dashboard_received(Dashboard*, u64);
+void Dashboard_recv_stats(Dashboard*, const RecvStats*);
+void Dashboard_ring_overflows(Dashboard*, u64);
+void Dashboard_written(Dashboard*, IdHandle, u64);
+void Dashboard_stop(Dashboard*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+static void dashboard_add(u64* counter, u64 value) {
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static u64 dashboard_load(const u64* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Poses received and decoded
+void Dashboard_received(Dashboard* dash, u64 count) {
+    if (!dash->enabled) return;
+    dashboard_add(&dash->received, count);
+}
+
+// Takes the rejected and kernel drop totals of the receiver(s) so far
+void Dashboard_recv_stats(Dashboard* dash, const RecvStats* stats) {
+    if (!dash->enabled) return;
+    u64 rejected = 0;
+    for (u32 i = 0; i < POSE_WIRE_STATUS_COUNT; ++i) {
+        rejected += stats->rejected[i];
+    }
+    __atomic_store_n(&dash->rejected, rejected, __ATOMIC_RELAXED);
+    __atomic_store_n(
+        &dash->kernel_drops, stats->kernel_drops, __ATOMIC_RELAXED
+    );
+}
+
+// Total poses the shard rings have dropped so far
+void Dashboard_ring_overflows(Dashboard* dash, u64 overflows) {
+    if (!dash->enabled) return;
+    __atomic_store_n(&dash->ring_overflows, overflows, __ATOMIC_RELAXED);
+}
+
+// One pose handed to the writer.  `recv_ns` is monotonic, a replay's capture
+// clock can run ahead of it and counts as no lag.
+void Dashboard_written(Dashboard* dash, IdHandle id, u64 recv_ns) {
+    if (!dash->enabled) return;
+    u64 now = monotonic_ns();
+    u64 lag_ns = now > recv_ns ? now - recv_ns : 0;
+    dashboard_add(&dash->written, 1);
+    if (id < ID_TABLE_CAPACITY) dashboard_add(&dash->bodies[id], 1);
+    LatencyHist* lag = &dash->lag;
+    dashboard_add(&lag->buckets[LatencyHist_index(lag_ns)], 1);
+    dashboard_add(&lag->count, 1);
+    if (lag_ns > lag->max) {
+        __atomic_store_n(&lag->max, lag_ns, __ATOMIC_RELAXED);
+    }
+}
+
+// Appends to the frame, dropping whatever doesn't fit
+static void dashboard_append(
+    char* frame, usize* len, const char* format, ...
+) {
+    if (*len >= DASHBOARD_FRAME_SIZE) return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(
+        frame + *len, DASHBOARD_FRAME_SIZE - *len, format, args
+    );
+    va_end(args);
+    if (n > 0) *len += (usize)n;
+    if (*len > DASHBOARD_FRAME_SIZE) *len = DASHBOARD_FRAME_SIZE;
+}
+
+static void Dashboard_draw(Dashboard* dash) {
+    static char frame[DASHBOARD_FRAME_SIZE];
+    usize len = 0;
+    u64 now = monotonic_ns();
+    f64 seconds = (f64)(now - dash->last_ns) / 1e9;
+    if (seconds <= 0.0) seconds = 1e-9;
+
+    // Back over the previous frame
+    const char* clear = dash->tty ? "\033[K" : "";
+    if (dash->tty && dash->lines > 0) {
+        dashboard_append(frame, &len, "\033[%uA", dash->lines);
+    }
+    u32 lines = 0;
+
+    u64 received = dashboard_load(&dash->received);
+    dashboard_append(
+        frame,
+        &len,
+        "%s%8.1f s  received %lu (%.0f/s)  written %lu  rejected %lu  "
+        "kernel drops %lu  ring overflows %lu\n",
+        clear,
+        (f64)(now - dash->start_ns) / 1e9,
+        received,
+        (f64)(received - dash->last_received) / seconds,
+        dashboard_load(&dash->written),
+        dashboard_load(&dash->rejected),
+        dashboard_load(&dash->kernel_drops),
+        dashboard_load(&dash->ring_overflows)
+    );
+    lines++;
+    dash->last_received = received;
+
+    // Percentiles of this frame's poses only
+    static LatencyHist lag;
+    memset(&lag, 0, sizeof(lag));
+    for (u32 i = 0; i < LATENCY_BUCKETS; ++i) {
+        u64 bucket = dashboard_load(&dash->lag.buckets[i]);
+        lag.buckets[i] = bucket - dash->last_lag[i];
+        lag.count += lag.buckets[i];
+        dash->last_lag[i] = bucket;
+    }
+    lag.max = dashboard_load(&dash->lag.max);
+    dashboard_append(
+        frame,
+        &len,
+        "%s  write lag us  p50 %.1f  p99 %.1f  p99.9 %.1f  run max %.1f\n",
+        clear,
+        (f64)LatencyHist_percentile(&lag, 50.0) / 1e3,
+        (f64)LatencyHist_percentile(&lag, 99.0) / 1e3,
+        (f64)LatencyHist_percentile(&lag, 99.9) / 1e3,
+        (f64)lag.max / 1e3
+    );
+    lines++;
+
+    // Per-body rates only on a terminal, a log would fill up with them
+    u32 count = IdTable_count(dash->ids);
+    u64 rest_rate = 0;
+    u32 rest = 0;
+    for (u32 i = 0; i < count && i < ID_TABLE_CAPACITY; ++i) {
+        u64 written = dashboard_load(&dash->bodies[i]);
+        u64 delta = written - dash->last_bodies[i];
+        dash->last_bodies[i] = written;
+        if (!dash->tty) continue;
+        if (i >= DASHBOARD_BODY_ROWS) {
+            rest++;
+            rest_rate += delta;
+            continue;
+        }
+        StringView name = IdTable_name(dash->ids, (IdHandle)i);
+        dashboard_append(
+            frame,
+            &len,
+            "%s  %-32.*s %10.0f/s %12lu\n",
+            clear,
+            (int)name.count,
+            name.items,
+            (f64)delta / seconds,
+            written
+        );
+        lines++;
+    }
+    if (rest > 0) {
+        char label[32];
+        snprintf(label, sizeof(label), "%u more bodies", rest);
+        dashboard_append(
+            frame,
+            &len,
+            "%s  %-32s %10.0f/s\n",
+            clear,
+            label,
+            (f64)rest_rate / seconds
+        );
+        lines++;
+    }
+
+    fwrite(frame, 1, len, dash->fp);
+    fflush(dash->fp);
+    dash->lines = lines;
+    dash->last_ns = now;
+}
+
+static void* Dashboard_run(void* arg) {
+    Dashboard* dash = arg;
+    u64 period = NS_PER_SEC / dash->hz;
+    u64 due = monotonic_ns();
+    while (__atomic_load_n(&dash->running, __ATOMIC_ACQUIRE)) {
+        due += period;
+        struct timespec ts = {
+            .tv_sec = (time_t)(due / NS_PER_SEC),
+            .tv_nsec = (long)(due % NS_PER_SEC),
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        Dashboard_draw(dash);
+    }
+    return NULL;
+}
+
+// Redraws `hz` times a second on `fp`, in place if it's a terminal.  With
+// `hz` 0 nothing is drawn and counting costs a branch.
+CimplReturn Dashboard_start(
+    Dashboard* dash, const IdTable* ids, u32 hz, FILE* fp
+) {
+    memset(dash, 0, sizeof(*dash));
+    if (hz == 0) return RETURN_OK;
+    if (hz > DASHBOARD_MAX_HZ) hz = DASHBOARD_MAX_HZ;
+    dash->hz = hz;
+    dash->fp = fp;
+    dash->ids = ids;
+    dash->tty = isatty(fileno(fp));
+    dash->start_ns = monotonic_ns();
+    dash->last_ns = dash->start_ns;
+    dash->enabled = true;
+    dash->running = true;
+    if (pthread_create(&dash->thread, NULL, Dashboard_run, dash) != 0) {
+        log_error("Failed to start the dashboard");
+        dash->enabled = false;
+        dash->running = false;
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// Draws the final counts and stops redrawing, before anything else is
+// printed so a terminal frame doesn't overwrite it.  Safe to call more than
+// once.
+void Dashboard_stop(Dashboard* dash) {
+    if (!__atomic_exchange_n(&dash->running, false, __ATOMIC_ACQ_REL)) return;
+    pthread_join(dash->thread, NULL);
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_DASHBOARD_H */
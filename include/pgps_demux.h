@@ -0,0 +1,238 @@
+#ifndef PGPS_DEMUX_H
+#define PGPS_DEMUX_H
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "cimpl_core.h"
+#include "cimpl_string.h"
+#include "pgps_intern.h"
+#include "pgps_latency.h"
+#include "pgps_pose.h"
+#include "pgps_writer.h"
+
+// One output file per body, so keep well clear of the fd limit
+#define DEMUX_MAX_BODIES 512
+// In `streams`, a body whose stream couldn't be opened
+#define DEMUX_STREAM_FAILED UINT16_MAX
+
+// Routes every pose to its own PoseWriter by id.  `capture.csv` becomes
+// `capture_<id>.csv` (and `capture_<id>_0000.csv`... with segments).  With
+// `by_body` off everything goes to a single writer on the original path.
+typedef struct PoseDemux {
+    const char* path;
+    WriterConfig config;
+    const IdTable* ids;
+    bool by_body;
+    // Stream index + 1 of every id handle, 0 until its first pose,
+    // DEMUX_STREAM_FAILED once opening its stream failed
+    u16 streams[ID_TABLE_CAPACITY];
+    PoseWriter* writers;
+    char** paths;
+    u32 count;
+    // Poses of bodies without a stream: past DEMUX_MAX_BODIES, or whose
+    // stream failed to open
+    u64 dropped;
+} PoseDemux;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn PoseDemux_open(
+    PoseDemux*, const char*, WriterConfig, const IdTable*, bool
+);
+CimplReturn PoseDemux_write(PoseDemux*, const PoseSample*, u64, u64, u64);
+CimplReturn PoseDemux_tick(PoseDemux*, u64);
+void PoseDemux_latency(const PoseDemux*, LatencyStats*);
+void PoseDemux_close(PoseDemux*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+/* PoseDemux */
+
+CimplReturn PoseDemux_open(
+    PoseDemux* demux,
+    const char* path,
+    WriterConfig config,
+    const IdTable* ids,
+    bool by_body
+) {
+    memset(demux, 0, sizeof(*demux));
+    demux->path = path;
+    demux->config = config;
+    demux->ids = ids;
+    demux->by_body = by_body;
+    u32 max_writers = by_body ? DEMUX_MAX_BODIES : 1;
+    demux->writers = calloc(max_writers, sizeof(PoseWriter));
+    demux->paths = calloc(max_writers, sizeof(char*));
+    if (demux->writers == NULL || demux->paths == NULL) {
+        log_error("PoseDemux_open: Out of memory");
+        PoseDemux_close(demux);
+        return RETURN_ERR;
+    }
+    if (by_body) return RETURN_OK;
+    if (PoseWriter_open(&demux->writers[0], path, config, ids) != RETURN_OK) {
+        PoseDemux_close(demux);
+        return RETURN_ERR;
+    }
+    demux->count = 1;
+    return RETURN_OK;
+}
+
+// `capture.csv` + `body 1` -> `capture_body_1.csv`.  Anything that isn't
+// safe in a file name becomes '_', and the stream index is appended if that
+// makes two ids collide.
+static char* PoseDemux_body_path(const PoseDemux* demux, StringView id) {
+    char name[ID_KEY_SIZE + 1];
+    usize len = 0;
+    for (; len < id.count; ++len) {
+        u8 c = (u8)id.items[len];
+        bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                    (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+                    c == '.';
+        name[len] = safe ? (char)c : '_';
+    }
+    name[len] = '\0';
+    if (len == 0) strcpy(name, "_");
+
+    const char* path = demux->path;
+    const char* ext = strrchr(path, '.');
+    const char* slash = strrchr(path, '/');
+    if (ext == NULL || (slash != NULL && ext < slash)) {
+        ext = path + strlen(path);
+    }
+    char* body_path = malloc(WRITER_PATH_MAX);
+    if (body_path == NULL) return NULL;
+    snprintf(
+        body_path,
+        WRITER_PATH_MAX,
+        "%.*s_%s%s",
+        (int)(ext - path),
+        path,
+        name,
+        ext
+    );
+    for (u32 i = 0; i < demux->count; ++i) {
+        if (strcmp(demux->paths[i], body_path) == 0) {
+            snprintf(
+                body_path,
+                WRITER_PATH_MAX,
+                "%.*s_%s_%u%s",
+                (int)(ext - path),
+                path,
+                name,
+                demux->count,
+                ext
+            );
+            break;
+        }
+    }
+    return body_path;
+}
+
+// Opens the stream for a body seen for the first time.  Returns its index,
+// or -1 if it can't be opened, which is remembered so the body's later
+// poses are dropped without trying, and logging, again.
+static i32 PoseDemux_add_body(PoseDemux* demux, IdHandle handle) {
+    demux->streams[handle] = DEMUX_STREAM_FAILED;
+    StringView id = IdTable_name(demux->ids, handle);
+    if (demux->count == DEMUX_MAX_BODIES) {
+        log_warn_fields(
+            "Too many bodies for a stream each, dropping its poses",
+            LOG_STRN("body", id.items, id.count)
+        );
+        return -1;
+    }
+    char* body_path = PoseDemux_body_path(demux, id);
+    if (body_path == NULL) {
+        log_error("PoseDemux: Out of memory");
+        return -1;
+    }
+    u32 index = demux->count;
+    if (PoseWriter_open(
+            &demux->writers[index], body_path, demux->config, demux->ids
+        ) != RETURN_OK) {
+        PoseWriter_close(&demux->writers[index]);
+        log_warn_fields(
+            "Can't open a stream for a body, dropping its poses",
+            LOG_STRN("body", id.items, id.count)
+        );
+        free(body_path);
+        return -1;
+    }
+    demux->paths[index] = body_path;
+    demux->streams[handle] = (u16)(index + 1);
+    demux->count++;
+    log_info_fields(
+        "New body stream",
+        LOG_STRN("body", id.items, id.count),
+        LOG_STR("path", body_path)
+    );
+    return (i32)index;
+}
+
+// Writes a pose at `now`, see PoseWriter_write
+CimplReturn PoseDemux_write(
+    PoseDemux* demux,
+    const PoseSample* sample,
+    u64 kernel_ns,
+    u64 user_ns,
+    u64 now
+) {
+    if (!demux->by_body) {
+        return PoseWriter_write(
+            &demux->writers[0], sample, kernel_ns, user_ns, now
+        );
+    }
+    u16 stream = demux->streams[sample->id];
+    i32 index = stream == DEMUX_STREAM_FAILED ? -1 : (i32)stream - 1;
+    if (stream == 0) index = PoseDemux_add_body(demux, sample->id);
+    if (index < 0) {
+        demux->dropped++;
+        return RETURN_OK;
+    }
+    return PoseWriter_write(
+        &demux->writers[index], sample, kernel_ns, user_ns, now
+    );
+}
+
+CimplReturn PoseDemux_tick(PoseDemux* demux, u64 now) {
+    CimplReturn result = RETURN_OK;
+    for (u32 i = 0; i < demux->count; ++i) {
+        if (PoseWriter_tick(&demux->writers[i], now) != RETURN_OK) {
+            result = RETURN_ERR;
+        }
+    }
+    return result;
+}
+
+// Latency over every stream
+void PoseDemux_latency(const PoseDemux* demux, LatencyStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (u32 i = 0; i < demux->count; ++i) {
+        const LatencyStats* writer = &demux->writers[i].latency;
+        for (u32 stage = 0; stage < LATENCY_STAGE_COUNT; ++stage) {
+            LatencyHist_merge(&stats->stages[stage], &writer->stages[stage]);
+        }
+    }
+}
+
+void PoseDemux_close(PoseDemux* demux) {
+    for (u32 i = 0; i < demux->count; ++i) {
+        PoseWriter_close(&demux->writers[i]);
+        if (demux->paths != NULL) free(demux->paths[i]);
+    }
+    if (demux->dropped > 0) {
+        log_warn_fields(
+            "Dropped poses of bodies without a stream",
+            LOG_U64("poses", demux->dropped),
+            LOG_U64("max_bodies", DEMUX_MAX_BODIES)
+        );
+    }
+    free(demux->writers);
+    free(demux->paths);
+    memset(demux, 0, sizeof(*demux));
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_DEMUX_H */
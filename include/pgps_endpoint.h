@@ -0,0 +1,274 @@
+#ifndef PGPS_ENDPOINT_H
+#define PGPS_ENDPOINT_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "cimpl_network.h"
+#include "pgps_filter.h"
+#include "pgps_intern.h"
+#include "pgps_listener.h"
+#include "pgps_rcvbuf.h"
+#include "pgps_receiver.h"
+
+#define ENDPOINT_MAX 16
+// Room for `255.255.255.255:65535@255.255.255.255`
+#define ENDPOINT_STR_SIZE 40
+
+// One address to listen on.  A multicast address is joined on `iface`, the
+// local address of the interface to join on, or 0 for the kernel's choice.
+typedef struct EndpointSpec {
+    IpV4Addr addr;
+    u32 iface;
+} EndpointSpec;
+
+// How every endpoint's socket and receiver are set up
+typedef struct EndpointConfig {
+    RecvBackend backend;
+    u32 batch_size;
+    bool timestamps;
+    RcvBufConfig rcvbuf;
+    const SocketFilter* filter;
+    // Shared by all endpoints
+    IdTable* ids;
+    // Of the one thread receiving on every endpoint, NULL when not published
+    StageStats* timing;
+} EndpointConfig;
+
+typedef struct Endpoint {
+    EndpointSpec spec;
+    isize socket_fd;
+    Receiver rx;
+    // Taken out of the epoll set after a receive error
+    bool removed;
+} Endpoint;
+
+// Several sockets multiplexed through one epoll instance on the calling
+// thread.  Each endpoint keeps its own receive stats.
+typedef struct EndpointSet {
+    Endpoint endpoints[ENDPOINT_MAX];
+    u32 count;
+    // Endpoints still waited on
+    u32 active;
+    i32 epoll_fd;
+    struct epoll_event events[ENDPOINT_MAX];
+} EndpointSet;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn EndpointSpec_from_str(EndpointSpec*, const char*);
+bool EndpointSpec_is_multicast(const EndpointSpec*);
+void EndpointSpec_format(const EndpointSpec*, char*, usize);
+CimplReturn EndpointSpec_join(const EndpointSpec*, isize);
+
+CimplReturn EndpointSet_open(
+    EndpointSet*, const EndpointSpec*, u32, EndpointConfig
+);
+i32 EndpointSet_wait(EndpointSet*, i32, Endpoint**);
+u32 EndpointSet_remove(EndpointSet*, Endpoint*);
+void EndpointSet_print(const EndpointSet*, FILE*);
+void EndpointSet_close(EndpointSet*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+/* EndpointSpec */
+
+// Parses `ADDR:PORT`, optionally followed by `@IFACE_ADDR` for multicast
+CimplReturn EndpointSpec_from_str(EndpointSpec* spec, const char* text) {
+    memset(spec, 0, sizeof(*spec));
+    char addr[ENDPOINT_STR_SIZE];
+    const char* at = strchr(text, '@');
+    usize len = at != NULL ? (usize)(at - text) : strlen(text);
+    if (len >= sizeof(addr)) {
+        log_error("Invalid endpoint %s", text);
+        return RETURN_ERR;
+    }
+    memcpy(addr, text, len);
+    addr[len] = '\0';
+    if (parse_ip_str(&spec->addr, addr) != 0) return RETURN_ERR;
+    if (at != NULL) {
+        struct in_addr iface;
+        if (inet_pton(AF_INET, at + 1, &iface) != 1) {
+            log_error("Invalid interface address %s", at + 1);
+            return RETURN_ERR;
+        }
+        spec->iface = ntohl(iface.s_addr);
+    }
+    return RETURN_OK;
+}
+
+bool EndpointSpec_is_multicast(const EndpointSpec* spec) {
+    return IN_MULTICAST(spec->addr.addr);
+}
+
+void EndpointSpec_format(const EndpointSpec* spec, char* out, usize size) {
+    struct in_addr in = {.s_addr = htonl(spec->addr.addr)};
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    if (spec->iface == 0) {
+        snprintf(out, size, "%s:%u", addr, spec->addr.port);
+        return;
+    }
+    struct in_addr iface_in = {.s_addr = htonl(spec->iface)};
+    char iface[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &iface_in, iface, sizeof(iface));
+    snprintf(out, size, "%s:%u@%s", addr, spec->addr.port, iface);
+}
+
+// Joins the endpoint's group on a socket bound to it.  Nothing to do for a
+// unicast endpoint.
+CimplReturn EndpointSpec_join(const EndpointSpec* spec, isize socket_fd) {
+    if (!EndpointSpec_is_multicast(spec)) return RETURN_OK;
+    struct ip_mreqn mreq = {0};
+    mreq.imr_multiaddr.s_addr = htonl(spec->addr.addr);
+    mreq.imr_address.s_addr = htonl(spec->iface);
+    if (setsockopt(
+            socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)
+        ) < 0) {
+        char name[ENDPOINT_STR_SIZE];
+        EndpointSpec_format(spec, name, sizeof(name));
+        log_error("Failed to join %s: %s", name, strerror(errno));
+        return RETURN_ERR;
+    }
+    // Binding to the group already narrows delivery to it, this also keeps
+    // out groups joined by other sockets on the same port
+    int all = 0;
+    setsockopt(socket_fd, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+    return RETURN_OK;
+}
+
+/* EndpointSet */
+
+static CimplReturn EndpointSet_add(
+    EndpointSet* set, const EndpointSpec* spec, EndpointConfig config
+) {
+    Endpoint* endpoint = &set->endpoints[set->count];
+    endpoint->spec = *spec;
+    if (udp_listener_open(
+            &endpoint->socket_fd, spec->addr, 0, 0, false, config.filter
+        ) != EXIT_SUCCESS) {
+        return RETURN_ERR;
+    }
+    // epoll says when to receive, the receive itself must never block
+    int flags = fcntl(endpoint->socket_fd, F_GETFL);
+    if (EndpointSpec_join(spec, endpoint->socket_fd) != RETURN_OK ||
+        fcntl(endpoint->socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(endpoint->socket_fd);
+        return RETURN_ERR;
+    }
+    if (Receiver_init(
+            &endpoint->rx,
+            config.backend,
+            endpoint->socket_fd,
+            config.ids,
+            config.batch_size,
+            0,
+            config.timestamps,
+            config.rcvbuf
+        ) != RETURN_OK) {
+        close(endpoint->socket_fd);
+        return RETURN_ERR;
+    }
+    endpoint->rx.timing = config.timing;
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = endpoint,
+    };
+    if (epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, endpoint->socket_fd, &event) <
+        0) {
+        perror("epoll_ctl");
+        Receiver_free(&endpoint->rx);
+        close(endpoint->socket_fd);
+        return RETURN_ERR;
+    }
+    set->count++;
+    return RETURN_OK;
+}
+
+// Opens a socket per endpoint, joining multicast groups, and registers them
+// all with one epoll instance.  On failure everything opened is closed.
+CimplReturn EndpointSet_open(
+    EndpointSet* set,
+    const EndpointSpec* specs,
+    u32 count,
+    EndpointConfig config
+) {
+    memset(set, 0, sizeof(*set));
+    if (count == 0 || count > ENDPOINT_MAX) {
+        log_error(
+            "Endpoint count %u must be between 1 and %d", count, ENDPOINT_MAX
+        );
+        return RETURN_ERR;
+    }
+    if (config.backend == RECV_BACKEND_URING) {
+        log_error("The uring backend can't share an epoll loop");
+        return RETURN_ERR;
+    }
+    set->epoll_fd = epoll_create1(0);
+    if (set->epoll_fd < 0) {
+        perror("epoll_create1");
+        return RETURN_ERR;
+    }
+    for (u32 i = 0; i < count; ++i) {
+        if (EndpointSet_add(set, &specs[i], config) != RETURN_OK) {
+            EndpointSet_close(set);
+            return RETURN_ERR;
+        }
+    }
+    set->active = set->count;
+    return RETURN_OK;
+}
+
+// Waits up to `timeout_ms` (-1 forever) for endpoints with datagrams queued
+// and points `ready` at them.  Returns how many, 0 on timeout, or -1 with
+// errno set.
+i32 EndpointSet_wait(EndpointSet* set, i32 timeout_ms, Endpoint** ready) {
+    i32 n = epoll_wait(set->epoll_fd, set->events, (i32)set->count, timeout_ms);
+    for (i32 i = 0; i < n; ++i) ready[i] = set->events[i].data.ptr;
+    return n;
+}
+
+// Stops waiting on `endpoint`, e.g. after a receive error that would keep
+// it readable forever.  Its socket stays open until EndpointSet_close and
+// its stats are still printed.  Returns how many endpoints are left.
+u32 EndpointSet_remove(EndpointSet* set, Endpoint* endpoint) {
+    if (endpoint->removed) return set->active;
+    if (epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, endpoint->socket_fd, NULL) <
+        0) {
+        perror("epoll_ctl");
+    }
+    endpoint->removed = true;
+    return --set->active;
+}
+
+void EndpointSet_print(const EndpointSet* set, FILE* fp) {
+    RecvStats total = {0};
+    for (u32 i = 0; i < set->count; ++i) {
+        const Endpoint* endpoint = &set->endpoints[i];
+        char name[ENDPOINT_STR_SIZE];
+        EndpointSpec_format(&endpoint->spec, name, sizeof(name));
+        fprintf(fp, "Endpoint %s: ", name);
+        RecvStats_print(&endpoint->rx.stats, fp);
+        RecvStats_merge(&total, &endpoint->rx.stats);
+    }
+    fprintf(fp, "All endpoints: ");
+    RecvStats_print(&total, fp);
+}
+
+void EndpointSet_close(EndpointSet* set) {
+    for (u32 i = 0; i < set->count; ++i) {
+        Receiver_free(&set->endpoints[i].rx);
+        close(set->endpoints[i].socket_fd);
+    }
+    if (set->epoll_fd >= 0) close(set->epoll_fd);
+    memset(set, 0, sizeof(*set));
+    set->epoll_fd = -1;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_ENDPOINT_H */
@@ -0,0 +1,238 @@
+#ifndef PGPS_FILTER_H
+#define PGPS_FILTER_H
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#include "cimpl_core.h"
+#include "pgps_wire.h"
+
+#define FILTER_SUBNET_MAX 16
+// Length the filter sees: the UDP header and the payload
+#define FILTER_UDP_HEADER_SIZE 8
+// Offset of the IPv4 source address from the network header
+#define FILTER_IP_SOURCE 12
+// Length check, source load, three per subnet, accept and reject
+#define FILTER_PROGRAM_MAX (6 + 3 * FILTER_SUBNET_MAX)
+
+// IPv4 network in host byte order
+typedef struct Subnet {
+    u32 addr;
+    u32 mask;
+} Subnet;
+
+// What a socket accepts in-kernel.  Datagrams of any other length or from
+// outside every subnet are dropped before they wake the process.  No subnets
+// allows every source.
+typedef struct SocketFilter {
+    bool enabled;
+    u32 wire_size;
+    Subnet subnets[FILTER_SUBNET_MAX];
+    u32 subnet_count;
+} SocketFilter;
+
+// System-wide UDP counters from /proc/net/snmp.  The kernel counts a socket
+// filter drop as an input error, like a full receive buffer, and it feeds
+// the same per-socket SO_RXQ_OVFL count, so only these tell them apart.
+typedef struct UdpCounters {
+    u64 in_errors;
+    u64 rcvbuf_errors;
+    u64 csum_errors;
+} UdpCounters;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn Subnet_from_str(Subnet*, const char*);
+void Subnet_format(const Subnet*, char*, usize);
+
+void SocketFilter_init(SocketFilter*);
+CimplReturn SocketFilter_allow(SocketFilter*, const char*);
+u32 SocketFilter_compile(const SocketFilter*, struct sock_filter*);
+CimplReturn SocketFilter_attach(const SocketFilter*, isize);
+void SocketFilter_print(const SocketFilter*, FILE*);
+
+CimplReturn UdpCounters_read(UdpCounters*);
+u64 UdpCounters_filtered(const UdpCounters*, const UdpCounters*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+/* Subnet */
+
+// Parses `a.b.c.d/n`, or a bare address as a /32
+CimplReturn Subnet_from_str(Subnet* subnet, const char* text) {
+    char addr[INET_ADDRSTRLEN];
+    const char* slash = strchr(text, '/');
+    usize len = slash != NULL ? (usize)(slash - text) : strlen(text);
+    if (len >= sizeof(addr)) return RETURN_ERR;
+    memcpy(addr, text, len);
+    addr[len] = '\0';
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr, &in) != 1) return RETURN_ERR;
+
+    u32 prefix = 32;
+    if (slash != NULL) {
+        char* end;
+        prefix = (u32)strtoul(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || prefix > 32) {
+            return RETURN_ERR;
+        }
+    }
+    subnet->mask = prefix == 0 ? 0 : ~0u << (32 - prefix);
+    subnet->addr = ntohl(in.s_addr) & subnet->mask;
+    return RETURN_OK;
+}
+
+void Subnet_format(const Subnet* subnet, char* out, usize size) {
+    struct in_addr in = {.s_addr = htonl(subnet->addr)};
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    snprintf(out, size, "%s/%d", addr, __builtin_popcount(subnet->mask));
+}
+
+/* SocketFilter */
+
+void SocketFilter_init(SocketFilter* filter) {
+    memset(filter, 0, sizeof(*filter));
+    filter->wire_size = POSE_WIRE_SIZE;
+}
+
+// Adds a source subnet and turns the filter on
+CimplReturn SocketFilter_allow(SocketFilter* filter, const char* text) {
+    if (filter->subnet_count == FILTER_SUBNET_MAX) {
+        log_error("At most %d subnets can be allowed", FILTER_SUBNET_MAX);
+        return RETURN_ERR;
+    }
+    if (Subnet_from_str(&filter->subnets[filter->subnet_count], text) !=
+        RETURN_OK) {
+        log_error("Invalid subnet %s", text);
+        return RETURN_ERR;
+    }
+    filter->subnet_count++;
+    filter->enabled = true;
+    return RETURN_OK;
+}
+
+// Writes the classic BPF program into `program`, which must have room for
+// FILTER_PROGRAM_MAX instructions, and returns its length.  A socket filter
+// on UDP starts at the UDP header, so the source address is loaded relative
+// to the network header instead.
+u32 SocketFilter_compile(
+    const SocketFilter* filter, struct sock_filter* program
+) {
+    u32 subnets = filter->subnet_count;
+    // Accept sits right before reject at the end
+    u32 reject = subnets > 0 ? 3 * subnets + 4 : 3;
+    u32 n = 0;
+    program[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+    program[n] = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JEQ | BPF_K,
+        FILTER_UDP_HEADER_SIZE + filter->wire_size,
+        0,
+        (u8)(reject - n - 1)
+    );
+    n++;
+    if (subnets > 0) {
+        program[n++] = (struct sock_filter)BPF_STMT(
+            BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + FILTER_IP_SOURCE
+        );
+        program[n++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+    }
+    for (u32 i = 0; i < subnets; ++i) {
+        const Subnet* subnet = &filter->subnets[i];
+        if (i > 0) {
+            program[n++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TXA, 0);
+        }
+        program[n++] = (struct sock_filter)BPF_STMT(
+            BPF_ALU | BPF_AND | BPF_K, subnet->mask
+        );
+        // A match jumps to accept, a miss on the last subnet to reject
+        program[n] = (struct sock_filter)BPF_JUMP(
+            BPF_JMP | BPF_JEQ | BPF_K,
+            subnet->addr,
+            (u8)(reject - n - 2),
+            i + 1 < subnets ? 0 : (u8)(reject - n - 1)
+        );
+        n++;
+    }
+    // Keep the whole datagram
+    program[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+    program[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    return n;
+}
+
+CimplReturn SocketFilter_attach(const SocketFilter* filter, isize socket_fd) {
+    struct sock_filter program[FILTER_PROGRAM_MAX];
+    struct sock_fprog fprog = {
+        .len = (unsigned short)SocketFilter_compile(filter, program),
+        .filter = program,
+    };
+    if (setsockopt(
+            socket_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)
+        ) < 0) {
+        log_error("Failed to attach socket filter: %s", strerror(errno));
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+void SocketFilter_print(const SocketFilter* filter, FILE* fp) {
+    fprintf(fp, "Socket filter: %u-byte datagrams", filter->wire_size);
+    for (u32 i = 0; i < filter->subnet_count; ++i) {
+        char subnet[INET_ADDRSTRLEN + 4];
+        Subnet_format(&filter->subnets[i], subnet, sizeof(subnet));
+        fprintf(fp, "%s %s", i == 0 ? " from" : ",", subnet);
+    }
+    fprintf(fp, "\n");
+}
+
+/* UdpCounters */
+
+CimplReturn UdpCounters_read(UdpCounters* counters) {
+    memset(counters, 0, sizeof(*counters));
+    FILE* fp = fopen("/proc/net/snmp", "r");
+    if (fp == NULL) return RETURN_ERR;
+    // A line of field names, then a line of values
+    char names[1024];
+    char values[1024];
+    CimplReturn result = RETURN_ERR;
+    while (fgets(names, sizeof(names), fp) != NULL) {
+        if (strncmp(names, "Udp:", 4) != 0) continue;
+        if (fgets(values, sizeof(values), fp) == NULL) break;
+        char* name_save;
+        char* value_save;
+        char* name = strtok_r(names, " \n", &name_save);
+        char* value = strtok_r(values, " \n", &value_save);
+        while (name != NULL && value != NULL) {
+            u64 count = strtoull(value, NULL, 10);
+            if (strcmp(name, "InErrors") == 0) {
+                counters->in_errors = count;
+            } else if (strcmp(name, "RcvbufErrors") == 0) {
+                counters->rcvbuf_errors = count;
+            } else if (strcmp(name, "InCsumErrors") == 0) {
+                counters->csum_errors = count;
+            }
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+        }
+        result = RETURN_OK;
+        break;
+    }
+    fclose(fp);
+    return result;
+}
+
+// Input errors between the two reads that weren't a full receive buffer or
+// a bad checksum.  System-wide, so other UDP sockets' filters count too.
+u64 UdpCounters_filtered(const UdpCounters* start, const UdpCounters* end) {
+    u64 errors = end->in_errors - start->in_errors;
+    u64 other = (end->rcvbuf_errors - start->rcvbuf_errors) +
+                (end->csum_errors - start->csum_errors);
+    return errors > other ? errors - other : 0;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_FILTER_H */
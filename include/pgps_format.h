@@ -0,0 +1,130 @@
+#ifndef PGPS_FORMAT_H
+#define PGPS_FORMAT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cimpl_core.h"
+
+// Longest `%12.6f` of any f32 (sign, 39 integer digits, point, 6 decimals)
+// plus the terminator snprintf needs on the slow path
+#define FORMAT_F32_FIXED6_MAX 48
+// Longest `%d`
+#define FORMAT_I32_MAX 11
+// Magnitudes below this take the integer fast path, the rest go to snprintf
+#define FORMAT_FIXED6_LIMIT 0x1p40
+
+/*** FUNCTION DECLARATIONS ***/
+
+usize format_f32_fixed6(char*, f32);
+usize format_i32(char*, i32);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+static const char FORMAT_DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the decimal digits of `value` so they end just before `end`.
+// Returns a pointer to the first digit.
+static inline char* format_u64_backward(char* end, u64 value) {
+    while (value >= 100) {
+        u32 pair = (u32)(value % 100) * 2;
+        value /= 100;
+        *--end = FORMAT_DIGIT_PAIRS[pair + 1];
+        *--end = FORMAT_DIGIT_PAIRS[pair];
+    }
+    if (value >= 10) {
+        u32 pair = (u32)value * 2;
+        *--end = FORMAT_DIGIT_PAIRS[pair + 1];
+        *--end = FORMAT_DIGIT_PAIRS[pair];
+    } else {
+        *--end = (char)('0' + value);
+    }
+    return end;
+}
+
+// Writes `value` exactly as printf("%12.6f", value) would, without the
+// terminator, and returns the length.  `out` needs FORMAT_F32_FIXED6_MAX
+// bytes.  Rounds half to even on the exact binary value like glibc does.
+usize format_f32_fixed6(char* out, f32 value) {
+    f64 magnitude = value < 0 ? -(f64)value : (f64)value;
+    if (!(magnitude < FORMAT_FIXED6_LIMIT)) {
+        // NaN, infinities and huge values are rare enough for stdio
+        return (usize)snprintf(out, FORMAT_F32_FIXED6_MAX, "%12.6f", value);
+    }
+
+    // value = mantissa * 2^exponent, exactly
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bool negative = (bits >> 31) != 0;
+    i32 exponent = (i32)((bits >> 23) & 0xff);
+    u64 mantissa = bits & 0x7fffff;
+    if (exponent == 0) {
+        exponent = 1;
+    } else {
+        mantissa |= 1u << 23;
+    }
+    exponent -= 150;
+
+    // Scaled by 10^6 the mantissa needs at most 44 bits, so every shift
+    // below stays exact and the rounding sees the whole remainder
+    u64 scaled = mantissa * 1000000;
+    u64 micros;
+    if (exponent >= 0) {
+        micros = scaled << exponent;
+    } else if (exponent < -44) {
+        micros = 0;
+    } else {
+        u32 shift = (u32)-exponent;
+        u64 rem = scaled & ((1ull << shift) - 1);
+        u64 half = 1ull << (shift - 1);
+        micros = scaled >> shift;
+        if (rem > half || (rem == half && (micros & 1))) micros++;
+    }
+
+    char digits[FORMAT_F32_FIXED6_MAX];
+    char* end = digits + sizeof(digits);
+    u32 frac = (u32)(micros % 1000000);
+    for (u32 i = 0; i < 3; ++i) {
+        u32 pair = (frac % 100) * 2;
+        frac /= 100;
+        *--end = FORMAT_DIGIT_PAIRS[pair + 1];
+        *--end = FORMAT_DIGIT_PAIRS[pair];
+    }
+    *--end = '.';
+    char* start = format_u64_backward(end, micros / 1000000);
+    if (negative) *--start = '-';
+
+    usize len = (usize)(digits + sizeof(digits) - start);
+    usize pad = len < 12 ? 12 - len : 0;
+    memset(out, ' ', pad);
+    memcpy(out + pad, start, len);
+    return pad + len;
+}
+
+// Writes `value` exactly as printf("%d", value) would, without the
+// terminator, and returns the length.  `out` needs FORMAT_I32_MAX bytes.
+usize format_i32(char* out, i32 value) {
+    char digits[FORMAT_I32_MAX];
+    char* end = digits + sizeof(digits);
+    u64 magnitude = value < 0 ? (u64)(-(i64)value) : (u64)value;
+    char* start = format_u64_backward(end, magnitude);
+    if (value < 0) *--start = '-';
+    usize len = (usize)(end - start);
+    memcpy(out, start, len);
+    return len;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_FORMAT_H */
@@ -0,0 +1,344 @@
+#ifndef PGPS_GEN_H
+#define PGPS_GEN_H
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "cimpl_network.h"
+#include "pgps_iso8601.h"
+#include "pgps_pcap.h"
+#include "pgps_pose.h"
+#include "pgps_time.h"
+#include "pgps_wire.h"
+
+#define GEN_DEFAULT_RATE 1000.0
+#define GEN_DEFAULT_BODIES 3
+#define GEN_BURST_MAX 1024
+// Bodies trace circles this big around their own centre, metres
+#define GEN_RADIUS 0.5f
+// Source port of the datagrams in a capture
+#define GEN_CAPTURE_SRC_PORT 49152
+
+// What to send.  Poses go round-robin over the bodies, so each body sees
+// `rate / bodies` poses a second.
+typedef struct GenConfig {
+    IpV4Addr dst;
+    // Poses per second over all bodies, 0 as fast as the socket takes them
+    f64 rate;
+    u32 bodies;
+    // Poses sent back to back per sendmmsg, then a pause that keeps the
+    // average at `rate`
+    u32 burst;
+    // Fraction of poses deliberately never sent
+    f64 loss;
+    // Fraction of poses held back and sent after their body's next one
+    f64 reorder;
+    // Stop after this many poses, or this many seconds, whichever is first.
+    // 0 is no limit.
+    u64 count;
+    f64 seconds;
+    u64 seed;
+    // Write the datagrams to this capture instead of sending them.  Nothing
+    // is paced, each is stamped with when it was due.  Needs a rate.
+    const char* capture_path;
+} GenConfig;
+
+typedef struct GenStats {
+    // Poses generated, including lost ones
+    u64 generated;
+    u64 sent;
+    u64 lost;
+    u64 reordered;
+    // Refused by the socket, e.g. nothing listening yet
+    u64 send_errors;
+    u64 syscalls;
+    f64 seconds;
+} GenStats;
+
+typedef struct Generator {
+    GenConfig config;
+    i32 socket_fd;
+    PcapWriter capture;
+    u64 rng;
+    // A burst, one more for a held-back pose released at its end, and the
+    // held-back pose itself
+    u8* wire;
+    struct iovec* iovecs;
+    struct mmsghdr* msgs;
+    bool holding;
+    // The held-back pose goes out behind the pose with this index
+    u64 release_index;
+    u64 start_ns;
+    i64 start_wall_ns;
+    GenStats stats;
+} Generator;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn Generator_init(Generator*, GenConfig);
+CimplReturn Generator_run(Generator*, const volatile sig_atomic_t*);
+void Generator_free(Generator*);
+void GenStats_print(const GenStats*, FILE*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+// xorshift64*, uniform in [0, 1)
+static f64 Generator_random(Generator* gen) {
+    gen->rng ^= gen->rng >> 12;
+    gen->rng ^= gen->rng << 25;
+    gen->rng ^= gen->rng >> 27;
+    return (f64)((gen->rng * 0x2545f4914f6cdd1dull) >> 11) * 0x1.0p-53;
+}
+
+CimplReturn Generator_init(Generator* gen, GenConfig config) {
+    memset(gen, 0, sizeof(*gen));
+    gen->socket_fd = -1;
+    if (config.bodies == 0) config.bodies = 1;
+    if (config.burst == 0) config.burst = 1;
+    if (config.burst > GEN_BURST_MAX) {
+        log_error(
+            "Burst %u is over the maximum %d", config.burst, GEN_BURST_MAX
+        );
+        return RETURN_ERR;
+    }
+    gen->config = config;
+    gen->rng = config.seed != 0 ? config.seed : 0x9e3779b97f4a7c15ull;
+
+    if (config.capture_path != NULL) {
+        if (config.rate <= 0.0) {
+            log_error("A capture needs a rate to stamp its poses with");
+            return RETURN_ERR;
+        }
+        if (PcapWriter_open(&gen->capture, config.capture_path) !=
+            RETURN_OK) {
+            return RETURN_ERR;
+        }
+    } else {
+        gen->socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in dst = {0};
+        dst.sin_family = AF_INET;
+        dst.sin_addr.s_addr = htonl(config.dst.addr);
+        dst.sin_port = htons(config.dst.port);
+        if (gen->socket_fd < 0 ||
+            connect(gen->socket_fd, (struct sockaddr*)&dst, sizeof(dst)) <
+                0) {
+            perror("connect");
+            Generator_free(gen);
+            return RETURN_ERR;
+        }
+    }
+
+    u32 slots = GEN_BURST_MAX + 2;
+    gen->wire = calloc(slots, POSE_WIRE_SIZE);
+    gen->iovecs = calloc(slots, sizeof(struct iovec));
+    gen->msgs = calloc(slots, sizeof(struct mmsghdr));
+    if (gen->wire == NULL || gen->iovecs == NULL || gen->msgs == NULL) {
+        log_error("Generator_init: Out of memory");
+        Generator_free(gen);
+        return RETURN_ERR;
+    }
+    for (u32 i = 0; i < slots; ++i) {
+        gen->iovecs[i].iov_base = gen->wire + (usize)i * POSE_WIRE_SIZE;
+        gen->iovecs[i].iov_len = POSE_WIRE_SIZE;
+        gen->msgs[i].msg_hdr.msg_iov = &gen->iovecs[i];
+        gen->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return RETURN_OK;
+}
+
+// Encodes pose number `index` into `wire`.  Its sender timestamp is when it
+// was due, so every body's timestamps step evenly whatever the pacing did.
+static void Generator_encode(Generator* gen, u64 index, u8* wire) {
+    const GenConfig* config = &gen->config;
+    u32 body = (u32)(index % config->bodies);
+    i64 due_ns = gen->start_wall_ns;
+    if (config->rate > 0.0) {
+        due_ns += (i64)((f64)index * 1e9 / config->rate);
+    } else {
+        due_ns = (i64)realtime_ns();
+    }
+    f32 angle = (f32)(index / config->bodies) * 0.01f;
+    Pose pose = {0};
+    snprintf(pose.id, sizeof(pose.id), "body%u", body);
+    iso8601_format_ns(pose.timestamp, due_ns);
+    pose.position = (Vec3){
+        (f32)body + GEN_RADIUS * cosf(angle),
+        GEN_RADIUS * sinf(angle),
+        1.0f,
+    };
+    // Yaw following the circle
+    pose.rotation = (Quat){0.0f, 0.0f, sinf(angle / 2), cosf(angle / 2)};
+    pose.confidence = 100;
+    pose.trigger_activated = index % 100 == 0;
+    Pose_encode(&pose, wire);
+}
+
+// Generates the next `count` poses, applying loss and reorder, and returns
+// how many slots are ready to send: up to `count + 1` with a held-back pose
+// released behind the last one.
+static u32 Generator_fill(Generator* gen, u32 count) {
+    const GenConfig* config = &gen->config;
+    u8* held = gen->wire + (usize)(GEN_BURST_MAX + 1) * POSE_WIRE_SIZE;
+    u32 filled = 0;
+    for (u32 i = 0; i < count; ++i) {
+        u64 index = gen->stats.generated++;
+        if (config->loss > 0.0 && Generator_random(gen) < config->loss) {
+            gen->stats.lost++;
+            continue;
+        }
+        u8* slot = gen->wire + (usize)filled * POSE_WIRE_SIZE;
+        if (!gen->holding && config->reorder > 0.0 &&
+            Generator_random(gen) < config->reorder) {
+            Generator_encode(gen, index, held);
+            gen->holding = true;
+            gen->release_index = index + config->bodies;
+            gen->stats.reordered++;
+            continue;
+        }
+        Generator_encode(gen, index, slot);
+        filled++;
+        if (gen->holding && index >= gen->release_index) {
+            memcpy(
+                gen->wire + (usize)filled * POSE_WIRE_SIZE,
+                held,
+                POSE_WIRE_SIZE
+            );
+            gen->holding = false;
+            filled++;
+        }
+    }
+    return filled;
+}
+
+// Appends the first `count` slots to the capture, stamped `due_ns`
+// (monotonic) on the sender's wall clock
+static void Generator_capture(Generator* gen, u32 count, u64 due_ns) {
+    PcapPacket packet = {
+        .ts_ns = (u64)gen->start_wall_ns + (due_ns - gen->start_ns),
+        .src_addr = gen->config.dst.addr,
+        .dst_addr = gen->config.dst.addr,
+        .src_port = GEN_CAPTURE_SRC_PORT,
+        .dst_port = gen->config.dst.port,
+        .len = POSE_WIRE_SIZE,
+    };
+    for (u32 i = 0; i < count; ++i) {
+        packet.payload = gen->wire + (usize)i * POSE_WIRE_SIZE;
+        if (PcapWriter_write(&gen->capture, &packet) != RETURN_OK) {
+            gen->stats.send_errors++;
+            continue;
+        }
+        gen->stats.sent++;
+    }
+}
+
+// Sends the first `count` slots, or captures them as sent at `due_ns`
+static void Generator_send(Generator* gen, u32 count, u64 due_ns) {
+    if (gen->capture.fp != NULL) {
+        Generator_capture(gen, count, due_ns);
+        return;
+    }
+    u32 done = 0;
+    while (done < count) {
+        int n = sendmmsg(gen->socket_fd, gen->msgs + done, count - done, 0);
+        gen->stats.syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // ECONNREFUSED from an earlier datagram, the rest still go
+            gen->stats.send_errors++;
+            done++;
+            continue;
+        }
+        done += (u32)n;
+        gen->stats.sent += (u64)n;
+    }
+}
+
+// Sends until the count or duration runs out or `*stop` is set
+CimplReturn Generator_run(Generator* gen, const volatile sig_atomic_t* stop) {
+    const GenConfig* config = &gen->config;
+    gen->start_ns = monotonic_ns();
+    gen->start_wall_ns = (i64)realtime_ns();
+    u64 end_ns = config->seconds > 0.0
+                     ? gen->start_ns + (u64)(config->seconds * 1e9)
+                     : UINT64_MAX;
+    u64 due = gen->start_ns;
+    while (stop == NULL || !*stop) {
+        if (config->rate > 0.0) {
+            due = gen->start_ns +
+                  (u64)((f64)gen->stats.generated * 1e9 / config->rate);
+        }
+        // A capture isn't paced, it runs on the poses' own schedule
+        u64 now = gen->capture.fp != NULL ? due : monotonic_ns();
+        if (now >= end_ns) break;
+        u32 burst = config->burst;
+        if (config->count != 0) {
+            if (gen->stats.generated >= config->count) break;
+            u64 left = config->count - gen->stats.generated;
+            if (left < burst) burst = (u32)left;
+        }
+        if (config->rate > 0.0) {
+            // Sleep until the first pose of this burst is due
+            if (due > now) {
+                struct timespec ts = {
+                    .tv_sec = (time_t)(due / NS_PER_SEC),
+                    .tv_nsec = (long)(due % NS_PER_SEC),
+                };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+        }
+        u32 filled = Generator_fill(gen, burst);
+        Generator_send(gen, filled, due);
+    }
+    // A pose still held back goes out last
+    if (gen->holding) {
+        memcpy(
+            gen->wire,
+            gen->wire + (usize)(GEN_BURST_MAX + 1) * POSE_WIRE_SIZE,
+            POSE_WIRE_SIZE
+        );
+        gen->holding = false;
+        Generator_send(gen, 1, due);
+    }
+    gen->stats.seconds = (f64)(monotonic_ns() - gen->start_ns) / 1e9;
+    return RETURN_OK;
+}
+
+void Generator_free(Generator* gen) {
+    if (gen->socket_fd >= 0) close(gen->socket_fd);
+    PcapWriter_close(&gen->capture);
+    free(gen->wire);
+    free(gen->iovecs);
+    free(gen->msgs);
+    memset(gen, 0, sizeof(*gen));
+    gen->socket_fd = -1;
+}
+
+void GenStats_print(const GenStats* stats, FILE* fp) {
+    f64 rate = stats->seconds > 0.0 ? (f64)stats->sent / stats->seconds : 0.0;
+    fprintf(
+        fp,
+        "Sent %lu of %lu poses in %.3f s (%.0f/s, %lu syscalls): "
+        "%lu lost, %lu reordered, %lu send errors\n",
+        stats->sent,
+        stats->generated,
+        stats->seconds,
+        rate,
+        stats->syscalls,
+        stats->lost,
+        stats->reordered,
+        stats->send_errors
+    );
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_GEN_H */
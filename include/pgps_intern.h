@@ -0,0 +1,204 @@
+#ifndef PGPS_INTERN_H
+#define PGPS_INTERN_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "cimpl_core.h"
+#include "cimpl_string.h"
+
+#define ID_KEY_SIZE 32
+// Distinct ids a run can see.  Handles are dense, 0 .. ID_TABLE_CAPACITY-1.
+#define ID_TABLE_CAPACITY 1024
+// Twice the capacity, so the table is never more than half full
+#define ID_TABLE_SLOTS (2 * ID_TABLE_CAPACITY)
+// Room for every name at the String's first capacity, which fits any id
+#define ID_NAMES_ARENA_SIZE (ID_TABLE_CAPACITY * DEFAULT_ARRAY_CAPACITY)
+#define ID_HANDLE_INVALID UINT16_MAX
+
+// Small integer standing in for a pose id everywhere past the decoder
+typedef u16 IdHandle;
+
+// A pose id normalised for hashing: everything after the terminator is zero
+typedef struct IdKey {
+    u8 bytes[ID_KEY_SIZE];
+} IdKey;
+
+// Maps ids to handles in order of first sight.  Any number of receive
+// threads can intern at once: lookups are lock-free and only a miss takes
+// the lock.  Nothing is ever removed or moved, so a handle's key and name
+// stay valid for the life of the table.
+typedef struct IdTable {
+    // hash << 32 | (handle + 1), 0 when empty.  Stored with release order
+    // after the key and name it points at.
+    u64 slots[ID_TABLE_SLOTS];
+    IdKey keys[ID_TABLE_CAPACITY];
+    // Reserved up front so the array never moves under a reader
+    StringArray names;
+    // Backs every name, so interning a new id doesn't go to the heap and
+    // the names go in one free
+    Arena names_arena;
+    u32 count;
+    pthread_mutex_t lock;
+} IdTable;
+
+/*** FUNCTION DECLARATIONS ***/
+
+void IdKey_from_id(IdKey*, const char*);
+u32 IdKey_hash(const IdKey*);
+bool IdKey_equal(const IdKey*, const IdKey*);
+
+CimplReturn IdTable_init(IdTable*);
+IdHandle IdTable_intern(IdTable*, const char*);
+StringView IdTable_name(const IdTable*, IdHandle);
+u32 IdTable_count(const IdTable*);
+void IdTable_free(IdTable*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+/* IdKey */
+
+// `id` is read up to its terminator or ID_KEY_SIZE bytes, whichever is first
+void IdKey_from_id(IdKey* key, const char* id) {
+    usize len = strnlen(id, ID_KEY_SIZE);
+    memcpy(key->bytes, id, len);
+    memset(key->bytes + len, 0, ID_KEY_SIZE - len);
+}
+
+// Folds the key a word at a time with a multiply-xorshift mix
+u32 IdKey_hash(const IdKey* key) {
+    u64 hash = 0x9e3779b97f4a7c15ull;
+    for (u32 i = 0; i < ID_KEY_SIZE; i += sizeof(u64)) {
+        u64 word;
+        memcpy(&word, key->bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    return (u32)hash;
+}
+
+// One 256-bit compare with AVX2, two 128-bit with SSE2
+bool IdKey_equal(const IdKey* a, const IdKey* b) {
+#if defined(__AVX2__)
+    __m256i va = _mm256_loadu_si256((const __m256i*)a->bytes);
+    __m256i vb = _mm256_loadu_si256((const __m256i*)b->bytes);
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) == -1;
+#elif defined(__SSE2__)
+    __m128i lo = _mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i*)a->bytes),
+        _mm_loadu_si128((const __m128i*)b->bytes)
+    );
+    __m128i hi = _mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i*)(a->bytes + 16)),
+        _mm_loadu_si128((const __m128i*)(b->bytes + 16))
+    );
+    return _mm_movemask_epi8(_mm_and_si128(lo, hi)) == 0xffff;
+#else
+    return memcmp(a->bytes, b->bytes, ID_KEY_SIZE) == 0;
+#endif
+}
+
+/* IdTable */
+
+CimplReturn IdTable_init(IdTable* table) {
+    memset(table, 0, sizeof(*table));
+    if (StringArray_reserve(&table->names, ID_TABLE_CAPACITY) != RETURN_OK) {
+        return RETURN_ERR;
+    }
+    if (Arena_init(&table->names_arena, ID_NAMES_ARENA_SIZE) != RETURN_OK) {
+        StringArray_free(&table->names);
+        return RETURN_ERR;
+    }
+    if (pthread_mutex_init(&table->lock, NULL) != 0) {
+        log_error("IdTable_init: failed to create lock");
+        Arena_free(&table->names_arena);
+        StringArray_free(&table->names);
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// Probes for `key`.  Returns its handle, or ID_HANDLE_INVALID with `*empty`
+// set to the slot where it would go.
+static IdHandle IdTable_probe(
+    const IdTable* table, const IdKey* key, u32 hash, u32* empty
+) {
+    const u32 mask = ID_TABLE_SLOTS - 1;
+    for (u32 i = hash & mask;; i = (i + 1) & mask) {
+        u64 slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == 0) {
+            *empty = i;
+            return ID_HANDLE_INVALID;
+        }
+        u32 handle = (u32)slot - 1;
+        if ((u32)(slot >> 32) == hash &&
+            IdKey_equal(&table->keys[handle], key)) {
+            return (IdHandle)handle;
+        }
+    }
+}
+
+// Returns the handle of `id`, assigning the next one on first sight.
+// ID_HANDLE_INVALID once ID_TABLE_CAPACITY ids have been seen.
+IdHandle IdTable_intern(IdTable* table, const char* id) {
+    IdKey key;
+    IdKey_from_id(&key, id);
+    u32 hash = IdKey_hash(&key);
+    u32 empty;
+    IdHandle handle = IdTable_probe(table, &key, hash, &empty);
+    if (handle != ID_HANDLE_INVALID) return handle;
+
+    pthread_mutex_lock(&table->lock);
+    // Another thread may have added it since the probe above
+    handle = IdTable_probe(table, &key, hash, &empty);
+    if (handle == ID_HANDLE_INVALID && table->count < ID_TABLE_CAPACITY) {
+        u32 index = table->count;
+        table->keys[index] = key;
+        String name;
+        String_init_with(&name, &table->names_arena.allocator);
+        StringView view = {
+            .items = (char*)key.bytes,
+            .count = (u32)strnlen((const char*)key.bytes, ID_KEY_SIZE),
+        };
+        // Terminated too, so the name can be handed to printf as is
+        if (String_push_view(&name, &view) == RETURN_OK &&
+            String_push(&name, '\0') == RETURN_OK) {
+            name.count--;
+            table->names.items[index] = name;
+            table->names.count = index + 1;
+            u64 slot = ((u64)hash << 32) | (index + 1);
+            __atomic_store_n(&table->slots[empty], slot, __ATOMIC_RELEASE);
+            __atomic_store_n(&table->count, index + 1, __ATOMIC_RELEASE);
+            handle = (IdHandle)index;
+        } else {
+            String_free(&name);
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+    return handle;
+}
+
+// The id behind `handle`, which must have come from IdTable_intern
+StringView IdTable_name(const IdTable* table, IdHandle handle) {
+    const String* name = &table->names.items[handle];
+    StringView view = {.items = name->items, .count = (u32)name->count};
+    return view;
+}
+
+u32 IdTable_count(const IdTable* table) {
+    return __atomic_load_n(&table->count, __ATOMIC_ACQUIRE);
+}
+
+void IdTable_free(IdTable* table) {
+    Arena_free(&table->names_arena);
+    StringArray_free(&table->names);
+    pthread_mutex_destroy(&table->lock);
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_INTERN_H */
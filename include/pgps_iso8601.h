@@ -0,0 +1,277 @@
+#ifndef PGPS_ISO8601_H
+#define PGPS_ISO8601_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ISO8601_X86 1
+#endif
+
+#include "cimpl_core.h"
+
+// Sender timestamps are fixed width, UTC, microsecond resolution:
+//
+//   2026-10-16T12:00:00.000000Z
+//
+// 27 characters and a terminator, exactly filling Pose.timestamp.  Anything
+// else fails to parse.
+#define ISO8601_LENGTH 27
+#define ISO8601_SIZE (ISO8601_LENGTH + 1)
+// Stored in place of a timestamp that didn't parse
+#define ISO8601_INVALID INT64_MIN
+
+typedef bool (*Iso8601Parser)(const char*, i64*);
+
+/*** FUNCTION DECLARATIONS ***/
+
+bool iso8601_parse_ns(const char*, i64*);
+void iso8601_format_ns(char*, i64);
+const char* iso8601_parser_name(void);
+bool iso8601_parse_ns_scalar(const char*, i64*);
+#ifdef ISO8601_X86
+bool iso8601_parse_ns_sse41(const char*, i64*);
+bool iso8601_parse_ns_avx2(const char*, i64*);
+#endif
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+// Turns the ten two-digit groups (century, year, month, day, hour, minute,
+// second, then the fraction in three pairs) into ns since the epoch
+static bool iso8601_combine(const u16* pairs, i64* ns) {
+    // Days in the year before each month, and each month's length, in a
+    // common year
+    static const u16 days_before[13] = {
+        0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+    };
+    static const u8 month_days[13] = {
+        0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+    u32 year = pairs[0] * 100u + pairs[1];
+    u32 month = pairs[2];
+    u32 day = pairs[3];
+    if (month - 1 > 11) return false;
+    u32 leap = (year % 4 == 0) & ((pairs[1] != 0) | (pairs[0] % 4 == 0));
+    bool ok = day - 1 < month_days[month] + (leap & (month == 2)) &&
+              pairs[4] < 24 && pairs[5] < 60 && pairs[6] <= 60;
+    if (!ok) return false;
+
+    // Leap days before `year`, counted from 400 years earlier so everything
+    // stays unsigned, less the 97 in those 400 years and the 477 before 1970
+    u32 y = year + 399;
+    i64 leap_days = (i64)(y / 4 - y / 100 + y / 400) - 97 - 477;
+    i64 days = ((i64)year - 1970) * 365 + leap_days + days_before[month] +
+               (leap & (month > 2)) + day - 1;
+    i64 seconds = days * 86400 + pairs[4] * 3600 + pairs[5] * 60 + pairs[6];
+    i64 micros = pairs[7] * 10000 + pairs[8] * 100 + pairs[9];
+    *ns = seconds * 1000000000 + micros * 1000;
+    return true;
+}
+
+// `text` must have ISO8601_SIZE readable bytes
+bool iso8601_parse_ns_scalar(const char* text, i64* ns) {
+    // Offsets of the first digit of each pair
+    static const u8 pair_at[10] = {0, 2, 5, 8, 11, 14, 17, 20, 22, 24};
+    bool literals_ok = text[4] == '-' && text[7] == '-' && text[10] == 'T' &&
+                       text[13] == ':' && text[16] == ':' &&
+                       text[19] == '.' && text[26] == 'Z' && text[27] == '\0';
+    if (!literals_ok) return false;
+    u16 pairs[10];
+    for (u32 i = 0; i < 10; ++i) {
+        u32 hi = (u8)text[pair_at[i]] - (u32)'0';
+        u32 lo = (u8)text[pair_at[i] + 1] - (u32)'0';
+        if (hi > 9 || lo > 9) return false;
+        pairs[i] = (u16)(hi * 10 + lo);
+    }
+    return iso8601_combine(pairs, ns);
+}
+
+#ifdef ISO8601_X86
+// The two halves are loaded from offsets 0 and 12, so neither load leaves
+// the field.  Each shuffle gathers the digit pairs of its half to the front
+// so one maddubs (x10 + x1) turns them into values; -1 zeroes the byte.
+#define ISO8601_HI_OFFSET 12
+#define ISO8601_SHUFFLE_LO \
+    0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, -1, -1, -1, -1
+#define ISO8601_SHUFFLE_HI \
+    5, 6, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1
+
+// Digits are '0' in the template, everything else must match exactly.  Padded
+// to 32 bytes with the terminator and zeros.
+static const char ISO8601_TEMPLATE[32] = "0000-00-00T00:00:00.000000Z";
+// Bytes that must be digits in the template
+static const char ISO8601_DIGIT_MASK[32] = {
+    -1, -1, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1,
+    0,  -1, -1, 0,  -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0,
+};
+
+// Checks 16 bytes against the template: digits where the mask is set,
+// an exact match elsewhere.  Returns the digit values.
+__attribute__((target("sse4.1"))) static inline __m128i iso8601_check_sse41(
+    __m128i chars, u32 offset, bool* ok
+) {
+    __m128i expected =
+        _mm_loadu_si128((const __m128i*)(ISO8601_TEMPLATE + offset));
+    __m128i mask =
+        _mm_loadu_si128((const __m128i*)(ISO8601_DIGIT_MASK + offset));
+    __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i is_digit =
+        _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    __m128i is_literal = _mm_cmpeq_epi8(chars, expected);
+    __m128i good = _mm_blendv_epi8(is_literal, is_digit, mask);
+    *ok = _mm_movemask_epi8(good) == 0xffff;
+    return digits;
+}
+
+__attribute__((target("sse4.1"))) bool iso8601_parse_ns_sse41(
+    const char* text, i64* ns
+) {
+    bool lo_ok;
+    bool hi_ok;
+    __m128i lo = iso8601_check_sse41(
+        _mm_loadu_si128((const __m128i*)text), 0, &lo_ok
+    );
+    __m128i hi = iso8601_check_sse41(
+        _mm_loadu_si128((const __m128i*)(text + ISO8601_HI_OFFSET)),
+        ISO8601_HI_OFFSET,
+        &hi_ok
+    );
+    if (!(lo_ok & hi_ok)) return false;
+
+    const __m128i weights = _mm_set1_epi16(0x010a);
+    lo = _mm_shuffle_epi8(lo, _mm_setr_epi8(ISO8601_SHUFFLE_LO));
+    hi = _mm_shuffle_epi8(hi, _mm_setr_epi8(ISO8601_SHUFFLE_HI));
+    u16 pairs[16];
+    _mm_storeu_si128((__m128i*)pairs, _mm_maddubs_epi16(lo, weights));
+    _mm_storel_epi64((__m128i*)(pairs + 6), _mm_maddubs_epi16(hi, weights));
+    return iso8601_combine(pairs, ns);
+}
+
+// Same as the SSE4.1 path with both halves in one register.  The shuffle
+// works within each 128-bit lane, so the halves keep their own layout.
+__attribute__((target("avx2"))) bool iso8601_parse_ns_avx2(
+    const char* text, i64* ns
+) {
+    __m256i chars = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)text)),
+        _mm_loadu_si128((const __m128i*)(text + ISO8601_HI_OFFSET)),
+        1
+    );
+    __m256i expected = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i*)ISO8601_TEMPLATE)
+        ),
+        _mm_loadu_si128(
+            (const __m128i*)(ISO8601_TEMPLATE + ISO8601_HI_OFFSET)
+        ),
+        1
+    );
+    __m256i mask = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i*)ISO8601_DIGIT_MASK)
+        ),
+        _mm_loadu_si128(
+            (const __m128i*)(ISO8601_DIGIT_MASK + ISO8601_HI_OFFSET)
+        ),
+        1
+    );
+    __m256i digits = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    __m256i is_digit = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(digits, _mm256_set1_epi8(9)), digits
+    );
+    __m256i is_literal = _mm256_cmpeq_epi8(chars, expected);
+    __m256i good = _mm256_blendv_epi8(is_literal, is_digit, mask);
+    if (_mm256_movemask_epi8(good) != -1) return false;
+
+    __m256i gathered = _mm256_shuffle_epi8(
+        digits, _mm256_setr_epi8(ISO8601_SHUFFLE_LO, ISO8601_SHUFFLE_HI)
+    );
+    __m256i values =
+        _mm256_maddubs_epi16(gathered, _mm256_set1_epi16(0x010a));
+    // Lane 0 holds the six date/time pairs, lane 1 the remaining four
+    u16 pairs[16];
+    _mm_storeu_si128((__m128i*)pairs, _mm256_castsi256_si128(values));
+    _mm_storel_epi64(
+        (__m128i*)(pairs + 6), _mm256_extracti128_si256(values, 1)
+    );
+    return iso8601_combine(pairs, ns);
+}
+#endif /* ISO8601_X86 */
+
+static Iso8601Parser iso8601_parser;
+
+// Widest path the CPU supports, picked once
+static Iso8601Parser iso8601_select(void) {
+#ifdef ISO8601_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return iso8601_parse_ns_avx2;
+    if (__builtin_cpu_supports("sse4.1")) return iso8601_parse_ns_sse41;
+#endif
+    return iso8601_parse_ns_scalar;
+}
+
+// Parses a Pose.timestamp into ns since the Unix epoch.  `text` must have
+// ISO8601_SIZE readable bytes.  Returns false, leaving `ns` alone, if it
+// isn't a valid timestamp in the fixed layout.
+bool iso8601_parse_ns(const char* text, i64* ns) {
+    Iso8601Parser parser = __atomic_load_n(&iso8601_parser, __ATOMIC_RELAXED);
+    if (parser == NULL) {
+        // Every thread that races here picks the same parser
+        parser = iso8601_select();
+        __atomic_store_n(&iso8601_parser, parser, __ATOMIC_RELAXED);
+    }
+    return parser(text, ns);
+}
+
+// Writes `ns` since the epoch into ISO8601_SIZE bytes at `out`, the inverse
+// of iso8601_parse_ns down to the microsecond.  Years 1970-9999.
+void iso8601_format_ns(char* out, i64 ns) {
+    i64 micros = ns / 1000;
+    i64 seconds = micros / 1000000;
+    u32 fraction = (u32)(micros % 1000000);
+    u32 of_day = (u32)(seconds % 86400);
+    // Civil date from days since the epoch, in 400-year eras starting in
+    // March so the leap day comes last
+    i64 days = seconds / 86400 + 719468;
+    u32 era_day = (u32)(days % 146097);
+    u32 era_year =
+        (era_day - era_day / 1460 + era_day / 36524 - era_day / 146096) / 365;
+    u32 year_day = era_day - (365 * era_year + era_year / 4 - era_year / 100);
+    u32 month_index = (5 * year_day + 2) / 153;
+    u32 day = year_day - (153 * month_index + 2) / 5 + 1;
+    u32 month = month_index < 10 ? month_index + 3 : month_index - 9;
+    u32 year = (u32)(days / 146097) * 400 + era_year + (month <= 2);
+
+    u32 fields[7] = {
+        year, month, day, of_day / 3600, of_day / 60 % 60, of_day % 60,
+        fraction
+    };
+    static const u8 widths[7] = {4, 2, 2, 2, 2, 2, 6};
+    static const char separators[7] = {'-', '-', 'T', ':', ':', '.', 'Z'};
+    char* at = out;
+    for (u32 i = 0; i < 7; ++i) {
+        u32 value = fields[i];
+        for (u32 j = widths[i]; j > 0; --j) {
+            at[j - 1] = (char)('0' + value % 10);
+            value /= 10;
+        }
+        at += widths[i];
+        *at++ = separators[i];
+    }
+    *at = '\0';
+}
+
+const char* iso8601_parser_name(void) {
+    Iso8601Parser parser = iso8601_select();
+#ifdef ISO8601_X86
+    if (parser == iso8601_parse_ns_avx2) return "avx2";
+    if (parser == iso8601_parse_ns_sse41) return "sse4.1";
+#endif
+    (void)parser;
+    return "scalar";
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_ISO8601_H */
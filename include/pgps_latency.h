@@ -0,0 +1,207 @@
+#ifndef PGPS_LATENCY_H
+#define PGPS_LATENCY_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "cimpl_core.h"
+
+// Log-linear histogram: values below 16 get exact buckets, above that every
+// power of two is split into 16 linear sub-buckets, so any recorded value is
+// reported within 1/16 (~6%) of its true size.
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_COUNT (1u << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+typedef struct LatencyHist {
+    u64 count;
+    u64 sum;
+    u64 min;
+    u64 max;
+    u64 buckets[LATENCY_BUCKETS];
+} LatencyHist;
+
+typedef enum {
+    // SO_TIMESTAMPNS stamp to the receive syscall returning
+    LATENCY_KERNEL_TO_USER,
+    // Receive syscall returning to the CSV row being formatted
+    LATENCY_USER_TO_FORMATTED,
+    // CSV row formatted to the buffer holding it being flushed to the file
+    LATENCY_FORMATTED_TO_FLUSHED,
+    // SO_TIMESTAMPNS stamp to flushed
+    LATENCY_TOTAL,
+    LATENCY_STAGE_COUNT,
+} LatencyStage;
+
+typedef struct LatencyStats {
+    LatencyHist stages[LATENCY_STAGE_COUNT];
+} LatencyStats;
+
+/*** FUNCTION DECLARATIONS ***/
+
+void LatencyHist_record(LatencyHist*, u64);
+u64 LatencyHist_percentile(const LatencyHist*, f64);
+void LatencyHist_merge(LatencyHist*, const LatencyHist*);
+
+const char* LatencyStage_name(LatencyStage);
+void LatencyStats_record(LatencyStats*, u64, u64, u64, u64);
+void LatencyStats_print(const LatencyStats*, FILE*);
+void LatencyStats_print_json(const LatencyStats*, FILE*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+static u32 LatencyHist_index(u64 value) {
+    if (value < LATENCY_SUB_COUNT) return (u32)value;
+    u32 msb = 63 - (u32)__builtin_clzll(value);
+    u32 shift = msb - LATENCY_SUB_BITS;
+    u32 sub = (u32)(value >> shift) & (LATENCY_SUB_COUNT - 1);
+    return (shift + 1) * LATENCY_SUB_COUNT + sub;
+}
+
+// Largest value that lands in bucket `index`
+static u64 LatencyHist_upper(u32 index) {
+    if (index < LATENCY_SUB_COUNT) return index;
+    u32 shift = index / LATENCY_SUB_COUNT - 1;
+    u64 sub = index % LATENCY_SUB_COUNT;
+    return ((LATENCY_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void LatencyHist_record(LatencyHist* hist, u64 value) {
+    if (hist->count == 0 || value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->count++;
+    hist->sum += value;
+    hist->buckets[LatencyHist_index(value)]++;
+}
+
+// `p` in [0, 100].  Reports the top of the bucket, clamped to the true max.
+u64 LatencyHist_percentile(const LatencyHist* hist, f64 p) {
+    if (hist->count == 0) return 0;
+    u64 rank = (u64)((p / 100.0) * (f64)hist->count + 0.5);
+    if (rank == 0) rank = 1;
+    u64 seen = 0;
+    for (u32 i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            u64 upper = LatencyHist_upper(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void LatencyHist_merge(LatencyHist* dst, const LatencyHist* src) {
+    if (src->count == 0) return;
+    if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (u32 i = 0; i < LATENCY_BUCKETS; ++i) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+const char* LatencyStage_name(LatencyStage stage) {
+    switch (stage) {
+        case LATENCY_KERNEL_TO_USER:
+            return "kernel->user";
+        case LATENCY_USER_TO_FORMATTED:
+            return "user->formatted";
+        case LATENCY_FORMATTED_TO_FLUSHED:
+            return "formatted->flushed";
+        case LATENCY_TOTAL:
+            return "kernel->flushed";
+        case LATENCY_STAGE_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+// Stamps taken on different threads can be a few ns out of order, don't
+// record those as 2^64
+static void LatencyStats_stage(
+    LatencyStats* stats, LatencyStage stage, u64 earlier, u64 later
+) {
+    if (later < earlier) return;
+    LatencyHist_record(&stats->stages[stage], later - earlier);
+}
+
+// Records one pose.  All stamps are on latency_clock_ns, `kernel_ns` moved
+// onto it at receive and 0 when the datagram carried no kernel timestamp.
+void LatencyStats_record(
+    LatencyStats* stats,
+    u64 kernel_ns,
+    u64 user_ns,
+    u64 formatted_ns,
+    u64 flushed_ns
+) {
+    LatencyStats_stage(
+        stats, LATENCY_USER_TO_FORMATTED, user_ns, formatted_ns
+    );
+    LatencyStats_stage(
+        stats, LATENCY_FORMATTED_TO_FLUSHED, formatted_ns, flushed_ns
+    );
+    // The kernel stamp is CLOCK_REALTIME, which can be stepped between it
+    // and the receive
+    if (kernel_ns == 0) return;
+    LatencyStats_stage(stats, LATENCY_KERNEL_TO_USER, kernel_ns, user_ns);
+    LatencyStats_stage(stats, LATENCY_TOTAL, kernel_ns, flushed_ns);
+}
+
+void LatencyStats_print(const LatencyStats* stats, FILE* fp) {
+    fprintf(
+        fp,
+        "%-20s %10s %10s %10s %10s %10s %10s\n",
+        "stage (ns)",
+        "count",
+        "mean",
+        "p50",
+        "p99",
+        "p99.9",
+        "max"
+    );
+    for (u32 i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+        const LatencyHist* hist = &stats->stages[i];
+        if (hist->count == 0) continue;
+        fprintf(
+            fp,
+            "%-20s %10lu %10lu %10lu %10lu %10lu %10lu\n",
+            LatencyStage_name(i),
+            hist->count,
+            hist->sum / hist->count,
+            LatencyHist_percentile(hist, 50.0),
+            LatencyHist_percentile(hist, 99.0),
+            LatencyHist_percentile(hist, 99.9),
+            hist->max
+        );
+    }
+}
+
+// The same figures as one JSON object keyed by stage, empty stages left out
+void LatencyStats_print_json(const LatencyStats* stats, FILE* fp) {
+    fprintf(fp, "{");
+    bool first = true;
+    for (u32 i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+        const LatencyHist* hist = &stats->stages[i];
+        if (hist->count == 0) continue;
+        fprintf(
+            fp,
+            "%s\"%s\":{\"count\":%lu,\"mean\":%lu,\"p50\":%lu,"
+            "\"p99\":%lu,\"p99.9\":%lu,\"max\":%lu}",
+            first ? "" : ",",
+            LatencyStage_name(i),
+            hist->count,
+            hist->sum / hist->count,
+            LatencyHist_percentile(hist, 50.0),
+            LatencyHist_percentile(hist, 99.0),
+            LatencyHist_percentile(hist, 99.9),
+            hist->max
+        );
+        first = false;
+    }
+    fprintf(fp, "}");
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_LATENCY_H */
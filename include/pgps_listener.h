@@ -0,0 +1,146 @@
+#ifndef PGPS_LISTENER_H
+#define PGPS_LISTENER_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "cimpl_network.h"
+#include "pgps_filter.h"
+
+/*** FUNCTION DECLARATIONS ***/
+
+i32 udp_listener_open(
+    isize*, IpV4Addr, u32, u32, bool, const SocketFilter*
+);
+i32 udp_listener_setup_with_timeout(isize*, IpV4Addr, uint32_t);
+i32 udp_listener_setup_sharded(
+    isize*, u32, IpV4Addr, u32, u32, const SocketFilter*
+);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+// Creates and binds a UDP socket.  The receive timeout is split into seconds
+// and microseconds so shard threads can poll their stop flag.  `reuse_port`
+// lets several sockets bind the same address and have the kernel hash
+// incoming flows across them.  A `filter`, if given and enabled, is
+// attached before binding so nothing it rejects is ever queued.
+i32 udp_listener_open(
+    isize* socket_fd,
+    IpV4Addr ip,
+    u32 timeout_sec,
+    u32 timeout_usec,
+    bool reuse_port,
+    const SocketFilter* filter
+) {
+    struct sockaddr_in listen_addr = {0};
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_addr.s_addr = htonl(ip.addr);
+    listen_addr.sin_port = htons(ip.port);
+
+    char ip_addr_str[INET_ADDRSTRLEN] = {0};
+    if (inet_ntop(
+            listen_addr.sin_family,
+            &(listen_addr.sin_addr),
+            ip_addr_str,
+            INET_ADDRSTRLEN
+        ) == NULL) {
+        log_error("Malformed IP address.\n");
+        return EXIT_FAILURE;
+    }
+
+    *socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (*socket_fd < 0) {
+        log_error("Failed to create socket for %s:%d.", ip_addr_str, ip.port);
+        return EXIT_FAILURE;
+    }
+
+    int reuse = 1;
+    if (setsockopt(
+            *socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)
+        ) < 0) {
+        log_error("Failed to set SO_REUSEADDR");
+    }
+    if (reuse_port && setsockopt(
+                          *socket_fd,
+                          SOL_SOCKET,
+                          SO_REUSEPORT,
+                          &reuse,
+                          sizeof(reuse)
+                      ) < 0) {
+        log_error("Failed to set SO_REUSEPORT");
+        close(*socket_fd);
+        return EXIT_FAILURE;
+    }
+
+    // Every datagram then carries the socket's running drop count
+    int enable = 1;
+    if (setsockopt(
+            *socket_fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)
+        ) < 0) {
+        log_warn("Failed to set SO_RXQ_OVFL, kernel drops won't be counted");
+    }
+
+    struct timeval timeout_tv = {
+        .tv_sec = timeout_sec,
+        .tv_usec = timeout_usec,
+    };
+    if (setsockopt(
+            *socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout_tv, sizeof(timeout_tv)
+        ) < 0) {
+        log_error("Failed to set SO_RCVTIMEO");
+    }
+
+    if (filter != NULL && filter->enabled &&
+        SocketFilter_attach(filter, *socket_fd) != RETURN_OK) {
+        close(*socket_fd);
+        *socket_fd = -1;
+        return EXIT_FAILURE;
+    }
+
+    int bind_err = bind(
+        *socket_fd, (const struct sockaddr*)&listen_addr, sizeof(listen_addr)
+    );
+    if (bind_err < 0) {
+        log_error(
+            "[%d] Failed to bind to %s:%d.", bind_err, ip_addr_str, ip.port
+        );
+        close(*socket_fd);
+        *socket_fd = -1;
+        return EXIT_FAILURE;
+    }
+    log_info("Listening at %s:%d\n", ip_addr_str, ip.port);
+    return EXIT_SUCCESS;
+}
+
+i32 udp_listener_setup_with_timeout(
+    isize* socket_fd, IpV4Addr ip, uint32_t timeout_sec
+) {
+    return udp_listener_open(socket_fd, ip, timeout_sec, 0, false, NULL);
+}
+
+// Binds `count` SO_REUSEPORT sockets to the same address.  On failure every
+// socket opened so far is closed.
+i32 udp_listener_setup_sharded(
+    isize* socket_fds,
+    u32 count,
+    IpV4Addr ip,
+    u32 timeout_sec,
+    u32 timeout_usec,
+    const SocketFilter* filter
+) {
+    for (u32 i = 0; i < count; ++i) {
+        if (udp_listener_open(
+                &socket_fds[i], ip, timeout_sec, timeout_usec, true, filter
+            ) != EXIT_SUCCESS) {
+            for (u32 j = 0; j < i; ++j) close(socket_fds[j]);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_LISTENER_H */
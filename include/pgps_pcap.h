@@ -0,0 +1,565 @@
+#ifndef PGPS_PCAP_H
+#define PGPS_PCAP_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "pgps_endpoint.h"
+#include "pgps_intern.h"
+#include "pgps_recv.h"
+#include "pgps_stats.h"
+#include "pgps_time.h"
+#include "pgps_wire.h"
+
+// Classic libpcap files, microsecond or nanosecond timestamps, either byte
+// order.  pcapng is recognised only to say so.
+#define PCAP_MAGIC_USEC 0xa1b2c3d4u
+#define PCAP_MAGIC_NSEC 0xa1b23c4du
+#define PCAP_MAGIC_PCAPNG 0x0a0d0d0au
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+#define PCAP_IPV4_HEADER_SIZE 20
+
+#define PCAP_LINKTYPE_NULL 0
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_IPV4 228
+#define PCAP_LINKTYPE_LINUX_SLL2 276
+
+#define PCAP_ETHERTYPE_IPV4 0x0800
+#define PCAP_ETHERTYPE_VLAN 0x8100
+#define PCAP_IP_PROTO_UDP 17
+#define PCAP_UDP_HEADER_SIZE 8
+
+// One captured UDP/IPv4 datagram.  Addresses and ports are in host byte
+// order, `payload` points into the mapped file.
+typedef struct PcapPacket {
+    // Capture time, CLOCK_REALTIME ns
+    u64 ts_ns;
+    u32 src_addr;
+    u32 dst_addr;
+    u16 src_port;
+    u16 dst_port;
+    const u8* payload;
+    // Payload bytes captured, and on the wire per the UDP header
+    u32 len;
+    u32 wire_len;
+} PcapPacket;
+
+// Walks the records of a memory-mapped capture
+typedef struct PcapReader {
+    i32 fd;
+    const u8* map;
+    usize map_size;
+    usize offset;
+    bool swapped;
+    bool nanoseconds;
+    u32 link_type;
+
+    u64 records;
+    // Records that weren't unfragmented UDP over IPv4
+    u64 skipped;
+    // Datagrams cut short by the capture's snap length
+    u64 truncated;
+} PcapReader;
+
+// Writes UDP/IPv4 datagrams as a nanosecond capture with raw IPv4 framing,
+// for synthetic traffic that replays the same every time
+typedef struct PcapWriter {
+    FILE* fp;
+    u64 records;
+} PcapWriter;
+
+// Feeds a capture through the receive path instead of a socket.  Datagrams
+// sent to any of `endpoints` land in a PoseBatch exactly as recvmmsg would
+// have left them, with the capture time standing in for the kernel receive
+// stamp.
+typedef struct PcapReplay {
+    PcapReader reader;
+    const EndpointSpec* endpoints;
+    u32 endpoint_count;
+    // 0 as fast as possible, 1 at the captured pace, 2 twice as fast...
+    f64 speed;
+    bool started;
+    bool finished;
+    u64 start_ns;
+    u64 first_ts_ns;
+    // Monotonic ns as of the latest datagram by capture time, see
+    // PcapReplay_now
+    u64 clock_ns;
+    // Read but not yet handed out, it wasn't due
+    bool pending;
+    PcapPacket next;
+    // Datagrams for other addresses or ports
+    u64 other;
+    // Decode timing, NULL when not published
+    StageStats* timing;
+} PcapReplay;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn PcapReader_open(PcapReader*, const char*);
+bool PcapReader_next(PcapReader*, PcapPacket*);
+void PcapReader_close(PcapReader*);
+
+CimplReturn PcapWriter_open(PcapWriter*, const char*);
+CimplReturn PcapWriter_write(PcapWriter*, const PcapPacket*);
+CimplReturn PcapWriter_close(PcapWriter*);
+
+CimplReturn PcapReplay_open(
+    PcapReplay*, const char*, const EndpointSpec*, u32, f64
+);
+isize PcapReplay_recv(PcapReplay*, PoseBatch*, IdTable*, u32, RecvStats*);
+u64 PcapReplay_now(const PcapReplay*);
+void PcapReplay_print(const PcapReplay*, FILE*);
+void PcapReplay_close(PcapReplay*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+/* PcapReader */
+
+static u32 pcap_u32(const PcapReader* reader, const u8* src) {
+    u32 value;
+    memcpy(&value, src, sizeof(value));
+    return reader->swapped ? __builtin_bswap32(value) : value;
+}
+
+// Network byte order fields of the packet itself
+static u16 pcap_be16(const u8* src) { return (u16)(src[0] << 8 | src[1]); }
+
+static u32 pcap_be32(const u8* src) {
+    return (u32)src[0] << 24 | (u32)src[1] << 16 | (u32)src[2] << 8 | src[3];
+}
+
+CimplReturn PcapReader_open(PcapReader* reader, const char* path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return RETURN_ERR;
+    }
+    struct stat st;
+    if (fstat(reader->fd, &st) != 0 ||
+        (usize)st.st_size < PCAP_FILE_HEADER_SIZE) {
+        log_error("%s is not a pcap file", path);
+        close(reader->fd);
+        return RETURN_ERR;
+    }
+    reader->map_size = (usize)st.st_size;
+    void* map =
+        mmap(NULL, reader->map_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (map == MAP_FAILED) {
+        log_error("Failed to map %s: %s", path, strerror(errno));
+        close(reader->fd);
+        return RETURN_ERR;
+    }
+    madvise(map, reader->map_size, MADV_SEQUENTIAL);
+    reader->map = map;
+
+    u32 magic;
+    memcpy(&magic, reader->map, sizeof(magic));
+    const char* problem = NULL;
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        reader->nanoseconds = magic == PCAP_MAGIC_NSEC;
+    } else if (__builtin_bswap32(magic) == PCAP_MAGIC_USEC ||
+               __builtin_bswap32(magic) == PCAP_MAGIC_NSEC) {
+        reader->swapped = true;
+        reader->nanoseconds = __builtin_bswap32(magic) == PCAP_MAGIC_NSEC;
+    } else if (magic == PCAP_MAGIC_PCAPNG) {
+        problem = "pcapng, convert it with `editcap -F pcap`";
+    } else {
+        problem = "not a pcap file";
+    }
+    if (problem == NULL) {
+        // The low 16 bits, the rest hold FCS flags
+        reader->link_type = pcap_u32(reader, reader->map + 20) & 0xffff;
+        switch (reader->link_type) {
+            case PCAP_LINKTYPE_NULL:
+            case PCAP_LINKTYPE_ETHERNET:
+            case PCAP_LINKTYPE_RAW:
+            case PCAP_LINKTYPE_LINUX_SLL:
+            case PCAP_LINKTYPE_IPV4:
+            case PCAP_LINKTYPE_LINUX_SLL2:
+                break;
+            default:
+                problem = "an unsupported link type";
+        }
+    }
+    if (problem != NULL) {
+        log_error("%s is %s", path, problem);
+        PcapReader_close(reader);
+        return RETURN_ERR;
+    }
+    reader->offset = PCAP_FILE_HEADER_SIZE;
+    return RETURN_OK;
+}
+
+// Offset of the IPv4 header within a frame, or -1 if it isn't IPv4
+static isize pcap_ip_offset(u32 link_type, const u8* frame, u32 len) {
+    switch (link_type) {
+        case PCAP_LINKTYPE_NULL: {
+            // AF_INET in the capturing host's byte order
+            if (len < 4) return -1;
+            u32 family;
+            memcpy(&family, frame, sizeof(family));
+            return family == 2 || family == 0x02000000 ? 4 : -1;
+        }
+        case PCAP_LINKTYPE_ETHERNET: {
+            u32 offset = 12;
+            if (len >= offset + 2 &&
+                pcap_be16(frame + offset) == PCAP_ETHERTYPE_VLAN) {
+                offset += 4;
+            }
+            if (len < offset + 2) return -1;
+            return pcap_be16(frame + offset) == PCAP_ETHERTYPE_IPV4
+                       ? (isize)offset + 2
+                       : -1;
+        }
+        case PCAP_LINKTYPE_LINUX_SLL:
+            if (len < 16) return -1;
+            return pcap_be16(frame + 14) == PCAP_ETHERTYPE_IPV4 ? 16 : -1;
+        case PCAP_LINKTYPE_LINUX_SLL2:
+            if (len < 20) return -1;
+            return pcap_be16(frame) == PCAP_ETHERTYPE_IPV4 ? 20 : -1;
+        case PCAP_LINKTYPE_RAW:
+        case PCAP_LINKTYPE_IPV4:
+            return len >= 1 && frame[0] >> 4 == 4 ? 0 : -1;
+    }
+    return -1;
+}
+
+// Unpacks a frame into `packet`, false unless it is a whole UDP/IPv4
+// datagram (a first fragment's payload isn't the datagram)
+static bool pcap_parse_udp(
+    const PcapReader* reader, const u8* frame, u32 len, PcapPacket* packet
+) {
+    isize ip = pcap_ip_offset(reader->link_type, frame, len);
+    if (ip < 0 || len < (u32)ip + 20) return false;
+    const u8* hdr = frame + ip;
+    u32 ihl = (u32)(hdr[0] & 0x0f) * 4;
+    // More fragments flag or a fragment offset
+    bool fragment = (pcap_be16(hdr + 6) & 0x3fff) != 0;
+    if (hdr[0] >> 4 != 4 || ihl < 20 || hdr[9] != PCAP_IP_PROTO_UDP ||
+        fragment) {
+        return false;
+    }
+    u32 udp = (u32)ip + ihl;
+    if (len < udp + PCAP_UDP_HEADER_SIZE) return false;
+    packet->src_addr = pcap_be32(hdr + 12);
+    packet->dst_addr = pcap_be32(hdr + 16);
+    packet->src_port = pcap_be16(frame + udp);
+    packet->dst_port = pcap_be16(frame + udp + 2);
+    u32 udp_len = pcap_be16(frame + udp + 4);
+    if (udp_len < PCAP_UDP_HEADER_SIZE) return false;
+    packet->wire_len = udp_len - PCAP_UDP_HEADER_SIZE;
+    packet->payload = frame + udp + PCAP_UDP_HEADER_SIZE;
+    u32 captured = len - udp - PCAP_UDP_HEADER_SIZE;
+    // Ethernet pads short frames, the UDP length is the truth
+    packet->len =
+        captured < packet->wire_len ? captured : packet->wire_len;
+    return true;
+}
+
+// Advances to the next UDP/IPv4 datagram.  False at the end of the file or
+// at a record running past it.
+bool PcapReader_next(PcapReader* reader, PcapPacket* packet) {
+    while (reader->offset + PCAP_RECORD_HEADER_SIZE <= reader->map_size) {
+        const u8* record = reader->map + reader->offset;
+        u32 sec = pcap_u32(reader, record);
+        u32 frac = pcap_u32(reader, record + 4);
+        u32 len = pcap_u32(reader, record + 8);
+        if (reader->offset + PCAP_RECORD_HEADER_SIZE + len >
+            reader->map_size) {
+            log_warn_fields(
+                "Capture ends inside a record",
+                LOG_U64("record", reader->records),
+                LOG_U64("offset", reader->offset)
+            );
+            return false;
+        }
+        reader->offset += PCAP_RECORD_HEADER_SIZE + len;
+        reader->records++;
+        if (!pcap_parse_udp(
+                reader, record + PCAP_RECORD_HEADER_SIZE, len, packet
+            )) {
+            reader->skipped++;
+            continue;
+        }
+        if (packet->len < packet->wire_len) reader->truncated++;
+        packet->ts_ns = (u64)sec * NS_PER_SEC +
+                        (reader->nanoseconds ? frac : (u64)frac * 1000);
+        return true;
+    }
+    return false;
+}
+
+void PcapReader_close(PcapReader* reader) {
+    if (reader->map != NULL) munmap((void*)reader->map, reader->map_size);
+    if (reader->fd >= 0) close(reader->fd);
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+}
+
+/* PcapWriter */
+
+static void pcap_put_be16(u8* dst, u16 value) {
+    dst[0] = (u8)(value >> 8);
+    dst[1] = (u8)value;
+}
+
+static void pcap_put_be32(u8* dst, u32 value) {
+    pcap_put_be16(dst, (u16)(value >> 16));
+    pcap_put_be16(dst + 2, (u16)value);
+}
+
+CimplReturn PcapWriter_open(PcapWriter* writer, const char* path) {
+    memset(writer, 0, sizeof(*writer));
+    writer->fp = fopen(path, "wb");
+    if (writer->fp == NULL) {
+        log_error("Failed to create %s: %s", path, strerror(errno));
+        return RETURN_ERR;
+    }
+    // Host byte order, the reader takes either.  Version 2.4 is two u16s.
+    u32 header[6] = {
+        PCAP_MAGIC_NSEC, 0, 0, 0, UINT16_MAX, PCAP_LINKTYPE_IPV4,
+    };
+    u16 version[2] = {2, 4};
+    memcpy(&header[1], version, sizeof(version));
+    if (fwrite(header, sizeof(header), 1, writer->fp) != 1) {
+        log_error("Failed to write %s: %s", path, strerror(errno));
+        fclose(writer->fp);
+        writer->fp = NULL;
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// Appends `packet`'s payload as a datagram from its source to its
+// destination, captured at `packet->ts_ns`
+CimplReturn PcapWriter_write(PcapWriter* writer, const PcapPacket* packet) {
+    u8 frame[PCAP_IPV4_HEADER_SIZE + PCAP_UDP_HEADER_SIZE];
+    u32 frame_len = sizeof(frame) + packet->len;
+    memset(frame, 0, sizeof(frame));
+    // Version 4, no options, don't fragment, TTL 64
+    frame[0] = 0x45;
+    pcap_put_be16(frame + 2, (u16)frame_len);
+    pcap_put_be16(frame + 6, 0x4000);
+    frame[8] = 64;
+    frame[9] = PCAP_IP_PROTO_UDP;
+    pcap_put_be32(frame + 12, packet->src_addr);
+    pcap_put_be32(frame + 16, packet->dst_addr);
+    u32 sum = 0;
+    for (u32 i = 0; i < PCAP_IPV4_HEADER_SIZE; i += 2) {
+        sum += pcap_be16(frame + i);
+    }
+    while (sum > 0xffff) sum = (sum & 0xffff) + (sum >> 16);
+    pcap_put_be16(frame + 10, (u16)~sum);
+    u8* udp = frame + PCAP_IPV4_HEADER_SIZE;
+    pcap_put_be16(udp, packet->src_port);
+    pcap_put_be16(udp + 2, packet->dst_port);
+    pcap_put_be16(udp + 4, (u16)(PCAP_UDP_HEADER_SIZE + packet->len));
+
+    u32 record[4] = {
+        (u32)(packet->ts_ns / NS_PER_SEC),
+        (u32)(packet->ts_ns % NS_PER_SEC),
+        frame_len,
+        frame_len,
+    };
+    if (fwrite(record, sizeof(record), 1, writer->fp) != 1 ||
+        fwrite(frame, sizeof(frame), 1, writer->fp) != 1 ||
+        fwrite(packet->payload, 1, packet->len, writer->fp) != packet->len) {
+        log_error("Failed to write capture: %s", strerror(errno));
+        return RETURN_ERR;
+    }
+    writer->records++;
+    return RETURN_OK;
+}
+
+CimplReturn PcapWriter_close(PcapWriter* writer) {
+    CimplReturn result = RETURN_OK;
+    if (writer->fp != NULL && fclose(writer->fp) != 0) {
+        log_error("Failed to write capture: %s", strerror(errno));
+        result = RETURN_ERR;
+    }
+    writer->fp = NULL;
+    return result;
+}
+
+/* PcapReplay */
+
+// `speed` 0 replays as fast as the pipeline takes it, otherwise datagrams
+// are released on the capture's own schedule sped up by `speed`
+CimplReturn PcapReplay_open(
+    PcapReplay* replay,
+    const char* path,
+    const EndpointSpec* endpoints,
+    u32 endpoint_count,
+    f64 speed
+) {
+    memset(replay, 0, sizeof(*replay));
+    if (PcapReader_open(&replay->reader, path) != RETURN_OK) {
+        return RETURN_ERR;
+    }
+    replay->endpoints = endpoints;
+    replay->endpoint_count = endpoint_count;
+    replay->speed = speed;
+    return RETURN_OK;
+}
+
+// Whether a listener bound to one of the endpoints would have received it.
+// A wildcard address takes anything sent to its port.
+static bool PcapReplay_wanted(
+    const PcapReplay* replay, const PcapPacket* packet
+) {
+    for (u32 i = 0; i < replay->endpoint_count; ++i) {
+        const IpV4Addr* addr = &replay->endpoints[i].addr;
+        if (addr->port == packet->dst_port &&
+            (addr->addr == INADDR_ANY || addr->addr == packet->dst_addr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sleeps until monotonic `due`, false if a signal cut it short
+static bool PcapReplay_sleep_until(u64 due) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(due / NS_PER_SEC),
+        .tv_nsec = (long)(due % NS_PER_SEC),
+    };
+    return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == 0;
+}
+
+// Takes up to `max` datagrams into `batch` and decodes them, like
+// Receiver_recv.  A batch only holds datagrams captured at the same instant,
+// so every pose in it is delivered at its own capture time and the stages
+// downstream see the same sequence at any speed.  When pacing, an empty batch
+// waits for its first datagram to be due.  Returns the number of valid poses,
+// 0 with `finished` set at the end of the capture, or -1 with errno EINTR
+// when a signal interrupted the wait.
+isize PcapReplay_recv(
+    PcapReplay* replay,
+    PoseBatch* batch,
+    IdTable* ids,
+    u32 max,
+    RecvStats* stats
+) {
+    if (max > batch->capacity) max = batch->capacity;
+    batch->count = 0;
+    i64 wall_offset;
+    u64 now = latency_clock_ns(&wall_offset);
+    u64 batch_ts_ns = 0;
+    while (batch->count < max) {
+        PcapPacket* packet = &replay->next;
+        if (!replay->pending) {
+            if (!PcapReader_next(&replay->reader, packet)) {
+                replay->finished = true;
+                break;
+            }
+            if (!PcapReplay_wanted(replay, packet)) {
+                replay->other++;
+                continue;
+            }
+            replay->pending = true;
+        }
+        if (batch->count > 0 && packet->ts_ns != batch_ts_ns) break;
+        batch_ts_ns = packet->ts_ns;
+        if (!replay->started) {
+            replay->started = true;
+            replay->start_ns = monotonic_ns();
+            replay->first_ts_ns = packet->ts_ns;
+        }
+        // Captures can step back in time, those go out right away
+        u64 offset = packet->ts_ns > replay->first_ts_ns
+                         ? packet->ts_ns - replay->first_ts_ns
+                         : 0;
+        if (replay->speed > 0.0) {
+            u64 due = replay->start_ns + (u64)((f64)offset / replay->speed);
+            if (due > monotonic_ns()) {
+                if (!PcapReplay_sleep_until(due)) {
+                    errno = EINTR;
+                    return -1;
+                }
+                now = latency_clock_ns(&wall_offset);
+            }
+        }
+        replay->pending = false;
+        // Deadlines downstream expect a clock that never steps back
+        if (replay->start_ns + offset > replay->clock_ns) {
+            replay->clock_ns = replay->start_ns + offset;
+        }
+
+        // What recvmmsg would have written: the payload cut to the buffer,
+        // so oversize datagrams still show up as too long
+        u32 i = batch->count++;
+        u32 len = packet->len < POSE_WIRE_BUFFER_SIZE ? packet->len
+                                                      : POSE_WIRE_BUFFER_SIZE;
+        memcpy(
+            batch->wire + (usize)i * POSE_WIRE_BUFFER_SIZE,
+            packet->payload,
+            len
+        );
+        batch->msgs[i].msg_len = len;
+        batch->senders[i] = (struct sockaddr_in){
+            .sin_family = AF_INET,
+            .sin_port = htons(packet->src_port),
+            .sin_addr.s_addr = htonl(packet->src_addr),
+        };
+        if (batch->timestamps) {
+            batch->kernel_ns[i] =
+                latency_clock_from_realtime(packet->ts_ns, wall_offset);
+            batch->user_ns[i] = now;
+        }
+    }
+    if (batch->count == 0) return 0;
+    RecvStats_record(stats, batch->count);
+    u32 datagrams = batch->count;
+    u64 start = replay->timing != NULL ? stats_ticks() : 0;
+    PoseBatch_decode(batch, ids, stats);
+    if (replay->timing != NULL) {
+        StageStats_add(
+            replay->timing, STAGE_DECODE, datagrams, stats_ticks() - start
+        );
+    }
+    return batch->count;
+}
+
+// The capture's clock carried over to this run: monotonic ns at the start of
+// the replay plus the capture time elapsed up to the last datagram handed
+// out.  Reorder, flush and segment deadlines follow it, so the output doesn't
+// depend on the replay speed.
+u64 PcapReplay_now(const PcapReplay* replay) {
+    return replay->started ? replay->clock_ns : monotonic_ns();
+}
+
+void PcapReplay_print(const PcapReplay* replay, FILE* fp) {
+    const PcapReader* reader = &replay->reader;
+    u64 span_ns = replay->started ? replay->clock_ns - replay->start_ns : 0;
+    fprintf(
+        fp,
+        "Replayed %lu records spanning %.3f s of capture: %lu not UDP/IPv4, "
+        "%lu for other endpoints, %lu truncated\n",
+        reader->records,
+        (f64)span_ns / 1e9,
+        reader->skipped,
+        replay->other,
+        reader->truncated
+    );
+}
+
+void PcapReplay_close(PcapReplay* replay) {
+    PcapReader_close(&replay->reader);
+    memset(replay, 0, sizeof(*replay));
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_PCAP_H */
@@ -0,0 +1,100 @@
+#ifndef PGPS_POSE_H
+#define PGPS_POSE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+#include "cimpl_string.h"
+#include "pgps_format.h"
+#include "pgps_intern.h"
+#include "pgps_iso8601.h"
+
+typedef struct Pose {
+    char id[32];
+    char timestamp[28];
+    Vec3 position;
+    Quat rotation;
+    uint8_t confidence;
+    bool trigger_activated;
+} Pose;
+
+// A decoded pose with its id interned.  This is what every stage past the
+// decoder carries, and the record layout of the binary log.  Laid out so no
+// member needs padding.
+typedef struct PoseSample {
+    // `timestamp` as ns since the epoch, ISO8601_INVALID if it didn't parse
+    i64 sent_ns;
+    char timestamp[28];
+    Vec3 position;
+    Quat rotation;
+    IdHandle id;
+    u8 confidence;
+    bool trigger_activated;
+    u8 reserved[4];
+} PoseSample;
+
+#define POSE_CSV_HEADER "id,px,py,pz,qx,qy,qz,qw\n"
+// Longest CSV row
+#define POSE_CSV_ROW_MAX \
+    (ID_KEY_SIZE + 1 + FORMAT_I32_MAX + 7 * (1 + FORMAT_F32_FIXED6_MAX) + 1)
+
+/*** FUNCTION DECLARATIONS ***/
+
+usize PoseSample_format_csv(char*, const PoseSample*, StringView, u32);
+i32 Pose_write_csv(FILE*, const Pose*, u32);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+// Formats a single CSV row into `out`, byte for byte what Pose_write_csv
+// produces for the same pose, and returns its length.  `id` is the name
+// behind `sample->id`.  `out` needs room for POSE_CSV_ROW_MAX bytes.
+usize PoseSample_format_csv(
+    char* out, const PoseSample* sample, StringView id, u32 index
+) {
+    const f32 fields[7] = {
+        sample->position.x,
+        sample->position.y,
+        sample->position.z,
+        sample->rotation.x,
+        sample->rotation.y,
+        sample->rotation.z,
+        sample->rotation.w,
+    };
+    memcpy(out, id.items, id.count);
+    char* cursor = out + id.count;
+    *cursor++ = ',';
+    cursor += format_i32(cursor, (i32)index);
+    for (u32 i = 0; i < 7; ++i) {
+        *cursor++ = ',';
+        cursor += format_f32_fixed6(cursor, fields[i]);
+    }
+    *cursor++ = '\n';
+    return (usize)(cursor - out);
+}
+
+// Writes a single CSV row.  `index` is the running pose count.  Returns the
+// number of bytes written, negative on error.
+i32 Pose_write_csv(FILE* fp, const Pose* pose, u32 index) {
+    return fprintf(
+        fp,
+        "%s"
+        ",%d"
+        ",%12.6f,%12.6f,%12.6f"
+        ",%12.6f,%12.6f,%12.6f,%12.6f\n",
+        pose->id,
+        index,
+        pose->position.x,
+        pose->position.y,
+        pose->position.z,
+        pose->rotation.x,
+        pose->rotation.y,
+        pose->rotation.z,
+        pose->rotation.w
+    );
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_POSE_H */
@@ -0,0 +1,192 @@
+#ifndef PGPS_RCVBUF_H
+#define PGPS_RCVBUF_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "cimpl_core.h"
+
+#define RCVBUF_DEFAULT_MAX (8 * 1024 * 1024)
+// Kernel memory charged against SO_RCVBUF for one queued pose datagram: the
+// skb and its data rounded up to the allocation the driver hands out
+#define RCVBUF_DATAGRAM_COST 1024
+// Arrival rate is measured over windows this long, the peak one is the burst
+#define RCVBUF_RATE_WINDOW_NS (10 * 1000000ull)
+// How often the buffer is re-sized
+#define RCVBUF_UPDATE_NS (250 * 1000000ull)
+// Extra time a burst has to be absorbed on top of the observed lag
+#define RCVBUF_SLACK_NS (10 * 1000000ull)
+
+// Limits for SO_RCVBUF, in the doubled bytes getsockopt reports.  A zero
+// `min_bytes` keeps the system default to start with, a zero `max_bytes`
+// turns resizing off.
+typedef struct RcvBufConfig {
+    usize min_bytes;
+    usize max_bytes;
+    // The socket has a filter, whose drops land in SO_RXQ_OVFL too, so its
+    // drops only count as overflows when a burst could have filled it
+    bool filtered;
+} RcvBufConfig;
+
+// Grows a socket's receive buffer until it can hold the largest burst seen
+// for as long as the receive loop has been seen to stay away from the
+// socket.  With a separate writer thread that's the time the receive thread
+// spends between syscalls; on a single thread it includes writing.  New
+// kernel drops double the buffer outright.  It never shrinks.
+typedef struct RcvBufTuner {
+    RcvBufConfig config;
+    isize socket_fd;
+    // As reported by getsockopt
+    usize bytes;
+    u32 resizes;
+    // Warned that net.core.rmem_max held it back.  Growth is still tried,
+    // the limit can be raised while running.
+    bool capped;
+
+    u64 window_start_ns;
+    u64 window_packets;
+    u64 update_ns;
+    // Over the current update period
+    f64 peak_rate;
+    u64 max_lag_ns;
+    u64 last_return_ns;
+    u64 last_drops;
+} RcvBufTuner;
+
+/*** FUNCTION DECLARATIONS ***/
+
+usize rcvbuf_get(isize);
+usize rcvbuf_set(isize, usize);
+
+void RcvBufTuner_init(RcvBufTuner*, isize, RcvBufConfig);
+void RcvBufTuner_enter(RcvBufTuner*, u64);
+void RcvBufTuner_observe(RcvBufTuner*, u32, u64, u64);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+usize rcvbuf_get(isize socket_fd) {
+    int bytes = 0;
+    socklen_t len = sizeof(bytes);
+    if (getsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &bytes, &len) < 0) {
+        return 0;
+    }
+    return (usize)bytes;
+}
+
+// Asks for `bytes` as getsockopt would report them (the kernel doubles what
+// it is given) and returns what was granted.  SO_RCVBUFFORCE gets past
+// net.core.rmem_max when we have CAP_NET_ADMIN.
+usize rcvbuf_set(isize socket_fd, usize bytes) {
+    int half = (int)(bytes / 2);
+    if (setsockopt(
+            socket_fd, SOL_SOCKET, SO_RCVBUFFORCE, &half, sizeof(half)
+        ) < 0) {
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &half, sizeof(half));
+    }
+    return rcvbuf_get(socket_fd);
+}
+
+void RcvBufTuner_init(
+    RcvBufTuner* tuner, isize socket_fd, RcvBufConfig config
+) {
+    memset(tuner, 0, sizeof(*tuner));
+    tuner->config = config;
+    tuner->socket_fd = socket_fd;
+    if (config.min_bytes != 0 && rcvbuf_get(socket_fd) < config.min_bytes) {
+        rcvbuf_set(socket_fd, config.min_bytes);
+    }
+    tuner->bytes = rcvbuf_get(socket_fd);
+}
+
+// Call right before each receive syscall.  `now` is monotonic ns.
+void RcvBufTuner_enter(RcvBufTuner* tuner, u64 now) {
+    if (tuner->last_return_ns == 0) return;
+    u64 lag = now - tuner->last_return_ns;
+    if (lag > tuner->max_lag_ns) tuner->max_lag_ns = lag;
+}
+
+// Re-sizes the buffer for what the last period showed.  `drops` is the
+// socket's SO_RXQ_OVFL count.
+static void RcvBufTuner_update(RcvBufTuner* tuner, u64 drops) {
+    u64 burst_ns = tuner->max_lag_ns + RCVBUF_SLACK_NS;
+    f64 queued = tuner->peak_rate * (f64)burst_ns / 1e9;
+    // Twice the burst, so one that lands while the loop is away still fits
+    usize target = (usize)(queued * 2.0) * RCVBUF_DATAGRAM_COST;
+    bool dropped = drops > tuner->last_drops;
+    // Filter rejects count there too, they aren't a full buffer unless the
+    // burst could have filled half of it
+    if (dropped && tuner->config.filtered &&
+        queued * RCVBUF_DATAGRAM_COST < (f64)(tuner->bytes / 2)) {
+        dropped = false;
+    }
+    if (dropped && target < tuner->bytes * 2) target = tuner->bytes * 2;
+    if (target > tuner->config.max_bytes) target = tuner->config.max_bytes;
+
+    // Only steps of a quarter or more, setsockopt isn't free
+    bool grew = false;
+    if (target > tuner->bytes + tuner->bytes / 4) {
+        usize granted = rcvbuf_set(tuner->socket_fd, target);
+        grew = granted > tuner->bytes;
+        if (grew) {
+            log_info_fields(
+                "SO_RCVBUF resized",
+                LOG_U64("from_bytes", tuner->bytes),
+                LOG_U64("bytes", granted),
+                LOG_F64("burst_pps", tuner->peak_rate),
+                LOG_F64("lag_ms", (f64)tuner->max_lag_ns / 1e6),
+                LOG_U64("kernel_drops", drops)
+            );
+            tuner->resizes++;
+            tuner->bytes = granted;
+        }
+        if (granted < target && !tuner->capped) {
+            log_warn_fields(
+                "SO_RCVBUF capped, raise net.core.rmem_max",
+                LOG_U64("bytes", granted),
+                LOG_U64("wanted_bytes", target)
+            );
+            tuner->capped = true;
+        }
+    }
+    if (dropped && !grew) {
+        log_warn_fields(
+            "Kernel drops at the SO_RCVBUF limit",
+            LOG_U64("kernel_drops", drops - tuner->last_drops),
+            LOG_U64("bytes", tuner->bytes)
+        );
+    }
+    tuner->last_drops = drops;
+    tuner->peak_rate = 0.0;
+    tuner->max_lag_ns = 0;
+}
+
+// Call after each receive syscall that returned `packets`.  `drops` is the
+// socket's SO_RXQ_OVFL count so far, `now` is monotonic ns.
+void RcvBufTuner_observe(
+    RcvBufTuner* tuner, u32 packets, u64 drops, u64 now
+) {
+    tuner->last_return_ns = now;
+    if (tuner->config.max_bytes == 0) return;
+    if (tuner->update_ns == 0) tuner->update_ns = now;
+    // A window left open across an idle spell would dilute the next burst
+    if (now - tuner->window_start_ns >= 2 * RCVBUF_RATE_WINDOW_NS) {
+        tuner->window_start_ns = now;
+        tuner->window_packets = 0;
+    }
+    tuner->window_packets += packets;
+    u64 elapsed = now - tuner->window_start_ns;
+    if (elapsed >= RCVBUF_RATE_WINDOW_NS) {
+        f64 rate = (f64)tuner->window_packets * 1e9 / (f64)elapsed;
+        if (rate > tuner->peak_rate) tuner->peak_rate = rate;
+        tuner->window_start_ns = now;
+        tuner->window_packets = 0;
+    }
+    if (now - tuner->update_ns >= RCVBUF_UPDATE_NS) {
+        RcvBufTuner_update(tuner, drops);
+        tuner->update_ns = now;
+    }
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_RCVBUF_H */
@@ -0,0 +1,183 @@
+#ifndef PGPS_RECEIVER_H
+#define PGPS_RECEIVER_H
+
+#include "cimpl_core.h"
+#include "pgps_intern.h"
+#include "pgps_rcvbuf.h"
+#include "pgps_recv.h"
+#include "pgps_stats.h"
+#include "pgps_time.h"
+#include "pgps_uring.h"
+
+typedef enum {
+    RECV_BACKEND_RECVFROM,
+    RECV_BACKEND_RECVMMSG,
+    RECV_BACKEND_URING,
+} RecvBackend;
+
+// One receive path over one socket, whichever backend was picked at startup
+typedef struct Receiver {
+    RecvBackend backend;
+    isize socket_fd;
+    // Shared by every receiver of a run, so handles agree across threads
+    IdTable* ids;
+    PoseBatch batch;
+    UringRecv uring;
+    RcvBufTuner rcvbuf;
+    RecvStats stats;
+    // Receive and decode timing, NULL when not published
+    StageStats* timing;
+} Receiver;
+
+/*** FUNCTION DECLARATIONS ***/
+
+const char* RecvBackend_name(RecvBackend);
+CimplReturn RecvBackend_from_str(RecvBackend*, const char*);
+
+CimplReturn Receiver_init(
+    Receiver*, RecvBackend, isize, IdTable*, u32, u64, bool, RcvBufConfig
+);
+isize Receiver_recv(Receiver*, u32);
+void Receiver_free(Receiver*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+const char* RecvBackend_name(RecvBackend backend) {
+    switch (backend) {
+        case RECV_BACKEND_RECVFROM:
+            return "recvfrom";
+        case RECV_BACKEND_RECVMMSG:
+            return "recvmmsg";
+        case RECV_BACKEND_URING:
+            return "uring";
+    }
+    return "unknown";
+}
+
+CimplReturn RecvBackend_from_str(RecvBackend* backend, const char* name) {
+    if (strcmp(name, "recvfrom") == 0) {
+        *backend = RECV_BACKEND_RECVFROM;
+    } else if (strcmp(name, "recvmmsg") == 0) {
+        *backend = RECV_BACKEND_RECVMMSG;
+    } else if (strcmp(name, "uring") == 0) {
+        *backend = RECV_BACKEND_URING;
+    } else {
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// `timeout_usec` only applies to the uring backend, the socket backends use
+// the SO_RCVTIMEO already set on `socket_fd`.  `timestamps` turns on
+// SO_TIMESTAMPNS and per-pose kernel/user receive stamps in the batch.
+// `rcvbuf` bounds how far the socket's receive buffer may grow.
+CimplReturn Receiver_init(
+    Receiver* rx,
+    RecvBackend backend,
+    isize socket_fd,
+    IdTable* ids,
+    u32 batch_size,
+    u64 timeout_usec,
+    bool timestamps,
+    RcvBufConfig rcvbuf
+) {
+    memset(rx, 0, sizeof(*rx));
+    rx->backend = backend;
+    rx->socket_fd = socket_fd;
+    rx->ids = ids;
+    rx->uring.ring_fd = -1;
+    if (backend == RECV_BACKEND_RECVFROM) batch_size = 1;
+    if (timestamps) {
+        int enable = 1;
+        if (setsockopt(
+                socket_fd,
+                SOL_SOCKET,
+                SO_TIMESTAMPNS,
+                &enable,
+                sizeof(enable)
+            ) < 0) {
+            log_error("Failed to set SO_TIMESTAMPNS");
+            return RETURN_ERR;
+        }
+    }
+    if (PoseBatch_init(&rx->batch, batch_size, timestamps) != RETURN_OK) {
+        return RETURN_ERR;
+    }
+    if (backend == RECV_BACKEND_URING &&
+        UringRecv_init(&rx->uring, socket_fd, timeout_usec) != RETURN_OK) {
+        PoseBatch_free(&rx->batch);
+        return RETURN_ERR;
+    }
+    RcvBufTuner_init(&rx->rcvbuf, socket_fd, rcvbuf);
+    rx->stats.rcvbuf_bytes = rx->rcvbuf.bytes;
+    return RETURN_OK;
+}
+
+// Receives up to `max` datagrams into `rx->batch` and decodes them.
+// Returns the number of valid poses, which can be 0 when everything received
+// was rejected, or -1 with errno set.
+isize Receiver_recv(Receiver* rx, u32 max) {
+    RcvBufTuner_enter(&rx->rcvbuf, monotonic_ns());
+    // Datagrams, rejects included, which is what the buffer had to hold
+    u64 packets = rx->stats.packets;
+    u64 start = rx->timing != NULL ? stats_ticks() : 0;
+    isize received = -1;
+    switch (rx->backend) {
+        case RECV_BACKEND_RECVFROM:
+            received =
+                PoseBatch_recv_single(&rx->batch, rx->socket_fd, &rx->stats);
+            break;
+        case RECV_BACKEND_RECVMMSG:
+            received =
+                PoseBatch_recv(&rx->batch, rx->socket_fd, max, &rx->stats);
+            break;
+        case RECV_BACKEND_URING:
+            received = UringRecv_recv(
+                &rx->uring, &rx->batch, rx->ids, max, &rx->stats
+            );
+            break;
+        default:
+            errno = EINVAL;
+            break;
+    }
+    // Resizing may log, keep the receive error for the caller
+    int recv_errno = errno;
+    // Timeouts aren't work, only count receives that brought something
+    if (rx->timing != NULL && received >= 0) {
+        StageStats_add(
+            rx->timing, STAGE_RECV, (u64)received, stats_ticks() - start
+        );
+    }
+    RcvBufTuner_observe(
+        &rx->rcvbuf,
+        (u32)(rx->stats.packets - packets),
+        rx->stats.kernel_drops,
+        monotonic_ns()
+    );
+    rx->stats.rcvbuf_bytes = rx->rcvbuf.bytes;
+    rx->stats.rcvbuf_resizes = rx->rcvbuf.resizes;
+    if (received < 0) {
+        errno = recv_errno;
+        return -1;
+    }
+    // Decoded out of the provided buffers, its time counts as receive time
+    if (rx->backend == RECV_BACKEND_URING) return received;
+    u32 datagrams = rx->batch.count;
+    start = rx->timing != NULL ? stats_ticks() : 0;
+    PoseBatch_decode(&rx->batch, rx->ids, &rx->stats);
+    if (rx->timing != NULL) {
+        StageStats_add(
+            rx->timing, STAGE_DECODE, datagrams, stats_ticks() - start
+        );
+    }
+    return rx->batch.count;
+}
+
+void Receiver_free(Receiver* rx) {
+    if (rx->backend == RECV_BACKEND_URING) UringRecv_free(&rx->uring);
+    PoseBatch_free(&rx->batch);
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_RECEIVER_H */
@@ -0,0 +1,377 @@
+#ifndef PGPS_RECV_H
+#define PGPS_RECV_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cimpl_core.h"
+#include "pgps_intern.h"
+#include "pgps_pose.h"
+#include "pgps_time.h"
+#include "pgps_wire.h"
+
+#ifndef PGPS_BATCH_SIZE
+#define PGPS_BATCH_SIZE 64
+#endif
+
+#define PGPS_BATCH_MAX 1024
+// Buckets of the per-syscall fill histogram: 1, 2-3, 4-7, ..., 512-1023, 1024
+#define RECV_FILL_BUCKETS 11
+// Room for an SCM_TIMESTAMPNS and an SO_RXQ_OVFL control message
+#define RECV_CONTROL_SIZE \
+    (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(u32)))
+
+// Preallocated receive buffers for draining several datagrams per syscall.
+// Datagrams land in `wire` and are decoded into `samples`, dropping the ones
+// that fail validation, so `count` only covers valid poses.
+typedef struct PoseBatch {
+    u8* wire;
+    PoseSample* samples;
+    struct sockaddr_in* senders;
+    struct mmsghdr* msgs;
+    struct iovec* iovecs;
+    u32 count;
+    u32 capacity;
+
+    // Control data for every datagram, see RECV_CONTROL_SIZE
+    u8* control;
+
+    // Only allocated when receive timestamps are enabled.  Both are on
+    // latency_clock_ns: when the kernel queued the datagram and when the
+    // receive syscall returned it.  `kernel_ns` is 0 if no stamp came back.
+    bool timestamps;
+    u64* kernel_ns;
+    u64* user_ns;
+} PoseBatch;
+
+typedef struct RecvStats {
+    u64 syscalls;
+    u64 packets;
+    u32 max_fill;
+    // How many packets each successful syscall returned, in log2 buckets
+    u64 fill_hist[RECV_FILL_BUCKETS];
+    // Datagrams dropped by the decoder, by PoseWireStatus
+    u64 rejected[POSE_WIRE_STATUS_COUNT];
+    // Accepted poses whose timestamp didn't parse
+    u64 bad_timestamps;
+    // Datagrams the kernel dropped because the socket's receive buffer was
+    // full, from SO_RXQ_OVFL
+    u64 kernel_drops;
+    // SO_RCVBUF at the end, summed over sockets when merged, and how many
+    // times it was grown
+    usize rcvbuf_bytes;
+    u32 rcvbuf_resizes;
+} RecvStats;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn PoseBatch_init(PoseBatch*, u32, bool);
+void PoseBatch_free(PoseBatch*);
+void PoseBatch_read_control(PoseBatch*, RecvStats*);
+bool PoseBatch_decode_one(
+    PoseBatch*, u32, IdTable*, RecvStats*, const u8*, u32
+);
+void PoseBatch_decode(PoseBatch*, IdTable*, RecvStats*);
+u64 cmsg_kernel_ns(void*, usize);
+u32 cmsg_rxq_drops(void*, usize);
+isize PoseBatch_recv(PoseBatch*, isize, u32, RecvStats*);
+isize PoseBatch_recv_single(PoseBatch*, isize, RecvStats*);
+
+void RecvStats_record(RecvStats*, u32);
+void RecvStats_merge(RecvStats*, const RecvStats*);
+void RecvStats_print(const RecvStats*, FILE*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+/* PoseBatch */
+
+// Allocates room for `capacity` datagrams and wires each message header to
+// its wire buffer, sender slot and control buffer so the receive path never
+// touches the heap.  `timestamps` also allocates the per-pose stamps.
+CimplReturn PoseBatch_init(
+    PoseBatch* batch, u32 capacity, bool timestamps
+) {
+    if (capacity == 0 || capacity > PGPS_BATCH_MAX) {
+        log_error(
+            "Batch size %u must be between 1 and %d", capacity, PGPS_BATCH_MAX
+        );
+        return RETURN_ERR;
+    }
+    memset(batch, 0, sizeof(*batch));
+    batch->wire = calloc(capacity, POSE_WIRE_BUFFER_SIZE);
+    batch->samples = calloc(capacity, sizeof(PoseSample));
+    batch->senders = calloc(capacity, sizeof(struct sockaddr_in));
+    batch->msgs = calloc(capacity, sizeof(struct mmsghdr));
+    batch->iovecs = calloc(capacity, sizeof(struct iovec));
+    batch->control = calloc(capacity, RECV_CONTROL_SIZE);
+    if (batch->wire == NULL || batch->samples == NULL ||
+        batch->senders == NULL || batch->msgs == NULL ||
+        batch->iovecs == NULL || batch->control == NULL) {
+        log_error("PoseBatch_init: Out of memory");
+        PoseBatch_free(batch);
+        return RETURN_ERR;
+    }
+    if (timestamps) {
+        batch->timestamps = true;
+        batch->kernel_ns = calloc(capacity, sizeof(u64));
+        batch->user_ns = calloc(capacity, sizeof(u64));
+        if (batch->kernel_ns == NULL || batch->user_ns == NULL) {
+            log_error("PoseBatch_init: Out of memory");
+            PoseBatch_free(batch);
+            return RETURN_ERR;
+        }
+    }
+    for (u32 i = 0; i < capacity; ++i) {
+        batch->iovecs[i].iov_base =
+            batch->wire + (usize)i * POSE_WIRE_BUFFER_SIZE;
+        batch->iovecs[i].iov_len = POSE_WIRE_BUFFER_SIZE;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->senders[i];
+    }
+    batch->capacity = capacity;
+    return RETURN_OK;
+}
+
+void PoseBatch_free(PoseBatch* batch) {
+    free(batch->wire);
+    free(batch->samples);
+    free(batch->senders);
+    free(batch->msgs);
+    free(batch->iovecs);
+    free(batch->control);
+    free(batch->kernel_ns);
+    free(batch->user_ns);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Drains up to `max` datagrams with a single recvmmsg call.  Blocks (subject
+// to SO_RCVTIMEO) for the first datagram only, then takes whatever else is
+// already queued.  Returns the number received, or -1 with errno set.
+isize PoseBatch_recv(
+    PoseBatch* batch, isize socket_fd, u32 max, RecvStats* stats
+) {
+    if (max > batch->capacity) max = batch->capacity;
+    for (u32 i = 0; i < max; ++i) {
+        // The kernel overwrites these on return, so reset them every call
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->msgs[i].msg_len = 0;
+        batch->msgs[i].msg_hdr.msg_control =
+            batch->control + (usize)i * RECV_CONTROL_SIZE;
+        batch->msgs[i].msg_hdr.msg_controllen = RECV_CONTROL_SIZE;
+    }
+    int received =
+        recvmmsg(socket_fd, batch->msgs, max, MSG_WAITFORONE, NULL);
+    if (received < 0) {
+        batch->count = 0;
+        return -1;
+    }
+    batch->count = (u32)received;
+    PoseBatch_read_control(batch, stats);
+    RecvStats_record(stats, batch->count);
+    return received;
+}
+
+// Receives exactly one datagram into the first batch slot.  Plain recvfrom
+// can't return control data, so this is a recvmsg of one.
+isize PoseBatch_recv_single(
+    PoseBatch* batch, isize socket_fd, RecvStats* stats
+) {
+    struct msghdr* hdr = &batch->msgs[0].msg_hdr;
+    hdr->msg_namelen = sizeof(struct sockaddr_in);
+    hdr->msg_control = batch->control;
+    hdr->msg_controllen = RECV_CONTROL_SIZE;
+    isize recv_bytes = recvmsg(socket_fd, hdr, 0);
+    if (recv_bytes < 0) {
+        batch->count = 0;
+        return -1;
+    }
+    batch->msgs[0].msg_len = (u32)recv_bytes;
+    batch->count = 1;
+    PoseBatch_read_control(batch, stats);
+    RecvStats_record(stats, 1);
+    return 1;
+}
+
+// Picks up the socket's drop count and fills in `kernel_ns` and `user_ns`
+// for the datagrams just received
+void PoseBatch_read_control(PoseBatch* batch, RecvStats* stats) {
+    i64 offset = 0;
+    u64 now = batch->timestamps ? latency_clock_ns(&offset) : 0;
+    for (u32 i = 0; i < batch->count; ++i) {
+        struct msghdr* hdr = &batch->msgs[i].msg_hdr;
+        u32 drops = cmsg_rxq_drops(hdr->msg_control, hdr->msg_controllen);
+        if (drops > stats->kernel_drops) stats->kernel_drops = drops;
+        if (!batch->timestamps) continue;
+        batch->user_ns[i] = now;
+        batch->kernel_ns[i] = latency_clock_from_realtime(
+            cmsg_kernel_ns(hdr->msg_control, hdr->msg_controllen), offset
+        );
+    }
+}
+
+// Decodes the `len` byte datagram at `wire` into `samples[slot]`, interning
+// its id in `ids`.  False, with the reject counted in `stats`, when it isn't
+// a valid pose.
+bool PoseBatch_decode_one(
+    PoseBatch* batch,
+    u32 slot,
+    IdTable* ids,
+    RecvStats* stats,
+    const u8* wire,
+    u32 len
+) {
+    PoseWireStatus status =
+        PoseSample_decode(&batch->samples[slot], ids, wire, len);
+    if (status != POSE_WIRE_OK) {
+        stats->rejected[status]++;
+        return false;
+    }
+    if (batch->samples[slot].sent_ns == ISO8601_INVALID) {
+        stats->bad_timestamps++;
+    }
+    return true;
+}
+
+// Decodes the datagrams just received into `samples`, interning ids in
+// `ids`, and compacts the batch so the first `count` entries of every
+// per-datagram array are valid poses.  Rejects are counted in `stats`.
+void PoseBatch_decode(PoseBatch* batch, IdTable* ids, RecvStats* stats) {
+    u32 valid = 0;
+    for (u32 i = 0; i < batch->count; ++i) {
+        if (!PoseBatch_decode_one(
+                batch,
+                valid,
+                ids,
+                stats,
+                batch->wire + (usize)i * POSE_WIRE_BUFFER_SIZE,
+                batch->msgs[i].msg_len
+            )) {
+            continue;
+        }
+        if (valid != i) {
+            batch->msgs[valid].msg_len = batch->msgs[i].msg_len;
+            batch->senders[valid] = batch->senders[i];
+            if (batch->timestamps) {
+                batch->kernel_ns[valid] = batch->kernel_ns[i];
+                batch->user_ns[valid] = batch->user_ns[i];
+            }
+        }
+        valid++;
+    }
+    batch->count = valid;
+}
+
+// Pulls the SCM_TIMESTAMPNS stamp out of a control buffer, 0 if it has none
+u64 cmsg_kernel_ns(void* control, usize control_len) {
+    struct msghdr hdr = {
+        .msg_control = control,
+        .msg_controllen = control_len,
+    };
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return timespec_to_ns(&ts);
+        }
+    }
+    return 0;
+}
+
+// Pulls the SO_RXQ_OVFL count out of a control buffer.  It is the socket's
+// running total of drops, and only attached once there has been one.
+u32 cmsg_rxq_drops(void* control, usize control_len) {
+    struct msghdr hdr = {
+        .msg_control = control,
+        .msg_controllen = control_len,
+    };
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_RXQ_OVFL) {
+            u32 drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            return drops;
+        }
+    }
+    return 0;
+}
+
+/* RecvStats */
+
+void RecvStats_record(RecvStats* stats, u32 fill) {
+    stats->syscalls++;
+    stats->packets += fill;
+    if (fill > stats->max_fill) stats->max_fill = fill;
+    u32 bucket = 0;
+    while ((fill >>= 1) != 0 && bucket < RECV_FILL_BUCKETS - 1) {
+        bucket++;
+    }
+    stats->fill_hist[bucket]++;
+}
+
+// Adds `src` into `dst`, e.g. to total up shards, which each have their own
+// socket
+void RecvStats_merge(RecvStats* dst, const RecvStats* src) {
+    dst->syscalls += src->syscalls;
+    dst->packets += src->packets;
+    if (src->max_fill > dst->max_fill) dst->max_fill = src->max_fill;
+    for (u32 i = 0; i < RECV_FILL_BUCKETS; ++i) {
+        dst->fill_hist[i] += src->fill_hist[i];
+    }
+    for (u32 i = 0; i < POSE_WIRE_STATUS_COUNT; ++i) {
+        dst->rejected[i] += src->rejected[i];
+    }
+    dst->bad_timestamps += src->bad_timestamps;
+    dst->kernel_drops += src->kernel_drops;
+    dst->rcvbuf_bytes += src->rcvbuf_bytes;
+    dst->rcvbuf_resizes += src->rcvbuf_resizes;
+}
+
+void RecvStats_print(const RecvStats* stats, FILE* fp) {
+    f64 avg = stats->syscalls == 0
+                  ? 0.0
+                  : (f64)stats->packets / (f64)stats->syscalls;
+    fprintf(
+        fp,
+        "Received %lu packets in %lu syscalls (%.2f/syscall, max %u)\n",
+        stats->packets,
+        stats->syscalls,
+        avg,
+        stats->max_fill
+    );
+    for (u32 i = 0; i < RECV_FILL_BUCKETS; ++i) {
+        if (stats->fill_hist[i] == 0) continue;
+        u32 lo = 1u << i;
+        u32 hi = (i == RECV_FILL_BUCKETS - 1) ? lo : (lo << 1) - 1;
+        fprintf(
+            fp, "  %4u-%-4u per syscall: %lu\n", lo, hi, stats->fill_hist[i]
+        );
+    }
+    for (u32 i = 0; i < POSE_WIRE_STATUS_COUNT; ++i) {
+        if (stats->rejected[i] == 0) continue;
+        fprintf(
+            fp,
+            "  rejected %s: %lu\n",
+            PoseWireStatus_name((PoseWireStatus)i),
+            stats->rejected[i]
+        );
+    }
+    if (stats->bad_timestamps > 0) {
+        fprintf(fp, "  bad timestamps: %lu\n", stats->bad_timestamps);
+    }
+    fprintf(
+        fp,
+        "  kernel drops: %lu, SO_RCVBUF %zu bytes after %u resizes\n",
+        stats->kernel_drops,
+        stats->rcvbuf_bytes,
+        stats->rcvbuf_resizes
+    );
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_RECV_H */
@@ -0,0 +1,334 @@
+#ifndef PGPS_REORDER_H
+#define PGPS_REORDER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cimpl_core.h"
+#include "pgps_intern.h"
+#include "pgps_iso8601.h"
+#include "pgps_ring.h"
+
+#define REORDER_DEFAULT_WINDOW 32
+#define REORDER_DEFAULT_BUDGET_NS (50 * 1000000ull)
+// A step between consecutive poses this many times the body's usual
+// interval counts as a gap
+#define REORDER_GAP_FACTOR 1.5
+// Steps the interval is seeded from, as their minimum, before any gap is
+// counted, so a gap among the first few poses can't inflate it
+#define REORDER_SEED_STEPS 8
+
+typedef struct ReorderConfig {
+    // Poses held per body, 0 disables reordering
+    u32 window;
+    // Longest a pose is held waiting for earlier ones, monotonic ns
+    u64 budget_ns;
+} ReorderConfig;
+
+typedef struct ReorderStats {
+    // Arrived after every pose sent before them
+    u64 in_order;
+    // Arrived early and were put back in place
+    u64 reordered;
+    // Same sender timestamp as one already held or emitted, dropped
+    u64 duplicates;
+    // Sent before a pose that had already been emitted, dropped
+    u64 late;
+    // Emitted because the window was full rather than the budget running out
+    u64 evicted;
+    // Timestamp didn't parse, passed straight through
+    u64 unordered;
+    // Steps in sender time well over the usual interval, and an estimate of
+    // the poses missing in them
+    u64 gaps;
+    u64 missing;
+} ReorderStats;
+
+// Poses of one body held back, sorted by sender time
+typedef struct ReorderBody {
+    PoseRecord* held;
+    u32 count;
+    // Earliest arrival among `held`, monotonic ns
+    u64 oldest_recv_ns;
+    bool started;
+    i64 last_sent_ns;
+    // Running estimate of the sender's interval, and steps seen so far
+    i64 interval_ns;
+    u32 steps;
+    ReorderStats stats;
+} ReorderBody;
+
+// Per-body reorder stage keyed on the parsed sender timestamp.  A pose is
+// emitted once the window behind it is full or it has been held for the
+// budget, whichever is first, so each body comes out in sender order with
+// bounded added latency.
+typedef struct PoseReorder {
+    ReorderConfig config;
+    ReorderBody* bodies;
+    // Handles that have a body, in order of first sight
+    IdHandle active[ID_TABLE_CAPACITY];
+    u32 active_count;
+} PoseReorder;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn PoseReorder_init(PoseReorder*, ReorderConfig);
+CimplReturn PoseReorder_push(PoseReorder*, const PoseRecord*, PoseRecordArray*);
+CimplReturn PoseReorder_tick(PoseReorder*, u64, PoseRecordArray*);
+CimplReturn PoseReorder_flush(PoseReorder*, PoseRecordArray*);
+void PoseReorder_totals(const PoseReorder*, ReorderStats*);
+void PoseReorder_print(const PoseReorder*, const IdTable*, FILE*);
+void PoseReorder_free(PoseReorder*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+CimplReturn PoseReorder_init(PoseReorder* reorder, ReorderConfig config) {
+    memset(reorder, 0, sizeof(*reorder));
+    reorder->config = config;
+    reorder->bodies = calloc(ID_TABLE_CAPACITY, sizeof(ReorderBody));
+    if (reorder->bodies == NULL) {
+        log_error("PoseReorder_init: Out of memory");
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// Advances the body's sender clock to an emitted pose and counts a gap if
+// it jumped well past the usual interval
+static void ReorderBody_advance(ReorderBody* body, i64 sent_ns) {
+    if (body->started) {
+        i64 step = sent_ns - body->last_sent_ns;
+        if (body->steps < REORDER_SEED_STEPS) {
+            body->steps++;
+            if (body->interval_ns == 0 || step < body->interval_ns) {
+                body->interval_ns = step;
+            }
+        } else if (step > body->interval_ns * REORDER_GAP_FACTOR) {
+            body->stats.gaps++;
+            // Rounded to the nearest whole number of intervals
+            i64 intervals = (step + body->interval_ns / 2) / body->interval_ns;
+            body->stats.missing += (u64)(intervals - 1);
+        } else {
+            body->interval_ns += (step - body->interval_ns) / 8;
+        }
+    }
+    body->started = true;
+    body->last_sent_ns = sent_ns;
+}
+
+// Hands the first `count` held poses to `out`
+static CimplReturn ReorderBody_emit(
+    ReorderBody* body, u32 count, PoseRecordArray* out
+) {
+    for (u32 i = 0; i < count; ++i) {
+        ReorderBody_advance(body, body->held[i].sample.sent_ns);
+        if (PoseRecordArray_push(out, body->held[i]) != RETURN_OK) {
+            return RETURN_ERR;
+        }
+    }
+    body->count -= count;
+    memmove(body->held, body->held + count, body->count * sizeof(PoseRecord));
+    body->oldest_recv_ns = UINT64_MAX;
+    for (u32 i = 0; i < body->count; ++i) {
+        if (body->held[i].recv_ns < body->oldest_recv_ns) {
+            body->oldest_recv_ns = body->held[i].recv_ns;
+        }
+    }
+    return RETURN_OK;
+}
+
+// Whether a pose received at `recv_ns` has been held for the budget.  The
+// caller's clock may be behind a record's stamp, that is never overdue.
+static bool Reorder_overdue(u64 now, u64 recv_ns, u64 budget_ns) {
+    return now >= recv_ns && now - recv_ns >= budget_ns;
+}
+
+static ReorderBody* PoseReorder_body(PoseReorder* reorder, IdHandle id) {
+    ReorderBody* body = &reorder->bodies[id];
+    if (body->held != NULL) return body;
+    body->held = calloc(reorder->config.window, sizeof(PoseRecord));
+    if (body->held == NULL) {
+        log_error("PoseReorder: Out of memory");
+        return NULL;
+    }
+    body->oldest_recv_ns = UINT64_MAX;
+    reorder->active[reorder->active_count++] = id;
+    return body;
+}
+
+// Takes one received pose.  Whatever it pushes out of the window, or the
+// pose itself if it can't be ordered, is appended to `out`.
+CimplReturn PoseReorder_push(
+    PoseReorder* reorder, const PoseRecord* record, PoseRecordArray* out
+) {
+    ReorderBody* body = PoseReorder_body(reorder, record->sample.id);
+    if (body == NULL) return RETURN_ERR;
+    i64 sent_ns = record->sample.sent_ns;
+    if (sent_ns == ISO8601_INVALID) {
+        body->stats.unordered++;
+        return PoseRecordArray_push(out, *record);
+    }
+    if (body->started && sent_ns <= body->last_sent_ns) {
+        if (sent_ns == body->last_sent_ns) {
+            body->stats.duplicates++;
+        } else {
+            body->stats.late++;
+        }
+        return RETURN_OK;
+    }
+
+    // Almost always lands at the end, so search from there
+    u32 at = body->count;
+    while (at > 0 && body->held[at - 1].sample.sent_ns > sent_ns) at--;
+    if (at > 0 && body->held[at - 1].sample.sent_ns == sent_ns) {
+        body->stats.duplicates++;
+        return RETURN_OK;
+    }
+    if (at == body->count) {
+        body->stats.in_order++;
+    } else {
+        body->stats.reordered++;
+    }
+
+    if (body->count == reorder->config.window) {
+        // Window full, the earliest pose can't wait any longer
+        body->stats.evicted++;
+        if (at == 0) {
+            // The new pose is the earliest, it goes straight out
+            ReorderBody_advance(body, sent_ns);
+            return PoseRecordArray_push(out, *record);
+        }
+        if (ReorderBody_emit(body, 1, out) != RETURN_OK) return RETURN_ERR;
+        at--;
+    }
+    memmove(
+        body->held + at + 1,
+        body->held + at,
+        (body->count - at) * sizeof(PoseRecord)
+    );
+    body->held[at] = *record;
+    body->count++;
+    if (record->recv_ns < body->oldest_recv_ns) {
+        body->oldest_recv_ns = record->recv_ns;
+    }
+    return RETURN_OK;
+}
+
+// Emits every pose that has been held for the budget, along with the
+// earlier poses that have to go out before it.  `now` is monotonic ns.
+CimplReturn PoseReorder_tick(
+    PoseReorder* reorder, u64 now, PoseRecordArray* out
+) {
+    u64 budget_ns = reorder->config.budget_ns;
+    for (u32 i = 0; i < reorder->active_count; ++i) {
+        ReorderBody* body = &reorder->bodies[reorder->active[i]];
+        while (body->count > 0 &&
+               Reorder_overdue(now, body->oldest_recv_ns, budget_ns)) {
+            // Everything up to the latest overdue pose
+            u32 due = 0;
+            for (u32 j = 0; j < body->count; ++j) {
+                if (Reorder_overdue(now, body->held[j].recv_ns, budget_ns)) {
+                    due = j + 1;
+                }
+            }
+            if (ReorderBody_emit(body, due, out) != RETURN_OK) {
+                return RETURN_ERR;
+            }
+        }
+    }
+    return RETURN_OK;
+}
+
+// Emits everything still held, e.g. at the end of a capture, merged across
+// bodies in sender order
+CimplReturn PoseReorder_flush(PoseReorder* reorder, PoseRecordArray* out) {
+    for (;;) {
+        ReorderBody* next = NULL;
+        for (u32 i = 0; i < reorder->active_count; ++i) {
+            ReorderBody* body = &reorder->bodies[reorder->active[i]];
+            if (body->count == 0) continue;
+            if (next == NULL ||
+                body->held[0].sample.sent_ns < next->held[0].sample.sent_ns) {
+                next = body;
+            }
+        }
+        if (next == NULL) return RETURN_OK;
+        if (ReorderBody_emit(next, 1, out) != RETURN_OK) return RETURN_ERR;
+    }
+}
+
+static void ReorderStats_add(ReorderStats* dst, const ReorderStats* src) {
+    dst->in_order += src->in_order;
+    dst->reordered += src->reordered;
+    dst->duplicates += src->duplicates;
+    dst->late += src->late;
+    dst->evicted += src->evicted;
+    dst->unordered += src->unordered;
+    dst->gaps += src->gaps;
+    dst->missing += src->missing;
+}
+
+void PoseReorder_totals(const PoseReorder* reorder, ReorderStats* total) {
+    memset(total, 0, sizeof(*total));
+    for (u32 i = 0; i < reorder->active_count; ++i) {
+        ReorderStats_add(total, &reorder->bodies[reorder->active[i]].stats);
+    }
+}
+
+static void ReorderStats_print(const ReorderStats* stats, FILE* fp) {
+    fprintf(
+        fp,
+        "in order %lu, reordered %lu, duplicate %lu, late %lu, "
+        "evicted %lu, unordered %lu, gaps %lu (~%lu poses missing)\n",
+        stats->in_order,
+        stats->reordered,
+        stats->duplicates,
+        stats->late,
+        stats->evicted,
+        stats->unordered,
+        stats->gaps,
+        stats->missing
+    );
+}
+
+// Reordered, late and duplicate poses point at the network; gaps without
+// them point at the tracker
+void PoseReorder_print(
+    const PoseReorder* reorder, const IdTable* ids, FILE* fp
+) {
+    ReorderStats total;
+    PoseReorder_totals(reorder, &total);
+    fprintf(
+        fp,
+        "Reorder (window %u, budget %lu ms): ",
+        reorder->config.window,
+        reorder->config.budget_ns / 1000000
+    );
+    ReorderStats_print(&total, fp);
+    for (u32 i = 0; i < reorder->active_count; ++i) {
+        IdHandle id = reorder->active[i];
+        const ReorderBody* body = &reorder->bodies[id];
+        fprintf(
+            fp,
+            "  %s (interval %.3f ms): ",
+            IdTable_name(ids, id).items,
+            (f64)body->interval_ns / 1e6
+        );
+        ReorderStats_print(&body->stats, fp);
+    }
+}
+
+void PoseReorder_free(PoseReorder* reorder) {
+    if (reorder->bodies != NULL) {
+        for (u32 i = 0; i < reorder->active_count; ++i) {
+            free(reorder->bodies[reorder->active[i]].held);
+        }
+    }
+    free(reorder->bodies);
+    memset(reorder, 0, sizeof(*reorder));
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_REORDER_H */
@@ -0,0 +1,148 @@
+#ifndef PGPS_RING_H
+#define PGPS_RING_H
+
+#include <stdbool.h>
+
+#include "cimpl_core.h"
+#include "pgps_pose.h"
+
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
+#ifndef POSE_RING_DEFAULT_CAPACITY
+#define POSE_RING_DEFAULT_CAPACITY 4096
+#endif
+
+// A received pose plus everything the output side needs to know about it
+typedef struct PoseRecord {
+    // Monotonic ns the receive syscall returned, used for ordering
+    u64 recv_ns;
+    // Receive stamps on latency_clock_ns, only filled in with timestamps
+    // enabled
+    u64 kernel_ns;
+    u64 user_ns;
+    u32 len;
+    PoseSample sample;
+} PoseRecord;
+
+DEFINE_DYNAMIC_ARRAY(PoseRecord, PoseRecordArray)
+
+// Lock-free single-producer/single-consumer ring of PoseRecords.  Producer
+// and consumer indices live on their own cache lines, and each side keeps a
+// cached copy of the other's index so the shared line is only read when the
+// ring looks full (producer) or empty (consumer).  A full ring drops the
+// newest records and counts them rather than blocking the receive thread.
+typedef struct PoseRing {
+    // Producer side
+    CACHE_ALIGNED u64 head;
+    u64 cached_tail;
+    u64 overflows;
+    u64 high_water;
+
+    // Consumer side
+    CACHE_ALIGNED u64 tail;
+    u64 cached_head;
+
+    // Read-only after init
+    CACHE_ALIGNED PoseRecord* items;
+    u64 capacity;
+    u64 mask;
+} PoseRing;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn PoseRing_init(PoseRing*, u64);
+void PoseRing_free(PoseRing*);
+u32 PoseRing_push_many(PoseRing*, const PoseRecord*, u32);
+u64 PoseRing_peek(PoseRing*, PoseRecord**);
+void PoseRing_release(PoseRing*, u64);
+u64 PoseRing_overflows(const PoseRing*);
+u64 PoseRing_high_water(const PoseRing*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+// `capacity` is rounded up to a power of two
+CimplReturn PoseRing_init(PoseRing* ring, u64 capacity) {
+    memset(ring, 0, sizeof(*ring));
+    u64 rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+    ring->items = aligned_alloc(
+        CACHE_LINE_SIZE,
+        (rounded * sizeof(PoseRecord) + CACHE_LINE_SIZE - 1) &
+            ~(u64)(CACHE_LINE_SIZE - 1)
+    );
+    if (ring->items == NULL) {
+        log_error("PoseRing_init: Out of memory");
+        return RETURN_ERR;
+    }
+    ring->capacity = rounded;
+    ring->mask = rounded - 1;
+    return RETURN_OK;
+}
+
+void PoseRing_free(PoseRing* ring) {
+    free(ring->items);
+    ring->items = NULL;
+    ring->capacity = 0;
+}
+
+// Producer only.  Copies in as many of `records` as fit and publishes them
+// with a single store.  Returns how many were accepted, the rest count as
+// overflows.
+u32 PoseRing_push_many(
+    PoseRing* ring, const PoseRecord* records, u32 count
+) {
+    u64 head = ring->head;
+    u64 free_slots = ring->capacity - (head - ring->cached_tail);
+    if (free_slots < count) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        free_slots = ring->capacity - (head - ring->cached_tail);
+    }
+    u32 accepted = count < free_slots ? count : (u32)free_slots;
+    for (u32 i = 0; i < accepted; ++i) {
+        ring->items[(head + i) & ring->mask] = records[i];
+    }
+    __atomic_store_n(&ring->head, head + accepted, __ATOMIC_RELEASE);
+
+    u64 used = head + accepted - ring->cached_tail;
+    if (used > ring->high_water) {
+        __atomic_store_n(&ring->high_water, used, __ATOMIC_RELAXED);
+    }
+    if (accepted < count) {
+        u64 overflows = ring->overflows + (count - accepted);
+        __atomic_store_n(&ring->overflows, overflows, __ATOMIC_RELAXED);
+    }
+    return accepted;
+}
+
+// Consumer only.  Points `first` at the oldest unread record and returns how
+// many can be read contiguously from there, 0 if the ring is empty.
+u64 PoseRing_peek(PoseRing* ring, PoseRecord** first) {
+    u64 tail = ring->tail;
+    if (tail == ring->cached_head) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == ring->cached_head) return 0;
+    }
+    u64 available = ring->cached_head - tail;
+    u64 until_wrap = ring->capacity - (tail & ring->mask);
+    *first = &ring->items[tail & ring->mask];
+    return available < until_wrap ? available : until_wrap;
+}
+
+// Consumer only.  Hands `count` peeked records back to the producer.
+void PoseRing_release(PoseRing* ring, u64 count) {
+    __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+// Safe to read from either side while the ring is live
+u64 PoseRing_overflows(const PoseRing* ring) {
+    return __atomic_load_n(&ring->overflows, __ATOMIC_RELAXED);
+}
+
+u64 PoseRing_high_water(const PoseRing* ring) {
+    return __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED);
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_RING_H */
@@ -0,0 +1,292 @@
+#ifndef PGPS_SHARD_H
+#define PGPS_SHARD_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "pgps_intern.h"
+#include "pgps_pose.h"
+#include "pgps_receiver.h"
+#include "pgps_ring.h"
+#include "pgps_stats.h"
+#include "pgps_time.h"
+
+// Shards poll their stop flag at this interval while the socket is idle
+#define SHARD_RECV_TIMEOUT_USEC 100000
+#define SHARD_MAX 64
+
+typedef struct ShardConfig {
+    RecvBackend backend;
+    u32 batch_size;
+    bool timestamps;
+    // Each shard sizes its own socket's receive buffer
+    RcvBufConfig rcvbuf;
+    // Shared by all shards
+    IdTable* ids;
+    // Records each shard can queue for the sink before it starts dropping
+    u64 ring_capacity;
+    // Where each shard publishes its receive timing, NULL for nowhere
+    StatsPage* stats;
+} ShardConfig;
+
+struct ShardSet;
+
+// One receive thread.  It is the only producer on `ring` and the sink is
+// the only consumer.
+typedef struct Shard {
+    pthread_t thread;
+    isize socket_fd;
+    u32 index;
+    i32 cpu;
+    ShardConfig config;
+    const bool* running;
+    struct ShardSet* set;
+
+    PoseRing ring;
+    // No record published later by this shard will be older than this.
+    // Always stored after the records it covers have been pushed.
+    CACHE_ALIGNED u64 watermark_ns;
+
+    // Owned by the shard thread, read by the sink only after join
+    RecvStats stats;
+    StageStats* timing;
+} Shard;
+
+typedef struct ShardSet {
+    Shard* shards;
+    u32 count;
+    bool running;
+
+    // Startup handshake, ShardSet_start waits until every shard has its
+    // receiver or has given up
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    u32 starting;
+    u32 failed;
+} ShardSet;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn ShardSet_start(ShardSet*, const isize*, u32, ShardConfig);
+void ShardSet_stop(ShardSet*);
+CimplReturn ShardSet_merge(ShardSet*, PoseRecordArray*, bool);
+void ShardSet_free(ShardSet*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+static void Shard_started(Shard* shard, bool ok) {
+    ShardSet* set = shard->set;
+    pthread_mutex_lock(&set->lock);
+    set->starting--;
+    if (!ok) set->failed++;
+    pthread_cond_signal(&set->started);
+    pthread_mutex_unlock(&set->lock);
+}
+
+static void* Shard_run(void* arg) {
+    Shard* shard = arg;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        log_warn_fields(
+            "Failed to pin shard",
+            LOG_U64("shard", shard->index),
+            LOG_I64("cpu", shard->cpu)
+        );
+    }
+
+    Receiver rx = {0};
+    PoseRecord* records = NULL;
+    bool ok = false;
+    if (Receiver_init(
+            &rx,
+            shard->config.backend,
+            shard->socket_fd,
+            shard->config.ids,
+            shard->config.batch_size,
+            SHARD_RECV_TIMEOUT_USEC,
+            shard->config.timestamps,
+            shard->config.rcvbuf
+        ) != RETURN_OK) {
+        log_error_fields(
+            "Failed to set up the shard receiver",
+            LOG_U64("shard", shard->index)
+        );
+        goto done;
+    }
+    rx.timing = shard->timing;
+    PoseBatch* batch = &rx.batch;
+    records = calloc(batch->capacity, sizeof(PoseRecord));
+    if (records == NULL) {
+        log_error("Shard %u: Out of memory", shard->index);
+        goto done;
+    }
+    ok = true;
+    Shard_started(shard, true);
+    while (__atomic_load_n(shard->running, __ATOMIC_ACQUIRE)) {
+        isize received = Receiver_recv(&rx, batch->capacity);
+        if (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR) {
+            log_error(
+                "Shard %u: failed to receive packet: %s",
+                shard->index,
+                strerror(errno)
+            );
+            break;
+        }
+
+        // Stamped after the syscall returns, so every later packet from this
+        // socket gets a stamp no smaller than this one.  Timeouts still
+        // advance the watermark so an idle shard never holds back the merge.
+        u64 now = monotonic_ns();
+        for (u32 i = 0; i < batch->count; ++i) {
+            PoseRecord* record = &records[i];
+            record->recv_ns = now;
+            record->len = batch->msgs[i].msg_len;
+            record->sample = batch->samples[i];
+            if (batch->timestamps) {
+                record->kernel_ns = batch->kernel_ns[i];
+                record->user_ns = batch->user_ns[i];
+            }
+        }
+        if (batch->count > 0) {
+            PoseRing_push_many(&shard->ring, records, batch->count);
+        }
+        __atomic_store_n(&shard->watermark_ns, now, __ATOMIC_RELEASE);
+    }
+    shard->stats = rx.stats;
+
+done:
+    if (!ok) Shard_started(shard, false);
+    free(records);
+    Receiver_free(&rx);
+    // Nothing else will be published, release the merge
+    __atomic_store_n(&shard->watermark_ns, UINT64_MAX, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Spawns one receive thread per socket, each pinned to its own core.  Only
+// returns once every shard is receiving, fails if any of them could not.
+CimplReturn ShardSet_start(
+    ShardSet* set, const isize* socket_fds, u32 count, ShardConfig config
+) {
+    memset(set, 0, sizeof(*set));
+    // Shards hold cache line aligned members, calloc doesn't promise that
+    set->shards = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(Shard));
+    if (set->shards == NULL) {
+        log_error("ShardSet_start: Out of memory");
+        return RETURN_ERR;
+    }
+    memset(set->shards, 0, count * sizeof(Shard));
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->started, NULL);
+    set->starting = count;
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count < 1) cpu_count = 1;
+    if ((long)count > cpu_count) {
+        log_warn(
+            "%u shards on %ld CPUs, some cores are shared", count, cpu_count
+        );
+    }
+
+    set->running = true;
+    for (u32 i = 0; i < count; ++i) {
+        Shard* shard = &set->shards[i];
+        shard->socket_fd = socket_fds[i];
+        shard->index = i;
+        shard->cpu = (i32)(i % (u32)cpu_count);
+        shard->config = config;
+        shard->running = &set->running;
+        shard->set = set;
+        char name[STATS_NAME_SIZE];
+        snprintf(name, sizeof(name), "shard %hu", (u16)i);
+        shard->timing = StatsPage_thread(config.stats, name);
+        if (PoseRing_init(&shard->ring, config.ring_capacity) != RETURN_OK) {
+            ShardSet_stop(set);
+            ShardSet_free(set);
+            return RETURN_ERR;
+        }
+        if (pthread_create(&shard->thread, NULL, Shard_run, shard) != 0) {
+            log_error("Failed to start shard %u", i);
+            PoseRing_free(&shard->ring);
+            ShardSet_stop(set);
+            ShardSet_free(set);
+            return RETURN_ERR;
+        }
+        set->count++;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    while (set->starting > 0) pthread_cond_wait(&set->started, &set->lock);
+    u32 failed = set->failed;
+    pthread_mutex_unlock(&set->lock);
+    if (failed > 0) {
+        log_error("%u of %u shards failed to start", failed, count);
+        ShardSet_stop(set);
+        ShardSet_free(set);
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+// Safe to call more than once
+void ShardSet_stop(ShardSet* set) {
+    if (!__atomic_exchange_n(&set->running, false, __ATOMIC_ACQ_REL)) return;
+    for (u32 i = 0; i < set->count; ++i) {
+        pthread_join(set->shards[i].thread, NULL);
+    }
+}
+
+// Moves every queued record older than all shard watermarks into `out`, in
+// receive timestamp order.  With `flush` set the watermark is ignored, which
+// is only safe once the shards have been stopped.
+CimplReturn ShardSet_merge(ShardSet* set, PoseRecordArray* out, bool flush) {
+    // Watermarks first: anything stamped at or before them is already
+    // visible in the rings
+    u64 watermark = UINT64_MAX;
+    for (u32 i = 0; !flush && i < set->count; ++i) {
+        u64 shard_watermark =
+            __atomic_load_n(&set->shards[i].watermark_ns, __ATOMIC_ACQUIRE);
+        if (shard_watermark < watermark) watermark = shard_watermark;
+    }
+
+    // K-way merge, K is the shard count so a linear scan for the head is fine
+    for (;;) {
+        Shard* next = NULL;
+        PoseRecord* next_record = NULL;
+        for (u32 i = 0; i < set->count; ++i) {
+            PoseRecord* record = NULL;
+            if (PoseRing_peek(&set->shards[i].ring, &record) == 0) continue;
+            if (record->recv_ns > watermark) continue;
+            if (next == NULL || record->recv_ns < next_record->recv_ns) {
+                next = &set->shards[i];
+                next_record = record;
+            }
+        }
+        if (next == NULL) break;
+        if (PoseRecordArray_push(out, *next_record) != RETURN_OK) {
+            return RETURN_ERR;
+        }
+        PoseRing_release(&next->ring, 1);
+    }
+    return RETURN_OK;
+}
+
+void ShardSet_free(ShardSet* set) {
+    for (u32 i = 0; i < set->count; ++i) PoseRing_free(&set->shards[i].ring);
+    free(set->shards);
+    pthread_cond_destroy(&set->started);
+    pthread_mutex_destroy(&set->lock);
+    memset(set, 0, sizeof(*set));
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_SHARD_H */
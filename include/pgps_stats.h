@@ -0,0 +1,206 @@
+#ifndef PGPS_STATS_H
+#define PGPS_STATS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "pgps_ring.h"
+#include "pgps_time.h"
+
+// Live counters published in a POSIX shared memory object, see
+// src/stat.c.  Every thread of the listener owns one StageStats slot and is
+// its only writer; readers map the page read-only and never take a lock, so
+// watching a run costs the listener nothing but the odd shared cache line.
+#define STATS_MAGIC 0x53544750u
+#define STATS_VERSION 1
+// The writer plus one receive thread per shard
+#define STATS_THREAD_MAX 65
+#define STATS_NAME_SIZE 16
+
+typedef enum {
+    // The receive syscall(s), including time blocked until data arrived
+    STAGE_RECV,
+    // Validating datagrams and interning ids
+    STAGE_DECODE,
+    // Turning poses into CSV rows or binary log records
+    STAGE_FORMAT,
+    // Handing formatted rows to the kernel
+    STAGE_WRITE,
+    // fflush or writeback of the mapped log
+    STAGE_FLUSH,
+    STAGE_COUNT,
+} Stage;
+
+typedef struct StageCounter {
+    u64 calls;
+    // Datagrams through recv and decode, poses through format, bytes
+    // through write and flush
+    u64 items;
+    // Time spent in the stage, in StatsPage.tick_hz ticks
+    u64 ticks;
+} StageCounter;
+
+// One thread's counters, on cache lines of their own
+typedef struct CACHE_ALIGNED StageStats {
+    StageCounter stages[STAGE_COUNT];
+    char name[STATS_NAME_SIZE];
+} StageStats;
+
+typedef struct StatsPage {
+    // Written last, a reader that sees it sees the rest of the header
+    u32 magic;
+    u32 version;
+    i32 pid;
+    u32 thread_count;
+    // Ticks per second of stats_ticks
+    u64 tick_hz;
+    // CLOCK_MONOTONIC ns the page was created
+    u64 start_ns;
+    StageStats threads[STATS_THREAD_MAX];
+} StatsPage;
+
+/*** FUNCTION DECLARATIONS ***/
+
+const char* Stage_name(Stage);
+u64 stats_ticks(void);
+
+void StageStats_add(StageStats*, Stage, u64, u64);
+
+CimplReturn StatsPage_create(StatsPage**, const char*);
+StageStats* StatsPage_thread(StatsPage*, const char*);
+void StatsPage_destroy(StatsPage*, const char*);
+CimplReturn StatsPage_attach(const StatsPage**, const char*);
+void StatsPage_detach(const StatsPage*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+const char* Stage_name(Stage stage) {
+    switch (stage) {
+        case STAGE_RECV:
+            return "recv";
+        case STAGE_DECODE:
+            return "decode";
+        case STAGE_FORMAT:
+            return "format";
+        case STAGE_WRITE:
+            return "write";
+        case STAGE_FLUSH:
+            return "flush";
+        case STAGE_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+// The log clock, timestamp_ns: an invariant TSC scaled to ns where there is
+// one, so no syscall and no calibration of its own
+u64 stats_ticks(void) { return timestamp_ns(); }
+
+// Adds one call covering `items` that took `ticks`.  Only the owning thread
+// writes, the relaxed stores just keep each counter untorn for readers.
+void StageStats_add(StageStats* stats, Stage stage, u64 items, u64 ticks) {
+    StageCounter* counter = &stats->stages[stage];
+    __atomic_store_n(&counter->calls, counter->calls + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&counter->items, counter->items + items, __ATOMIC_RELAXED);
+    __atomic_store_n(&counter->ticks, counter->ticks + ticks, __ATOMIC_RELAXED);
+}
+
+// Creates (or replaces) the shared memory object `name`, e.g. "/pgps"
+CimplReturn StatsPage_create(StatsPage** out, const char* name) {
+    *out = NULL;
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("Failed to create stats page %s: %s", name, strerror(errno));
+        return RETURN_ERR;
+    }
+    if (ftruncate(fd, sizeof(StatsPage)) != 0) {
+        log_error("Failed to size stats page %s: %s", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return RETURN_ERR;
+    }
+    void* map = mmap(
+        NULL, sizeof(StatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("Failed to map stats page %s: %s", name, strerror(errno));
+        shm_unlink(name);
+        return RETURN_ERR;
+    }
+    StatsPage* page = map;
+    page->version = STATS_VERSION;
+    page->pid = (i32)getpid();
+    page->tick_hz = NS_PER_SEC;
+    page->start_ns = monotonic_ns();
+    __atomic_store_n(&page->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    *out = page;
+    return RETURN_OK;
+}
+
+// Hands out the next slot, NULL once they're gone.  Called before the thread
+// that will own it starts.
+StageStats* StatsPage_thread(StatsPage* page, const char* name) {
+    if (page == NULL) return NULL;
+    if (page->thread_count == STATS_THREAD_MAX) {
+        log_warn("No stats slot left for %s", name);
+        return NULL;
+    }
+    StageStats* stats = &page->threads[page->thread_count];
+    snprintf(stats->name, sizeof(stats->name), "%s", name);
+    __atomic_store_n(
+        &page->thread_count, page->thread_count + 1, __ATOMIC_RELEASE
+    );
+    return stats;
+}
+
+void StatsPage_destroy(StatsPage* page, const char* name) {
+    if (page == NULL) return;
+    munmap(page, sizeof(StatsPage));
+    shm_unlink(name);
+}
+
+// Maps a listener's page read-only
+CimplReturn StatsPage_attach(const StatsPage** out, const char* name) {
+    *out = NULL;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        log_error("No stats page %s: %s", name, strerror(errno));
+        return RETURN_ERR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (usize)st.st_size < sizeof(StatsPage)) {
+        log_error("%s is not a stats page", name);
+        close(fd);
+        return RETURN_ERR;
+    }
+    void* map = mmap(NULL, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("Failed to map stats page %s: %s", name, strerror(errno));
+        return RETURN_ERR;
+    }
+    const StatsPage* page = map;
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+        page->version != STATS_VERSION) {
+        log_error("%s is not a version %d stats page", name, STATS_VERSION);
+        munmap(map, sizeof(StatsPage));
+        return RETURN_ERR;
+    }
+    *out = page;
+    return RETURN_OK;
+}
+
+void StatsPage_detach(const StatsPage* page) {
+    if (page != NULL) munmap((void*)page, sizeof(StatsPage));
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_STATS_H */
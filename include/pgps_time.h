@@ -0,0 +1,50 @@
+#ifndef PGPS_TIME_H
+#define PGPS_TIME_H
+
+#include <time.h>
+
+#include "cimpl_core.h"
+
+#define NS_PER_SEC 1000000000ull
+
+/*** FUNCTION DECLARATIONS ***/
+
+u64 monotonic_ns(void);
+u64 realtime_ns(void);
+u64 latency_clock_ns(i64*);
+u64 latency_clock_from_realtime(u64, i64);
+u64 timespec_to_ns(const struct timespec*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+u64 monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+// Same clock the kernel uses for SO_TIMESTAMPNS, so the two can be
+// subtracted.  Read off the TSC with a cached offset, cheap enough to stamp
+// every batch from any thread, and within a resync of an NTP step.
+u64 realtime_ns(void) { return timestamp_wall_ns(); }
+
+// The clock latency stages are stamped on: timestamp_ns, which never steps.
+// `wall_offset`, when not NULL, gets what turns this reading into
+// CLOCK_REALTIME, for moving kernel stamps onto it.
+u64 latency_clock_ns(i64* wall_offset) { return timestamp_read(wall_offset); }
+
+// A CLOCK_REALTIME stamp such as SO_TIMESTAMPNS on the latency clock, using
+// the offset of a latency_clock_ns reading taken with it.  0, no stamp,
+// stays 0.
+u64 latency_clock_from_realtime(u64 realtime, i64 wall_offset) {
+    if (realtime == 0 || (i64)realtime <= wall_offset) return 0;
+    return (u64)((i64)realtime - wall_offset);
+}
+
+u64 timespec_to_ns(const struct timespec* ts) {
+    return (u64)ts->tv_sec * NS_PER_SEC + (u64)ts->tv_nsec;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_TIME_H */
@@ -0,0 +1,347 @@
+#ifndef PGPS_URING_H
+#define PGPS_URING_H
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cimpl_core.h"
+#include "pgps_pose.h"
+#include "pgps_recv.h"
+
+// Provided buffers registered with the ring.  Must be a power of two.
+#ifndef URING_BUF_COUNT
+#define URING_BUF_COUNT 1024
+#endif
+
+#define URING_BUF_GROUP 0
+
+// io_uring receive engine.  A single multishot recvmsg stays armed on the
+// socket and the kernel completes into buffers picked from a provided buffer
+// ring, so one io_uring_enter can harvest any number of datagrams.
+typedef struct UringRecv {
+    i32 ring_fd;
+    isize socket_fd;
+    u64 timeout_usec;
+    bool armed;
+
+    // Submission queue
+    void* sq_ptr;
+    usize sq_size;
+    u32* sq_tail;
+    u32* sq_mask;
+    u32* sq_array;
+    struct io_uring_sqe* sqes;
+    usize sqes_size;
+
+    // Completion queue, shares `sq_ptr` with IORING_FEAT_SINGLE_MMAP
+    void* cq_ptr;
+    usize cq_size;
+    u32* cq_head;
+    u32* cq_tail;
+    u32* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Provided buffer ring
+    struct io_uring_buf_ring* buf_ring;
+    usize buf_ring_size;
+    u8* buffers;
+    u32 buf_size;
+    u16 buf_tail;
+
+    // Template for every multishot completion: where the sender address and
+    // control data go inside each provided buffer
+    struct msghdr msg;
+} UringRecv;
+
+/*** FUNCTION DECLARATIONS ***/
+
+CimplReturn UringRecv_init(UringRecv*, isize, u64);
+isize UringRecv_recv(UringRecv*, PoseBatch*, IdTable*, u32, RecvStats*);
+void UringRecv_free(UringRecv*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+static void UringRecv_buf_push(UringRecv* ring, u16 bid) {
+    struct io_uring_buf* buf =
+        &ring->buf_ring->bufs[ring->buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (u64)(uintptr_t)(ring->buffers + (usize)bid * ring->buf_size);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+    ring->buf_tail++;
+}
+
+static void UringRecv_buf_publish(UringRecv* ring) {
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Queues the multishot recvmsg.  It stays armed until the kernel runs out of
+// provided buffers or hits an error, signalled by a CQE without F_MORE.
+static void UringRecv_arm(UringRecv* ring) {
+    u32 tail = *ring->sq_tail;
+    u32 index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = (i32)ring->socket_fd;
+    sqe->addr = (u64)(uintptr_t)&ring->msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->armed = true;
+}
+
+// Sets up the rings and registers the provided buffers.  `timeout_usec`
+// plays the role SO_RCVTIMEO plays for the socket backends, 0 waits forever.
+CimplReturn UringRecv_init(UringRecv* ring, isize socket_fd, u64 timeout_usec) {
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+    ring->socket_fd = socket_fd;
+    ring->timeout_usec = timeout_usec;
+
+    struct io_uring_params params = {0};
+    params.flags = IORING_SETUP_CQSIZE;
+    // Every CQE holds a buffer, so the CQ can never need more slots
+    params.cq_entries = URING_BUF_COUNT;
+    ring->ring_fd = (i32)syscall(__NR_io_uring_setup, 4, &params);
+    if (ring->ring_fd < 0) {
+        log_error("io_uring_setup failed: %s", strerror(errno));
+        return RETURN_ERR;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG)) {
+        log_error("Kernel io_uring is too old for the uring backend");
+        goto error;
+    }
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+    ring->sq_ptr = mmap(
+        NULL,
+        ring->sq_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring->ring_fd,
+        IORING_OFF_SQ_RING
+    );
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        log_error("Failed to map io_uring rings: %s", strerror(errno));
+        goto error;
+    }
+    ring->cq_ptr = ring->sq_ptr;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(
+        NULL,
+        ring->sqes_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring->ring_fd,
+        IORING_OFF_SQES
+    );
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        log_error("Failed to map io_uring SQEs: %s", strerror(errno));
+        goto error;
+    }
+
+    u8* sq = ring->sq_ptr;
+    ring->sq_tail = (u32*)(sq + params.sq_off.tail);
+    ring->sq_mask = (u32*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (u32*)(sq + params.sq_off.array);
+    u8* cq = ring->cq_ptr;
+    ring->cq_head = (u32*)(cq + params.cq_off.head);
+    ring->cq_tail = (u32*)(cq + params.cq_off.tail);
+    ring->cq_mask = (u32*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Each buffer is laid out by the kernel as recvmsg_out, name, control,
+    // then payload
+    ring->msg.msg_namelen = sizeof(struct sockaddr_in);
+    ring->msg.msg_controllen = RECV_CONTROL_SIZE;
+    ring->buf_size = sizeof(struct io_uring_recvmsg_out) +
+                     ring->msg.msg_namelen + ring->msg.msg_controllen +
+                     POSE_WIRE_BUFFER_SIZE;
+    ring->buf_ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(
+        NULL,
+        ring->buf_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        log_error("Failed to map provided buffer ring: %s", strerror(errno));
+        goto error;
+    }
+    ring->buffers = calloc(URING_BUF_COUNT, ring->buf_size);
+    if (ring->buffers == NULL) {
+        log_error("UringRecv_init: Out of memory");
+        goto error;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (u64)(uintptr_t)ring->buf_ring,
+        .ring_entries = URING_BUF_COUNT,
+        .bgid = URING_BUF_GROUP,
+    };
+    if (syscall(
+            __NR_io_uring_register,
+            ring->ring_fd,
+            IORING_REGISTER_PBUF_RING,
+            &reg,
+            1
+        ) < 0) {
+        log_error("Failed to register provided buffers: %s", strerror(errno));
+        goto error;
+    }
+    for (u32 i = 0; i < URING_BUF_COUNT; ++i) UringRecv_buf_push(ring, i);
+    UringRecv_buf_publish(ring);
+    return RETURN_OK;
+error:
+    UringRecv_free(ring);
+    return RETURN_ERR;
+}
+
+// Harvests up to `max` datagrams and decodes them into `batch` straight out
+// of the provided buffers, which go back to the kernel once decoded.  Only
+// enters the kernel when the completion queue is empty, which is also when
+// the multishot request gets re-armed.  Returns the number of valid poses,
+// which can be 0 when everything harvested was rejected, or -1 with errno
+// set (EAGAIN on timeout, like the socket backends, EINTR on a signal).
+isize UringRecv_recv(
+    UringRecv* ring, PoseBatch* batch, IdTable* ids, u32 max, RecvStats* stats
+) {
+    if (max > batch->capacity) max = batch->capacity;
+    batch->count = 0;
+
+    u32 datagrams = 0;
+    u32 enters = 0;
+    i32 error = 0;
+    // A harvest can come back empty without a timeout, e.g. when the only
+    // completion is the multishot request ending on ENOBUFS.  Go round again.
+    while (datagrams == 0 && error == 0) {
+        u32 head = *ring->cq_head;
+        u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail || !ring->armed) {
+            u32 to_submit = 0;
+            if (!ring->armed) {
+                UringRecv_arm(ring);
+                to_submit = 1;
+            }
+            struct __kernel_timespec ts = {
+                .tv_sec = ring->timeout_usec / 1000000,
+                .tv_nsec = (ring->timeout_usec % 1000000) * 1000,
+            };
+            struct io_uring_getevents_arg arg = {
+                .ts = ring->timeout_usec == 0 ? 0 : (u64)(uintptr_t)&ts,
+            };
+            long ret = syscall(
+                __NR_io_uring_enter,
+                ring->ring_fd,
+                to_submit,
+                1,
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg,
+                sizeof(arg)
+            );
+            if (ret < 0 && errno != ETIME && errno != EINTR) return -1;
+            enters++;
+            i32 wait_error = ret < 0 && errno == EINTR ? EINTR : 0;
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                error = wait_error;
+                break;
+            }
+        }
+
+        while (head != tail && datagrams < max) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            head++;
+            if (!(cqe->flags & IORING_CQE_F_MORE)) ring->armed = false;
+            if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+                // ENOBUFS just means we fell behind, re-arming recovers
+                if (cqe->res < 0 && cqe->res != -ENOBUFS) error = -cqe->res;
+                continue;
+            }
+
+            u16 bid = (u16)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            u8* buf = ring->buffers + (usize)bid * ring->buf_size;
+            struct io_uring_recvmsg_out* out =
+                (struct io_uring_recvmsg_out*)buf;
+            u8* name = buf + sizeof(*out);
+            u8* control = name + ring->msg.msg_namelen;
+            u8* payload = control + ring->msg.msg_controllen;
+            datagrams++;
+            u32 drops = cmsg_rxq_drops(control, out->controllen);
+            if (drops > stats->kernel_drops) stats->kernel_drops = drops;
+
+            // `payloadlen` is the full datagram length, even when the
+            // kernel had to truncate it to fit the buffer
+            u32 len = out->payloadlen;
+            if (len > POSE_WIRE_BUFFER_SIZE) len = POSE_WIRE_BUFFER_SIZE;
+            u32 i = batch->count;
+            if (PoseBatch_decode_one(batch, i, ids, stats, payload, len)) {
+                batch->count++;
+                memcpy(&batch->senders[i], name, sizeof(struct sockaddr_in));
+                batch->msgs[i].msg_len = len;
+                if (batch->timestamps) {
+                    batch->kernel_ns[i] =
+                        cmsg_kernel_ns(control, out->controllen);
+                }
+            }
+            // The kernel only sees it again once published below
+            UringRecv_buf_push(ring, bid);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        UringRecv_buf_publish(ring);
+    }
+
+    if (datagrams == 0) {
+        errno = error != 0 ? error : EAGAIN;
+        return -1;
+    }
+    if (batch->timestamps && batch->count > 0) {
+        i64 offset;
+        u64 now = latency_clock_ns(&offset);
+        for (u32 i = 0; i < batch->count; ++i) {
+            batch->kernel_ns[i] =
+                latency_clock_from_realtime(batch->kernel_ns[i], offset);
+            batch->user_ns[i] = now;
+        }
+    }
+    // Every io_uring_enter is a syscall, the last one brought the harvest.
+    // Harvests that never entered the kernel are free.
+    if (enters > 0) {
+        stats->syscalls += enters - 1;
+        RecvStats_record(stats, datagrams);
+    } else {
+        stats->packets += datagrams;
+    }
+    return batch->count;
+}
+
+void UringRecv_free(UringRecv* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->sq_ptr) munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->ring_fd >= 0) close(ring->ring_fd);
+    if (ring->buf_ring) munmap(ring->buf_ring, ring->buf_ring_size);
+    free(ring->buffers);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_URING_H */
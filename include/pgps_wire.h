@@ -0,0 +1,164 @@
+#ifndef PGPS_WIRE_H
+#define PGPS_WIRE_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+#include "pgps_intern.h"
+#include "pgps_iso8601.h"
+#include "pgps_pose.h"
+
+// PGPS pose datagram, all multi-byte fields little-endian:
+//
+//   offset  size  field
+//        0    32  id, NUL padded
+//       32    28  timestamp, NUL padded
+//       60    12  position x, y, z (f32)
+//       72    16  rotation x, y, z, w (f32)
+//       88     1  confidence
+//       89     1  trigger activated (0 or 1)
+//       90     2  reserved
+//
+// This is what senders built against the original `struct Pose` put on the
+// wire, it's just no longer left to the compiler's padding rules.
+#define POSE_WIRE_SIZE 92
+#define POSE_WIRE_ID 0
+#define POSE_WIRE_TIMESTAMP 32
+#define POSE_WIRE_POSITION 60
+#define POSE_WIRE_ROTATION 72
+#define POSE_WIRE_CONFIDENCE 88
+#define POSE_WIRE_TRIGGER 89
+// Receive buffers hold one byte more than a pose so oversize datagrams show
+// up as too long instead of being silently truncated
+#define POSE_WIRE_BUFFER_SIZE (POSE_WIRE_SIZE + 1)
+// How far the squared norm of the rotation may stray from 1
+#define POSE_WIRE_QUAT_TOLERANCE 0.01f
+
+typedef enum {
+    POSE_WIRE_OK,
+    POSE_WIRE_SHORT,
+    POSE_WIRE_LONG,
+    POSE_WIRE_BAD_ROTATION,
+    POSE_WIRE_ID_OVERFLOW,
+    POSE_WIRE_STATUS_COUNT,
+} PoseWireStatus;
+
+/*** FUNCTION DECLARATIONS ***/
+
+const char* PoseWireStatus_name(PoseWireStatus);
+PoseWireStatus PoseSample_decode(PoseSample*, IdTable*, const u8*, usize);
+void Pose_encode(const Pose*, u8*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+const char* PoseWireStatus_name(PoseWireStatus status) {
+    switch (status) {
+        case POSE_WIRE_OK:
+            return "ok";
+        case POSE_WIRE_SHORT:
+            return "short";
+        case POSE_WIRE_LONG:
+            return "oversize";
+        case POSE_WIRE_BAD_ROTATION:
+            return "bad rotation";
+        case POSE_WIRE_ID_OVERFLOW:
+            return "id table full";
+        case POSE_WIRE_STATUS_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+static inline f32 wire_load_f32(const u8* src) {
+    u32 bits;
+    memcpy(&bits, src, sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap32(bits);
+#endif
+    f32 value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline void wire_store_f32(u8* dst, f32 value) {
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap32(bits);
+#endif
+    memcpy(dst, &bits, sizeof(bits));
+}
+
+// Decodes one datagram of `len` bytes, interning its id in `ids` and parsing
+// its timestamp.  `src`
+// must point at a buffer of at least POSE_WIRE_SIZE bytes even when `len` is
+// shorter: every field is read unconditionally and the length and rotation
+// are judged together at the end, so a good pose costs a single branch
+// before the id lookup.  `sample` is only meaningful when POSE_WIRE_OK comes
+// back.
+PoseWireStatus PoseSample_decode(
+    PoseSample* sample, IdTable* ids, const u8* src, usize len
+) {
+    memcpy(
+        sample->timestamp,
+        src + POSE_WIRE_TIMESTAMP,
+        sizeof(sample->timestamp)
+    );
+    sample->position.x = wire_load_f32(src + POSE_WIRE_POSITION);
+    sample->position.y = wire_load_f32(src + POSE_WIRE_POSITION + 4);
+    sample->position.z = wire_load_f32(src + POSE_WIRE_POSITION + 8);
+    sample->rotation.x = wire_load_f32(src + POSE_WIRE_ROTATION);
+    sample->rotation.y = wire_load_f32(src + POSE_WIRE_ROTATION + 4);
+    sample->rotation.z = wire_load_f32(src + POSE_WIRE_ROTATION + 8);
+    sample->rotation.w = wire_load_f32(src + POSE_WIRE_ROTATION + 12);
+    sample->confidence = src[POSE_WIRE_CONFIDENCE];
+    sample->trigger_activated = src[POSE_WIRE_TRIGGER] != 0;
+
+    const Quat* q = &sample->rotation;
+    f32 norm = q->x * q->x + q->y * q->y + q->z * q->z + q->w * q->w;
+    // NaN and infinities fail the comparison as well
+    bool rotation_ok = fabsf(norm - 1.0f) <= POSE_WIRE_QUAT_TOLERANCE;
+    bool length_ok = len == POSE_WIRE_SIZE;
+    if (__builtin_expect(length_ok & rotation_ok, 1)) {
+        // Only ids of poses that pass are interned, so garbage can't use up
+        // the table
+        sample->id = IdTable_intern(ids, (const char*)src + POSE_WIRE_ID);
+        if (sample->id == ID_HANDLE_INVALID) return POSE_WIRE_ID_OVERFLOW;
+        // An unreadable timestamp doesn't cost the pose, it just can't be
+        // ordered by sender time
+        if (!iso8601_parse_ns(sample->timestamp, &sample->sent_ns)) {
+            sample->sent_ns = ISO8601_INVALID;
+        }
+        return POSE_WIRE_OK;
+    }
+    if (len < POSE_WIRE_SIZE) return POSE_WIRE_SHORT;
+    if (len > POSE_WIRE_SIZE) return POSE_WIRE_LONG;
+    return POSE_WIRE_BAD_ROTATION;
+}
+
+// Encodes `pose` into POSE_WIRE_SIZE bytes at `dst`
+void Pose_encode(const Pose* pose, u8* dst) {
+    memcpy(dst + POSE_WIRE_ID, pose->id, sizeof(pose->id));
+    memcpy(
+        dst + POSE_WIRE_TIMESTAMP, pose->timestamp, sizeof(pose->timestamp)
+    );
+    wire_store_f32(dst + POSE_WIRE_POSITION, pose->position.x);
+    wire_store_f32(dst + POSE_WIRE_POSITION + 4, pose->position.y);
+    wire_store_f32(dst + POSE_WIRE_POSITION + 8, pose->position.z);
+    wire_store_f32(dst + POSE_WIRE_ROTATION, pose->rotation.x);
+    wire_store_f32(dst + POSE_WIRE_ROTATION + 4, pose->rotation.y);
+    wire_store_f32(dst + POSE_WIRE_ROTATION + 8, pose->rotation.z);
+    wire_store_f32(dst + POSE_WIRE_ROTATION + 12, pose->rotation.w);
+    dst[POSE_WIRE_CONFIDENCE] = pose->confidence;
+    dst[POSE_WIRE_TRIGGER] = pose->trigger_activated ? 1 : 0;
+    memset(
+        dst + POSE_WIRE_TRIGGER + 1, 0, POSE_WIRE_SIZE - POSE_WIRE_TRIGGER - 1
+    );
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_WIRE_H */
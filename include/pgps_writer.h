@@ -0,0 +1,401 @@
+#ifndef PGPS_WRITER_H
+#define PGPS_WRITER_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cimpl_core.h"
+#include "pgps_binlog.h"
+#include "pgps_intern.h"
+#include "pgps_latency.h"
+#include "pgps_pose.h"
+#include "pgps_stats.h"
+#include "pgps_time.h"
+
+#define WRITER_PATH_MAX 4096
+// Rows are formatted into a buffer of at least this size, which is handed to
+// stdio in one write when it fills up or the writer flushes
+#define WRITER_BUFFER_SIZE (64 * 1024)
+
+// Receive stamps of a pose that has been formatted but not yet flushed
+typedef struct LatencySample {
+    u64 kernel_ns;
+    u64 user_ns;
+    u64 formatted_ns;
+} LatencySample;
+
+DEFINE_DYNAMIC_ARRAY(LatencySample, LatencySampleArray)
+
+typedef enum {
+    OUTPUT_FORMAT_CSV,
+    // PoseLog, see pgps_binlog.h
+    OUTPUT_FORMAT_BINARY,
+} OutputFormat;
+
+// When to flush and when to start a new segment file.  Zero disables a
+// limit.  With no flush budget at all stdio decides, unless latency is being
+// tracked, in which case every tick flushes.
+typedef struct WriterConfig {
+    OutputFormat format;
+    bool timestamps;
+    usize flush_bytes;
+    u64 flush_interval_ns;
+    u32 segment_poses;
+    u64 segment_interval_ns;
+    // Format, write and flush timing of the writing thread, NULL when not
+    // published
+    StageStats* timing;
+} WriterConfig;
+
+// CSV or binary log sink for received poses.  With segments enabled `path`
+// is a template: `capture.csv` is written as `capture_0000.csv`,
+// `capture_0001.csv`, ...
+typedef struct PoseWriter {
+    WriterConfig config;
+    const char* path;
+    // Where sample ids are turned back into names
+    const IdTable* ids;
+    FILE* fp;
+    PoseLog log;
+    char* buffer;
+    usize buffer_len;
+    usize buffer_capacity;
+    // Per segment, so each file stands on its own like a one-shot capture
+    u32 pose_count;
+    // pose_count the next pose-count segment starts at
+    u32 segment_end;
+    u32 segment;
+    // Deadlines run on whatever clock PoseWriter_write and PoseWriter_tick
+    // are given, from the first call on
+    bool clock_started;
+    u64 segment_start_ns;
+    usize unflushed_bytes;
+    u64 last_flush_ns;
+    u64 total_poses;
+    // Track per-stage latency.  Every pose written is stamped once formatted
+    // and again when the flush that pushes it out of stdio completes.
+    LatencySampleArray pending;
+    LatencyStats latency;
+} PoseWriter;
+
+/*** FUNCTION DECLARATIONS ***/
+
+const char* OutputFormat_name(OutputFormat);
+CimplReturn OutputFormat_from_str(OutputFormat*, const char*);
+
+CimplReturn PoseWriter_open(
+    PoseWriter*, const char*, WriterConfig, const IdTable*
+);
+CimplReturn PoseWriter_write(PoseWriter*, const PoseSample*, u64, u64, u64);
+CimplReturn PoseWriter_tick(PoseWriter*, u64);
+CimplReturn PoseWriter_flush(PoseWriter*, u64);
+void PoseWriter_close(PoseWriter*);
+
+/*** FUNCTION DEFINITIONS ***/
+
+#ifdef PGPS_IMPLEMENTATION
+const char* OutputFormat_name(OutputFormat format) {
+    switch (format) {
+        case OUTPUT_FORMAT_CSV:
+            return "csv";
+        case OUTPUT_FORMAT_BINARY:
+            return "binary";
+    }
+    return "unknown";
+}
+
+CimplReturn OutputFormat_from_str(OutputFormat* format, const char* name) {
+    if (strcmp(name, "csv") == 0) {
+        *format = OUTPUT_FORMAT_CSV;
+    } else if (strcmp(name, "binary") == 0) {
+        *format = OUTPUT_FORMAT_BINARY;
+    } else {
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+static void PoseWriter_close_segment(PoseWriter*, u64);
+
+static bool PoseWriter_segmented(const PoseWriter* writer) {
+    return writer->config.segment_poses != 0 ||
+           writer->config.segment_interval_ns != 0;
+}
+
+// Opens the file for the current segment and writes the CSV header, or
+// creates the binary log.  The segment before it, if any, is only closed
+// (and flushed at `now`) once the new file is open, so a failed open leaves
+// it in place.
+static CimplReturn PoseWriter_open_segment(PoseWriter* writer, u64 now) {
+    char segment_path[WRITER_PATH_MAX];
+    const char* path = writer->path;
+    if (PoseWriter_segmented(writer)) {
+        const char* ext = strrchr(writer->path, '.');
+        const char* slash = strrchr(writer->path, '/');
+        if (ext == NULL || (slash != NULL && ext < slash)) {
+            ext = writer->path + strlen(writer->path);
+        }
+        snprintf(
+            segment_path,
+            sizeof(segment_path),
+            "%.*s_%04u%s",
+            (int)(ext - writer->path),
+            writer->path,
+            writer->segment,
+            ext
+        );
+        path = segment_path;
+    }
+
+    FILE* fp = NULL;
+    PoseLog log = {.fd = -1};
+    if (writer->config.format == OUTPUT_FORMAT_BINARY) {
+        if (PoseLog_create(&log, path) != RETURN_OK) return RETURN_ERR;
+    } else {
+        fp = fopen(path, "w");
+        if (fp == NULL) {
+            log_error("Failed to open %s: %s", path, strerror(errno));
+            return RETURN_ERR;
+        }
+        // Rows are already buffered in `writer->buffer`
+        setvbuf(fp, NULL, _IONBF, 0);
+    }
+    if (writer->fp != NULL || writer->log.map != NULL) {
+        PoseWriter_close_segment(writer, now);
+    }
+    writer->fp = fp;
+    writer->log = log;
+    if (fp != NULL) fprintf(fp, POSE_CSV_HEADER);
+    writer->pose_count = 0;
+    writer->segment_end = writer->config.segment_poses;
+    if (PoseWriter_segmented(writer)) log_info("Recording to %s", path);
+    return RETURN_OK;
+}
+
+CimplReturn PoseWriter_open(
+    PoseWriter* writer,
+    const char* path,
+    WriterConfig config,
+    const IdTable* ids
+) {
+    memset(writer, 0, sizeof(*writer));
+    writer->log.fd = -1;
+    writer->config = config;
+    writer->path = path;
+    writer->ids = ids;
+    if (config.format == OUTPUT_FORMAT_BINARY) {
+        return PoseWriter_open_segment(writer, 0);
+    }
+    // Large enough that our own budget decides when to flush, not the buffer
+    writer->buffer_capacity = config.flush_bytes * 2;
+    if (writer->buffer_capacity < WRITER_BUFFER_SIZE) {
+        writer->buffer_capacity = WRITER_BUFFER_SIZE;
+    }
+    writer->buffer = malloc(writer->buffer_capacity);
+    if (writer->buffer == NULL) {
+        log_error("PoseWriter_open: Out of memory");
+        return RETURN_ERR;
+    }
+    return PoseWriter_open_segment(writer, 0);
+}
+
+// Hands the formatted rows to stdio
+static CimplReturn PoseWriter_drain(PoseWriter* writer) {
+    if (writer->buffer_len == 0) return RETURN_OK;
+    if (writer->fp == NULL) {
+        log_error("No open output file, %zu bytes lost", writer->buffer_len);
+        writer->buffer_len = 0;
+        return RETURN_ERR;
+    }
+    usize length = writer->buffer_len;
+    writer->buffer_len = 0;
+    StageStats* timing = writer->config.timing;
+    u64 start = timing != NULL ? stats_ticks() : 0;
+    if (fwrite(writer->buffer, 1, length, writer->fp) != length) {
+        perror("fwrite");
+        return RETURN_ERR;
+    }
+    if (timing != NULL) {
+        StageStats_add(timing, STAGE_WRITE, length, stats_ticks() - start);
+    }
+    return RETURN_OK;
+}
+
+// Formats one CSV row into the buffer, draining it first if it's full
+static CimplReturn PoseWriter_write_csv(
+    PoseWriter* writer, const PoseSample* sample, usize* written
+) {
+    if (writer->buffer_len + POSE_CSV_ROW_MAX > writer->buffer_capacity) {
+        if (PoseWriter_drain(writer) != RETURN_OK) return RETURN_ERR;
+    }
+    StageStats* timing = writer->config.timing;
+    u64 start = timing != NULL ? stats_ticks() : 0;
+    *written = PoseSample_format_csv(
+        writer->buffer + writer->buffer_len,
+        sample,
+        IdTable_name(writer->ids, sample->id),
+        writer->pose_count
+    );
+    if (timing != NULL) {
+        StageStats_add(timing, STAGE_FORMAT, 1, stats_ticks() - start);
+    }
+    writer->buffer_len += *written;
+    return RETURN_OK;
+}
+
+// Flushes and closes the current segment's file
+static void PoseWriter_close_segment(PoseWriter* writer, u64 now) {
+    PoseWriter_flush(writer, now);
+    if (writer->fp != NULL) fclose(writer->fp);
+    writer->fp = NULL;
+    PoseLog_close(&writer->log);
+}
+
+// Moves on to the next segment.  If its file can't be opened the current one
+// stays open and is written to until the next boundary, which tries the
+// segment after.
+static void PoseWriter_rotate(PoseWriter* writer, u64 now) {
+    writer->segment++;
+    writer->segment_start_ns = now;
+    if (PoseWriter_open_segment(writer, now) == RETURN_OK) return;
+    log_error_fields(
+        "Failed to start a segment, continuing the current one",
+        LOG_U64("segment", writer->segment)
+    );
+    writer->segment_end = writer->pose_count + writer->config.segment_poses;
+}
+
+static void PoseWriter_start_clock(PoseWriter* writer, u64 now) {
+    if (writer->clock_started) return;
+    writer->clock_started = true;
+    writer->segment_start_ns = now;
+    writer->last_flush_ns = now;
+}
+
+// Formats or appends one pose at `now`, on the same clock as
+// PoseWriter_tick.  `kernel_ns` and `user_ns` are its receive stamps and are
+// ignored unless the writer tracks latency.
+CimplReturn PoseWriter_write(
+    PoseWriter* writer,
+    const PoseSample* sample,
+    u64 kernel_ns,
+    u64 user_ns,
+    u64 now
+) {
+    PoseWriter_start_clock(writer, now);
+    if (writer->config.segment_poses != 0 &&
+        writer->pose_count >= writer->segment_end) {
+        PoseWriter_rotate(writer, now);
+    }
+    usize written;
+    if (writer->config.format == OUTPUT_FORMAT_BINARY) {
+        StageStats* timing = writer->config.timing;
+        u64 start = timing != NULL ? stats_ticks() : 0;
+        StringView name = IdTable_name(writer->ids, sample->id);
+        if (PoseLog_append(&writer->log, sample, name) != RETURN_OK) {
+            return RETURN_ERR;
+        }
+        if (timing != NULL) {
+            StageStats_add(timing, STAGE_FORMAT, 1, stats_ticks() - start);
+        }
+        written = sizeof(PoseSample);
+    } else if (PoseWriter_write_csv(writer, sample, &written) != RETURN_OK) {
+        return RETURN_ERR;
+    }
+    writer->unflushed_bytes += written;
+    writer->pose_count++;
+    writer->total_poses++;
+    if (!writer->config.timestamps) return RETURN_OK;
+    LatencySample pending = {
+        .kernel_ns = kernel_ns,
+        .user_ns = user_ns,
+        .formatted_ns = latency_clock_ns(NULL),
+    };
+    return LatencySampleArray_push(&writer->pending, pending);
+}
+
+// Applies the flush and segment budgets.  Call after every batch and
+// whenever the receive path wakes up idle.  `now` is monotonic ns, or the
+// capture's clock on replay; a clock that steps back never ends a segment
+// or flush interval early.
+CimplReturn PoseWriter_tick(PoseWriter* writer, u64 now) {
+    const WriterConfig* config = &writer->config;
+    PoseWriter_start_clock(writer, now);
+    if (config->segment_interval_ns != 0 &&
+        now >= writer->segment_start_ns + config->segment_interval_ns) {
+        PoseWriter_rotate(writer, now);
+        return RETURN_OK;
+    }
+    if (writer->unflushed_bytes == 0) return RETURN_OK;
+
+    bool flush = false;
+    if (config->flush_bytes != 0 &&
+        writer->unflushed_bytes >= config->flush_bytes) {
+        flush = true;
+    }
+    if (config->flush_interval_ns != 0 &&
+        now >= writer->last_flush_ns + config->flush_interval_ns) {
+        flush = true;
+    }
+    if (config->timestamps && config->flush_bytes == 0 &&
+        config->flush_interval_ns == 0) {
+        flush = true;
+    }
+    return flush ? PoseWriter_flush(writer, now) : RETURN_OK;
+}
+
+// Writes out everything buffered, or starts writeback of the mapped log, and
+// closes out the latency of every pose written since the last flush.  The
+// flush interval restarts at `now`.
+CimplReturn PoseWriter_flush(PoseWriter* writer, u64 now) {
+    StageStats* timing = writer->config.timing;
+    u64 start = 0;
+    if (writer->config.format == OUTPUT_FORMAT_BINARY) {
+        if (writer->log.map == NULL) return RETURN_OK;
+        start = timing != NULL ? stats_ticks() : 0;
+        if (PoseLog_sync(&writer->log) != RETURN_OK) return RETURN_ERR;
+    } else {
+        if (PoseWriter_drain(writer) != RETURN_OK) return RETURN_ERR;
+        if (writer->fp == NULL) return RETURN_OK;
+        start = timing != NULL ? stats_ticks() : 0;
+        if (fflush(writer->fp) != 0) {
+            perror("fflush");
+            return RETURN_ERR;
+        }
+    }
+    if (timing != NULL) {
+        StageStats_add(
+            timing, STAGE_FLUSH, writer->unflushed_bytes, stats_ticks() - start
+        );
+    }
+    writer->unflushed_bytes = 0;
+    writer->last_flush_ns = now;
+    if (!writer->config.timestamps) return RETURN_OK;
+    u64 flushed_ns = latency_clock_ns(NULL);
+    for (usize i = 0; i < writer->pending.count; ++i) {
+        const LatencySample* sample = &writer->pending.items[i];
+        LatencyStats_record(
+            &writer->latency,
+            sample->kernel_ns,
+            sample->user_ns,
+            sample->formatted_ns,
+            flushed_ns
+        );
+    }
+    writer->pending.count = 0;
+    return RETURN_OK;
+}
+
+void PoseWriter_close(PoseWriter* writer) {
+    if (writer->fp != NULL || writer->log.map != NULL) {
+        PoseWriter_close_segment(writer, writer->last_flush_ns);
+    }
+    LatencySampleArray_free(&writer->pending);
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
+#endif /* PGPS_IMPLEMENTATION */
+
+#endif /* PGPS_WRITER_H */
@@ -1,18 +1,75 @@
 #ifndef CIMPL_CORE_H
 #define CIMPL_CORE_H
 
+// The clocks, localtime_r, nanosleep and strnlen are POSIX.1-2008.  Only
+// takes effect if no system header was included before this one.
+#if !defined(_POSIX_C_SOURCE) && !defined(_XOPEN_SOURCE) && \
+    !defined(_GNU_SOURCE) && !defined(_DEFAULT_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <memory.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TIMESTAMP_TSC
+#endif
+#ifndef CLOCK_MONOTONIC
+#error "cimpl_core.h needs POSIX.1-2008, define _POSIX_C_SOURCE 200809L"
+#endif
 
+// How long an invariant TSC is measured against CLOCK_MONOTONIC, which
+// timestamps read in the meantime, before the clock switches to it.  The
+// rate is refined at every resync after, which start this far apart and back
+// off to TIMESTAMP_RESYNC_NS as it settles.
+#define TIMESTAMP_CALIBRATE_NS 2000000ull
+// How often the rate and the wall-clock offset are brought up to date
+#define TIMESTAMP_RESYNC_NS 1000000000ull
+// "HH:MM:SS.uuuuuu"
+#define TIMESTAMP_SIZE 16
+
+// Messages below LOG_LEVEL are compiled out, see log_trace
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
 #ifndef LOG_LEVEL
-#define LOG_LEVEL 1
+#define LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
+// Asynchronous logging, see log_async_start.  Threads beyond
+// LOG_ASYNC_THREADS, and every thread once the ring pool is gone, log
+// synchronously.
+#ifndef LOG_ASYNC_THREADS
+#define LOG_ASYNC_THREADS 32
+#endif
+// Messages a thread can have in flight, a power of two
+#ifndef LOG_ASYNC_SLOTS
+#define LOG_ASYNC_SLOTS 128
+#endif
+#define LOG_ASYNC_MAX_ARGS 16
+// Fields one structured message can carry, more don't compile
+#define LOG_MAX_FIELDS 8
+// Copied string arguments, or the whole message when it had to be formatted
+// up front
+#define LOG_ASYNC_TEXT_SIZE 352
+#define LOG_ASYNC_IDLE_NS 1000000
+// Queued messages at which a thread wakes the log thread rather than leave
+// the ring to fill while it sleeps
+#define LOG_ASYNC_WAKE_SLOTS (LOG_ASYNC_SLOTS / 2)
+#define LOG_ASYNC_BUFFER_SIZE (64 * 1024)
+#define LOG_LINE_MAX 1024
+
 #ifndef CIMPL_ALLOC
 #include <stdlib.h>
 #define CIMPL_ALLOC malloc
@@ -57,162 +114,1448 @@ typedef enum {
     RETURN_ERR,
 } CimplReturn;
 
+// Every allocation an Arena or a Pool hands out is aligned to this
+#define ALLOCATOR_ALIGNMENT 16
+
+typedef enum {
+    ALLOCATOR_ARENA,
+    ALLOCATOR_POOL,
+} AllocatorKind;
+
+// Where a dynamic array gets its memory, see DEFINE_DYNAMIC_ARRAY.  The
+// first member of an Arena or a Pool, a NULL handle is the general heap
+// through CIMPL_REALLOC and CIMPL_FREE.
+typedef struct Allocator {
+    AllocatorKind kind;
+    // The most one allocation can ask for: the arena's size, the pool's
+    // block size
+    usize max_size;
+} Allocator;
+
+// Hands out one block front to back.  Nothing is freed on its own,
+// Arena_reset takes everything back in O(1).  The latest allocation grows
+// in place, so an array that has an arena to itself never copies.
+typedef struct Arena {
+    Allocator allocator;
+    u8* base;
+    usize size;
+    usize used;
+    // Offset of the latest allocation
+    usize last;
+    // Most ever used, for sizing the arena
+    usize high_water;
+    // `base` came from CIMPL_ALLOC
+    bool owned;
+} Arena;
+
+// Fixed-size blocks, handed out and given back in O(1).  An array on a pool
+// can grow up to one block without moving.
+typedef struct Pool {
+    Allocator allocator;
+    u8* base;
+    usize block_size;
+    u32 block_count;
+    // Blocks from here on were never handed out
+    u32 fresh;
+    // Blocks given back, each holding a pointer to the next
+    void* free_list;
+    u32 in_use;
+    bool owned;
+} Pool;
+
 #define DEFAULT_ARRAY_CAPACITY 64
 #define ARRAY_COUNT(arr) (sizeof((arr)) / sizeof((arr)[0]))
-#define DEFINE_DYNAMIC_ARRAY(type, name)                               \
-    typedef struct name {                                              \
-        type* items;                                                   \
-        size_t count;                                                  \
-        size_t capacity;                                               \
-    } name;                                                            \
-                                                                       \
-    static inline void name##_init(name* arr) {                        \
-        arr->items = NULL;                                             \
-        arr->count = 0;                                                \
-        arr->capacity = 0;                                             \
-    }                                                                  \
-                                                                       \
-    static inline CimplReturn name##_reserve(name* arr, size_t cap) {  \
-        if ((cap) > (arr)->capacity) {                                 \
-            if ((arr)->capacity == 0) {                                \
-                (arr)->capacity = DEFAULT_ARRAY_CAPACITY;              \
-            }                                                          \
-            while ((cap) > (arr)->capacity) {                          \
-                (arr)->capacity *= 2;                                  \
-            }                                                          \
-            (arr)->items = CIMPL_REALLOC(                              \
-                (arr)->items, (arr)->capacity * sizeof(*(arr)->items)  \
-            );                                                         \
-            if ((arr)->items == NULL) {                                \
-                fprintf(stderr, "ARRAY_RESERVE: Out of memory\n");     \
-                return RETURN_ERR;                                     \
-            }                                                          \
-        }                                                              \
-        return RETURN_OK;                                              \
-    }                                                                  \
-                                                                       \
-    static inline CimplReturn name##_push(name* arr, type item) {      \
-        if (name##_reserve((arr), (arr)->count + 1) != RETURN_OK) {    \
-            return RETURN_ERR;                                         \
-        }                                                              \
-        arr->items[arr->count++] = item;                               \
-        return RETURN_OK;                                              \
-    }                                                                  \
-                                                                       \
-    static inline CimplReturn name##_push_many(                        \
-        name* arr, const type* new_items, u32 new_items_count          \
-    ) {                                                                \
-        if (name##_reserve((arr), (arr)->count + (new_items_count)) != \
-            RETURN_OK) {                                               \
-            return RETURN_ERR;                                         \
-        }                                                              \
-        memcpy(                                                        \
-            (arr)->items + (arr)->count,                               \
-            (new_items),                                               \
-            (new_items_count) * sizeof(*(arr)->items)                  \
-        );                                                             \
-        (arr)->count += (new_items_count);                             \
-        return RETURN_OK;                                              \
-    }                                                                  \
-                                                                       \
-    static inline void name##_clear(name* arr) {                       \
-        memset(arr->items, 0, sizeof(*(arr)->items) * arr->count);     \
-        arr->count = 0;                                                \
-    }                                                                  \
-                                                                       \
-    static inline void name##_free(name* arr) {                        \
-        if (arr->items) {                                              \
-            CIMPL_FREE(arr->items);                                    \
-            arr->items = NULL;                                         \
-        }                                                              \
-        arr->count = 0;                                                \
-        arr->capacity = 0;                                             \
+#define DEFINE_DYNAMIC_ARRAY(type, name)                                   \
+    typedef struct name {                                                  \
+        type* items;                                                       \
+        size_t count;                                                      \
+        size_t capacity;                                                   \
+        /* NULL for the heap, see name##_init_with */                      \
+        Allocator* allocator;                                              \
+    } name;                                                                \
+                                                                           \
+    static inline void name##_init(name* arr) {                            \
+        arr->items = NULL;                                                 \
+        arr->count = 0;                                                    \
+        arr->capacity = 0;                                                 \
+        arr->allocator = NULL;                                             \
+    }                                                                      \
+                                                                           \
+    /* Takes its memory from `allocator` from now on */                    \
+    static inline void name##_init_with(name* arr, Allocator* allocator) { \
+        name##_init(arr);                                                  \
+        arr->allocator = allocator;                                        \
+    }                                                                      \
+                                                                           \
+    static inline CimplReturn name##_reserve(name* arr, size_t cap) {      \
+        if ((cap) <= (arr)->capacity) return RETURN_OK;                    \
+        size_t capacity = (arr)->capacity;                                 \
+        if (capacity == 0) capacity = DEFAULT_ARRAY_CAPACITY;              \
+        while ((cap) > capacity) capacity *= 2;                            \
+        size_t limit =                                                     \
+            Allocator_max_size((arr)->allocator) / sizeof(*(arr)->items);  \
+        if (capacity > limit && (cap) <= limit) capacity = limit;          \
+        type* items = Allocator_realloc(                                   \
+            (arr)->allocator,                                              \
+            (arr)->items,                                                  \
+            (arr)->capacity * sizeof(*(arr)->items),                       \
+            capacity * sizeof(*(arr)->items)                               \
+        );                                                                 \
+        if (items == NULL) {                                               \
+            fprintf(stderr, "ARRAY_RESERVE: Out of memory\n");             \
+            return RETURN_ERR;                                             \
+        }                                                                  \
+        (arr)->items = items;                                              \
+        (arr)->capacity = capacity;                                        \
+        return RETURN_OK;                                                  \
+    }                                                                      \
+                                                                           \
+    static inline CimplReturn name##_push(name* arr, type item) {          \
+        if (name##_reserve((arr), (arr)->count + 1) != RETURN_OK) {        \
+            return RETURN_ERR;                                             \
+        }                                                                  \
+        arr->items[arr->count++] = item;                                   \
+        return RETURN_OK;                                                  \
+    }                                                                      \
+                                                                           \
+    static inline CimplReturn name##_push_many(                            \
+        name* arr, const type* new_items, u32 new_items_count              \
+    ) {                                                                    \
+        if (name##_reserve((arr), (arr)->count + (new_items_count)) !=     \
+            RETURN_OK) {                                                   \
+            return RETURN_ERR;                                             \
+        }                                                                  \
+        memcpy(                                                            \
+            (arr)->items + (arr)->count,                                   \
+            (new_items),                                                   \
+            (new_items_count) * sizeof(*(arr)->items)                      \
+        );                                                                 \
+        (arr)->count += (new_items_count);                                 \
+        return RETURN_OK;                                                  \
+    }                                                                      \
+                                                                           \
+    static inline void name##_clear(name* arr) {                           \
+        memset(arr->items, 0, sizeof(*(arr)->items) * arr->count);         \
+        arr->count = 0;                                                    \
+    }                                                                      \
+                                                                           \
+    /* Keeps the allocator, the array can be used again */                 \
+    static inline void name##_free(name* arr) {                            \
+        if (arr->items) {                                                  \
+            Allocator_free(                                                \
+                arr->allocator,                                            \
+                arr->items,                                                \
+                arr->capacity * sizeof(*(arr)->items)                      \
+            );                                                             \
+            arr->items = NULL;                                             \
+        }                                                                  \
+        arr->count = 0;                                                    \
+        arr->capacity = 0;                                                 \
     }
 
+// The shared clock behind timestamp_ns.  One thread at a time brings it up
+// to date under `seq`, readers copy it out and retry if `seq` moved.
+typedef struct TimestampClock {
+    u32 seq;
+    // Reading the TSC, otherwise CLOCK_MONOTONIC ns
+    bool tsc;
+    // An invariant TSC still being measured, switched to at the first resync
+    bool tsc_pending;
+    // TSC baseline the rate is measured over
+    u64 start_ticks;
+    u64 start_mono_ns;
+    u64 base_ticks;
+    // timestamp_ns at `base_ticks`
+    u64 base_ns;
+    // ns per tick times 2^32
+    u64 scale;
+    // Ticks until the next resync
+    u64 resync_ticks;
+    // CLOCK_REALTIME minus timestamp_ns as of the last resync
+    i64 wall_offset_ns;
+    bool resyncing;
+} TimestampClock;
+
+// Argument types the asynchronous logger copies out of a va_list
+typedef enum {
+    // %%, no argument
+    LOG_ARG_NONE,
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_INTMAX,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+    // Formatted on the logging thread instead, e.g. %Lf or glibc's %m
+    LOG_ARG_UNSUPPORTED,
+} LogArgType;
+
+typedef struct LogSpec {
+    // One past the conversion character
+    const char* end;
+    LogArgType type;
+    // '*' width and precision, each an int argument ahead of the value
+    u8 stars;
+    bool star_precision;
+    // -1 when there is none or it's a '*'
+    i32 precision;
+} LogSpec;
+
+typedef union LogArg {
+    i64 i;
+    u64 u;
+    f64 f;
+    const void* p;
+} LogArg;
+
+typedef enum {
+    LOG_FIELD_U64,
+    LOG_FIELD_I64,
+    LOG_FIELD_F64,
+    LOG_FIELD_STR,
+} LogFieldType;
+
+// One key=value pair of a structured message, made with LOG_U64 and co.
+// Keys should be literals of [a-z0-9_].
+typedef struct LogField {
+    const char* key;
+    LogFieldType type;
+    // Of a LOG_FIELD_STR, LOG_STR_NUL when it's NUL terminated
+    u32 len;
+    LogArg value;
+} LogField;
+
+#define LOG_STR_NUL 0xffffffffu
+#define LOG_U64(key, v) \
+    ((LogField){(key), LOG_FIELD_U64, 0, {.u = (u64)(v)}})
+#define LOG_I64(key, v) \
+    ((LogField){(key), LOG_FIELD_I64, 0, {.i = (i64)(v)}})
+#define LOG_F64(key, v) \
+    ((LogField){(key), LOG_FIELD_F64, 0, {.f = (f64)(v)}})
+#define LOG_STR(key, s) \
+    ((LogField){(key), LOG_FIELD_STR, LOG_STR_NUL, {.p = (s)}})
+// `n` bytes of `s`, which needn't be NUL terminated
+#define LOG_STRN(key, s, n) \
+    ((LogField){(key), LOG_FIELD_STR, (u32)(n), {.p = (s)}})
+
+// One message as the logging thread left it: the format, which has to be a
+// string literal or otherwise outlive the message, and its raw arguments.
+// Strings are copied, they rarely do.
+typedef struct LogRecord {
+    // CLOCK_REALTIME
+    u64 time_ns;
+    // NULL when `text` holds the formatted message
+    const char* format;
+    u8 level;
+    LogArg args[LOG_ASYNC_MAX_ARGS];
+    // A structured message, `format` is then the plain message and string
+    // values point into `text`
+    u8 field_count;
+    LogField fields[LOG_MAX_FIELDS];
+    // String arguments back to back, their `args` are offsets into it
+    char text[LOG_ASYNC_TEXT_SIZE];
+} LogRecord;
+
+// Single producer, single consumer: the thread that claimed it and the log
+// thread
+typedef struct LogRing {
+    u64 head __attribute__((aligned(64)));
+    // Set while the thread queues a message, see log_async_enter
+    bool pushing;
+    u64 tail __attribute__((aligned(64)));
+    // Messages lost to a full ring, and how many of those were reported
+    u64 dropped __attribute__((aligned(64)));
+    u64 reported;
+    LogRecord records[LOG_ASYNC_SLOTS];
+} LogRing;
+
+typedef struct LogOutput {
+    FILE* fp;
+    usize len;
+    // LOG_ASYNC_BUFFER_SIZE bytes, allocated by log_async_start
+    char* data;
+} LogOutput;
+
+typedef struct LogAsync {
+    // Allocated and claimed for good by the first LOG_ASYNC_THREADS threads
+    // that log, on their first message.  NULL until then.
+    LogRing* rings[LOG_ASYNC_THREADS];
+    u32 ring_count;
+    bool running;
+    pthread_t thread;
+    // Set by a thread whose ring reached LOG_ASYNC_WAKE_SLOTS, cleared by
+    // the log thread when it wakes
+    bool wake;
+    pthread_mutex_t lock;
+    pthread_cond_t woken;
+    // Log thread only
+    LogOutput out;
+    LogOutput err;
+} LogAsync;
+
 /*** FUNCTION DECLARATIONS ***/
 
+static inline void* Allocator_realloc(Allocator*, void*, usize, usize);
+static inline void Allocator_free(Allocator*, void*, usize);
+static inline usize Allocator_max_size(const Allocator*);
+static inline CimplReturn Arena_init(Arena*, usize);
+static inline void Arena_init_buffer(Arena*, void*, usize);
+static inline void* Arena_alloc(Arena*, usize);
+static inline void Arena_reset(Arena*);
+static inline void Arena_free(Arena*);
+static inline CimplReturn Pool_init(Pool*, usize, u32);
+static inline void* Pool_alloc(Pool*);
+static inline void Pool_release(Pool*, void*);
+static inline void Pool_reset(Pool*);
+static inline void Pool_free(Pool*);
+
 inline static u32 randi(u32 index);
+static inline u64 timestamp_ns(void);
+static inline u64 timestamp_wall_ns(void);
+static inline usize timestamp_format(u64 wall_ns, char* out, usize size);
 static inline const char* get_timestamp(void);
-static inline void log_message(
-    const char* level_str, const char* format, va_list args
+static inline void log_message(u8 level, const char* format, va_list args);
+static inline void log_emit(u8 level, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+static inline void log_emit_fields(
+    u8 level, const char* message, const LogField* fields, u32 count
 );
-static inline void log_trace(const char* format, ...);
-static inline void log_debug(const char* format, ...);
-static inline void log_info(const char* format, ...);
-static inline void log_warn(const char* format, ...);
-static inline void log_error(const char* format, ...);
+static inline int log_discard(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+static inline void log_async_start(void);
+static inline void log_async_stop(void);
+
+// log_trace .. log_error take a printf format and its arguments.  Levels
+// below LOG_LEVEL turn into an unevaluated sizeof: no code at any
+// optimisation level, no argument evaluated, the format still checked.
+#define LOG_EMIT(level, ...) log_emit((level), __VA_ARGS__)
+#define LOG_DISCARD(...) ((void)sizeof(log_discard(__VA_ARGS__)))
+
+// log_trace_fields .. log_error_fields take a plain message and one or more
+// LOG_U64/LOG_I64/LOG_F64/LOG_STR fields, written logfmt style as
+// "message key=value key=\"quoted value\"" for tools to split without a
+// regex per message.  More than LOG_MAX_FIELDS fields is a compile error,
+// a negative array size.
+#define LOG_FIELDS_FIT(count) \
+    ((void)sizeof(char[(count) <= LOG_MAX_FIELDS ? 1 : -1]))
+#define LOG_EMIT_FIELDS(level, message, ...)                          \
+    do {                                                              \
+        const LogField log_fields_[] = {__VA_ARGS__};                 \
+        LOG_FIELDS_FIT(ARRAY_COUNT(log_fields_));                     \
+        log_emit_fields(                                              \
+            (level), (message), log_fields_, ARRAY_COUNT(log_fields_) \
+        );                                                            \
+    } while (0)
+#define LOG_DISCARD_FIELDS(message, ...) \
+    ((void)sizeof(message),              \
+     LOG_FIELDS_FIT(ARRAY_COUNT(((LogField[]){__VA_ARGS__}))))
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define log_trace(...) LOG_EMIT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define log_trace_fields(...) LOG_EMIT_FIELDS(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define log_trace(...) LOG_DISCARD(__VA_ARGS__)
+#define log_trace_fields(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define log_debug(...) LOG_EMIT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_debug_fields(...) LOG_EMIT_FIELDS(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) LOG_DISCARD(__VA_ARGS__)
+#define log_debug_fields(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define log_info(...) LOG_EMIT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_info_fields(...) LOG_EMIT_FIELDS(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define log_info(...) LOG_DISCARD(__VA_ARGS__)
+#define log_info_fields(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define log_warn(...) LOG_EMIT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_warn_fields(...) LOG_EMIT_FIELDS(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define log_warn(...) LOG_DISCARD(__VA_ARGS__)
+#define log_warn_fields(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define log_error(...) LOG_EMIT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_error_fields(...) LOG_EMIT_FIELDS(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define log_error(...) LOG_DISCARD(__VA_ARGS__)
+#define log_error_fields(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
 
 /*** FUNCTION DEFINITIONS ***/
 
 #ifdef CIMPL_IMPLEMENTATION
+static TimestampClock timestamp_clock;
+static LogAsync log_async = {.lock = PTHREAD_MUTEX_INITIALIZER};
+// This thread's ring, NULL until it first logs or when none was left
+static __thread LogRing* log_ring;
+static __thread bool log_ring_claimed;
+
+/* Allocator */
+
+// Grows (or shrinks) `ptr`, `old_size` bytes from the same allocator, to
+// `new_size`.  NULL when it doesn't fit, `ptr` is then left as it was.
+static inline void* Allocator_realloc(
+    Allocator* allocator, void* ptr, usize old_size, usize new_size
+) {
+    if (allocator == NULL) return CIMPL_REALLOC(ptr, new_size);
+    switch (allocator->kind) {
+        case ALLOCATOR_ARENA: {
+            Arena* arena = (Arena*)allocator;
+            if (ptr != NULL && (u8*)ptr == arena->base + arena->last &&
+                new_size <= arena->size - arena->last) {
+                arena->used = arena->last + new_size;
+                if (arena->used > arena->high_water) {
+                    arena->high_water = arena->used;
+                }
+                return ptr;
+            }
+            if (ptr != NULL && new_size <= old_size) return ptr;
+            void* moved = Arena_alloc(arena, new_size);
+            if (moved != NULL && ptr != NULL) memcpy(moved, ptr, old_size);
+            return moved;
+        }
+        case ALLOCATOR_POOL: {
+            Pool* pool = (Pool*)allocator;
+            if (new_size > pool->block_size) return NULL;
+            return ptr != NULL ? ptr : Pool_alloc(pool);
+        }
+    }
+    return NULL;
+}
+
+// Gives `ptr` back.  A no-op on an arena, whose memory comes back all at
+// once with Arena_reset.
+static inline void Allocator_free(Allocator* allocator, void* ptr, usize size) {
+    (void)size;
+    if (ptr == NULL) return;
+    if (allocator == NULL) {
+        CIMPL_FREE(ptr);
+        return;
+    }
+    if (allocator->kind == ALLOCATOR_POOL) Pool_release((Pool*)allocator, ptr);
+}
+
+// The most one allocation can ask for, which arrays cap their growth at.
+// Kept in the Allocator itself, reading it never needs the Arena or Pool
+// around it.
+static inline usize Allocator_max_size(const Allocator* allocator) {
+    return allocator == NULL ? SIZE_MAX : allocator->max_size;
+}
+
+/* Arena */
+
+// Allocates the arena's `size` bytes, the last call to the heap it makes
+static inline CimplReturn Arena_init(Arena* arena, usize size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->allocator.kind = ALLOCATOR_ARENA;
+    arena->base = CIMPL_ALLOC(size);
+    if (arena->base == NULL) {
+        fprintf(stderr, "Arena_init: Out of memory\n");
+        return RETURN_ERR;
+    }
+    arena->size = size;
+    arena->allocator.max_size = size;
+    arena->owned = true;
+    return RETURN_OK;
+}
+
+// An arena over `size` bytes at `buffer`, which has to outlive it
+static inline void Arena_init_buffer(Arena* arena, void* buffer, usize size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->allocator.kind = ALLOCATOR_ARENA;
+    arena->base = buffer;
+    arena->size = size;
+    arena->allocator.max_size = size;
+}
+
+// NULL once the arena is full
+static inline void* Arena_alloc(Arena* arena, usize size) {
+    usize offset = (arena->used + ALLOCATOR_ALIGNMENT - 1) &
+                   ~(usize)(ALLOCATOR_ALIGNMENT - 1);
+    if (offset > arena->size || size > arena->size - offset) return NULL;
+    arena->last = offset;
+    arena->used = offset + size;
+    if (arena->used > arena->high_water) arena->high_water = arena->used;
+    return arena->base + offset;
+}
+
+// Takes back everything handed out.  Arrays on the arena have to be
+// re-initialised, not freed.
+static inline void Arena_reset(Arena* arena) {
+    arena->used = 0;
+    arena->last = 0;
+}
+
+static inline void Arena_free(Arena* arena) {
+    if (arena->owned) CIMPL_FREE(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->allocator.max_size = 0;
+    Arena_reset(arena);
+}
+
+/* Pool */
+
+// `block_count` blocks of `block_size` bytes, rounded up to
+// ALLOCATOR_ALIGNMENT, allocated once
+static inline CimplReturn Pool_init(
+    Pool* pool, usize block_size, u32 block_count
+) {
+    memset(pool, 0, sizeof(*pool));
+    pool->allocator.kind = ALLOCATOR_POOL;
+    if (block_size < sizeof(void*)) block_size = sizeof(void*);
+    block_size = (block_size + ALLOCATOR_ALIGNMENT - 1) &
+                 ~(usize)(ALLOCATOR_ALIGNMENT - 1);
+    pool->base = CIMPL_ALLOC(block_size * block_count);
+    if (pool->base == NULL) {
+        fprintf(stderr, "Pool_init: Out of memory\n");
+        return RETURN_ERR;
+    }
+    pool->block_size = block_size;
+    pool->allocator.max_size = block_size;
+    pool->block_count = block_count;
+    pool->owned = true;
+    return RETURN_OK;
+}
+
+// One block, NULL when all are in use
+static inline void* Pool_alloc(Pool* pool) {
+    void* block = pool->free_list;
+    if (block != NULL) {
+        memcpy(&pool->free_list, block, sizeof(void*));
+    } else if (pool->fresh < pool->block_count) {
+        block = pool->base + (usize)pool->fresh++ * pool->block_size;
+    } else {
+        return NULL;
+    }
+    pool->in_use++;
+    return block;
+}
+
+static inline void Pool_release(Pool* pool, void* block) {
+    memcpy(block, &pool->free_list, sizeof(void*));
+    pool->free_list = block;
+    pool->in_use--;
+}
+
+// Takes back every block at once
+static inline void Pool_reset(Pool* pool) {
+    pool->free_list = NULL;
+    pool->fresh = 0;
+    pool->in_use = 0;
+}
+
+static inline void Pool_free(Pool* pool) {
+    if (pool->owned) CIMPL_FREE(pool->base);
+    pool->base = NULL;
+    pool->block_count = 0;
+    pool->allocator.max_size = 0;
+    Pool_reset(pool);
+}
+
 inline static u32 randi(u32 index) {
     index = (index << 13) ^ index;
     return (index * (index * index * 15731 + 789221) + 1276312589) & 0x7fffffff;
 }
 
-static inline const char* get_timestamp(void) {
-    static char timestamp[20];
-    static time_t last_time = 0;
+// The reference clock.  NTP keeps its rate in step with CLOCK_REALTIME, so
+// the cached wall-clock offset holds between resyncs, but never steps it.
+static inline u64 timestamp_mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static inline u64 timestamp_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+// A TSC that ticks at the same rate in every P- and C-state and on every
+// core, so it can stand in for a clock
+static inline bool timestamp_tsc_invariant(void) {
+#ifdef TIMESTAMP_TSC
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    return (edx >> 8) & 1;
+#else
+    return false;
+#endif
+}
+
+static inline u64 timestamp_ticks(bool tsc) {
+#ifdef TIMESTAMP_TSC
+    if (tsc) return __rdtsc();
+#else
+    (void)tsc;
+#endif
+    return timestamp_mono_ns();
+}
 
-    time_t now = time(NULL);
-    if (now != last_time) {
-        last_time = now;
-        struct tm* timeinfo = localtime(&now);
-        strftime(timestamp, sizeof(timestamp), "%H:%M:%S", timeinfo);
+static inline u64 timestamp_scale(u64 ns, u64 ticks) {
+    return (u64)((f64)ns / (f64)ticks * 4294967296.0);
+}
+
+static inline u64 timestamp_at(
+    u64 ticks, u64 base_ticks, u64 base_ns, u64 scale
+) {
+    u64 delta = ticks > base_ticks ? ticks - base_ticks : 0;
+    return base_ns + (u64)((f64)delta * (f64)scale / 4294967296.0);
+}
+
+// Starts out on CLOCK_MONOTONIC and, with an invariant TSC, notes where it
+// was so the first resync can measure its rate.  Nothing waits here.
+static inline void timestamp_calibrate(void) {
+    TimestampClock* clock = &timestamp_clock;
+    clock->tsc = false;
+    clock->tsc_pending = timestamp_tsc_invariant();
+    clock->start_mono_ns = timestamp_mono_ns();
+    clock->start_ticks = timestamp_ticks(clock->tsc_pending);
+    clock->base_ticks = clock->start_mono_ns;
+    clock->base_ns = clock->start_mono_ns;
+    clock->scale = 1ull << 32;
+    clock->resync_ticks = TIMESTAMP_CALIBRATE_NS;
+    clock->wall_offset_ns =
+        (i64)(timestamp_realtime_ns() - clock->start_mono_ns);
+}
+
+// Refines the rate over everything since calibration and refreshes the
+// wall-clock offset, so a TSC can't drift off and NTP steps show up within a
+// resync.  The first one switches to a pending TSC.  Continues from where the
+// clock is, it never steps back.  Whoever gets here first does it, the rest
+// go on with the old parameters.
+static inline void timestamp_resync(void) {
+    TimestampClock* clock = &timestamp_clock;
+    if (__atomic_exchange_n(&clock->resyncing, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    bool tsc = clock->tsc || clock->tsc_pending;
+    u64 mono_ns = timestamp_mono_ns();
+    u64 ticks = timestamp_ticks(tsc);
+    u64 wall_ns = timestamp_realtime_ns();
+    u64 now_ns = timestamp_at(
+        clock->tsc ? ticks : mono_ns,
+        clock->base_ticks,
+        clock->base_ns,
+        clock->scale
+    );
+    u64 scale = clock->scale;
+    u64 resync_ticks = clock->resync_ticks;
+    if (tsc && ticks > clock->start_ticks) {
+        scale = timestamp_scale(
+            mono_ns - clock->start_mono_ns, ticks - clock->start_ticks
+        );
+    }
+    if (clock->tsc_pending) {
+        clock->tsc_pending = false;
+        resync_ticks = (u64)(
+            (f64)TIMESTAMP_CALIBRATE_NS * 4294967296.0 / (f64)scale
+        );
+    }
+    // Twice as far apart each time, the rate error shrinks as fast
+    u64 max_ticks = (u64)(
+        (f64)TIMESTAMP_RESYNC_NS * 4294967296.0 / (f64)scale
+    );
+    if (resync_ticks < max_ticks) {
+        resync_ticks = resync_ticks * 2 < max_ticks ? resync_ticks * 2
+                                                     : max_ticks;
+    }
+
+    __atomic_store_n(&clock->seq, clock->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&clock->tsc, tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->base_ticks, ticks, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->base_ns, now_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->scale, scale, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock->resync_ticks, resync_ticks, __ATOMIC_RELAXED);
+    __atomic_store_n(
+        &clock->wall_offset_ns, (i64)(wall_ns - now_ns), __ATOMIC_RELAXED
+    );
+    __atomic_store_n(&clock->seq, clock->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&clock->resyncing, false, __ATOMIC_RELEASE);
+}
+
+// Reads the clock and the wall-clock offset that goes with it
+static inline u64 timestamp_read(i64* wall_offset_ns) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, timestamp_calibrate);
+    TimestampClock* clock = &timestamp_clock;
+    u64 ticks, base_ticks, base_ns, scale, resync_ticks;
+    i64 offset;
+    for (;;) {
+        u32 seq = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        bool tsc = __atomic_load_n(&clock->tsc, __ATOMIC_RELAXED);
+        base_ticks = __atomic_load_n(&clock->base_ticks, __ATOMIC_RELAXED);
+        base_ns = __atomic_load_n(&clock->base_ns, __ATOMIC_RELAXED);
+        scale = __atomic_load_n(&clock->scale, __ATOMIC_RELAXED);
+        resync_ticks =
+            __atomic_load_n(&clock->resync_ticks, __ATOMIC_RELAXED);
+        offset = __atomic_load_n(&clock->wall_offset_ns, __ATOMIC_RELAXED);
+        ticks = timestamp_ticks(tsc);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&clock->seq, __ATOMIC_RELAXED) == seq) break;
+    }
+    if (ticks > base_ticks && ticks - base_ticks > resync_ticks) {
+        timestamp_resync();
     }
+    if (wall_offset_ns != NULL) *wall_offset_ns = offset;
+    return timestamp_at(ticks, base_ticks, base_ns, scale);
+}
+
+// Monotonic ns, from any thread.  An rdtsc and a few multiplies where the
+// TSC is invariant, CLOCK_MONOTONIC elsewhere.  Only differences between two
+// readings mean anything.
+static inline u64 timestamp_ns(void) { return timestamp_read(NULL); }
+
+// CLOCK_REALTIME ns at the cost of timestamp_ns.  The offset is refreshed
+// every TIMESTAMP_RESYNC_NS, a step of the system clock takes that long to
+// show up.
+static inline u64 timestamp_wall_ns(void) {
+    i64 offset;
+    u64 now = timestamp_read(&offset);
+    return (u64)((i64)now + offset);
+}
+
+// "HH:MM:SS.uuuuuu" in local time.  localtime_r runs once a second per
+// thread.
+static inline usize timestamp_format(u64 wall_ns, char* out, usize size) {
+    static __thread time_t last_second = -1;
+    static __thread char hms[TIMESTAMP_SIZE];
+    time_t second = (time_t)(wall_ns / 1000000000ull);
+    if (second != last_second) {
+        struct tm timeinfo;
+        localtime_r(&second, &timeinfo);
+        strftime(hms, sizeof(hms), "%H:%M:%S", &timeinfo);
+        last_second = second;
+    }
+    int n = snprintf(
+        out, size, "%.8s.%06u", hms, (u32)(wall_ns / 1000 % 1000000)
+    );
+    return n < 0 ? 0 : (usize)n < size ? (usize)n : size - 1;
+}
+
+// This thread's copy, good until its next call
+static inline const char* get_timestamp(void) {
+    static __thread char timestamp[TIMESTAMP_SIZE];
+    timestamp_format(timestamp_wall_ns(), timestamp, sizeof(timestamp));
     return timestamp;
 }
 
-static inline void log_message(
-    const char* level_str, const char* format, va_list args
+static inline const char* log_level_name(u8 level) {
+    static const char* const names[] = {
+        "TRACE", "DEBUG", "INFO", "WARN", "ERROR"
+    };
+    return level < ARRAY_COUNT(names) ? names[level] : "LOG";
+}
+
+// Parses the conversion specification that starts at `c`, just past its '%'
+static inline LogSpec log_parse_spec(const char* c) {
+    LogSpec spec = {.type = LOG_ARG_UNSUPPORTED, .precision = -1};
+    while (*c != '\0' && strchr("-+ #0'", *c) != NULL) c++;
+    if (*c == '*') {
+        spec.stars++;
+        c++;
+    }
+    while (*c >= '0' && *c <= '9') c++;
+    if (*c == '.') {
+        c++;
+        if (*c == '*') {
+            spec.stars++;
+            spec.star_precision = true;
+            c++;
+        } else {
+            spec.precision = 0;
+            for (; *c >= '0' && *c <= '9'; ++c) {
+                if (spec.precision < 1000000) {
+                    spec.precision = spec.precision * 10 + (*c - '0');
+                }
+            }
+        }
+    }
+    // 'H' for hh, 'q' for ll
+    char length = 0;
+    switch (*c) {
+        case 'h':
+            length = *c++;
+            if (*c == 'h') length = 'H', c++;
+            break;
+        case 'l':
+            length = *c++;
+            if (*c == 'l') length = 'q', c++;
+            break;
+        case 'z':
+        case 'j':
+        case 't':
+        case 'L':
+            length = *c++;
+            break;
+    }
+    spec.end = c;
+    if (*c == '\0') return spec;
+    spec.end = c + 1;
+    switch (*c) {
+        case '%':
+            if (spec.stars == 0) spec.type = LOG_ARG_NONE;
+            break;
+        case 'c':
+            if (length == 0) spec.type = LOG_ARG_INT;
+            break;
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (length) {
+                case 0:
+                case 'h':
+                case 'H':
+                    spec.type = LOG_ARG_INT;
+                    break;
+                case 'l':
+                    spec.type = LOG_ARG_LONG;
+                    break;
+                case 'q':
+                    spec.type = LOG_ARG_LLONG;
+                    break;
+                case 'z':
+                    spec.type = LOG_ARG_SIZE;
+                    break;
+                case 'j':
+                    spec.type = LOG_ARG_INTMAX;
+                    break;
+                case 't':
+                    spec.type = LOG_ARG_PTRDIFF;
+                    break;
+            }
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (length == 0 || length == 'l') spec.type = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            if (length == 0) spec.type = LOG_ARG_STRING;
+            break;
+        case 'p':
+            if (length == 0) spec.type = LOG_ARG_POINTER;
+            break;
+    }
+    return spec;
+}
+
+// Copies what `format` takes from `args` into `record`.  False when it takes
+// more than fits or something that can only be formatted right away.
+static inline bool log_capture(
+    LogRecord* record, const char* format, va_list args
 ) {
-    printf("[%s] %s: ", get_timestamp(), level_str);
-    vprintf(format, args);
-    printf("\n");
-    fflush(stdout);
+    u32 count = 0;
+    usize text = 0;
+    record->text[LOG_ASYNC_TEXT_SIZE - 1] = '\0';
+    for (const char* c = strchr(format, '%'); c != NULL; c = strchr(c, '%')) {
+        LogSpec spec = log_parse_spec(c + 1);
+        c = spec.end;
+        if (spec.type == LOG_ARG_UNSUPPORTED) return false;
+        if (spec.type == LOG_ARG_NONE) continue;
+        if (count + spec.stars + 1u > LOG_ASYNC_MAX_ARGS) return false;
+        i32 precision = spec.precision;
+        for (u8 i = 0; i < spec.stars; ++i) {
+            int star = va_arg(args, int);
+            record->args[count++].i = star;
+            if (spec.star_precision && i + 1 == spec.stars) precision = star;
+        }
+        LogArg* arg = &record->args[count++];
+        switch (spec.type) {
+            case LOG_ARG_INT:
+                arg->i = va_arg(args, int);
+                break;
+            case LOG_ARG_LONG:
+                arg->i = va_arg(args, long);
+                break;
+            case LOG_ARG_LLONG:
+                arg->i = va_arg(args, long long);
+                break;
+            case LOG_ARG_SIZE:
+                arg->u = va_arg(args, size_t);
+                break;
+            case LOG_ARG_INTMAX:
+                arg->i = va_arg(args, intmax_t);
+                break;
+            case LOG_ARG_PTRDIFF:
+                arg->i = va_arg(args, ptrdiff_t);
+                break;
+            case LOG_ARG_DOUBLE:
+                arg->f = va_arg(args, double);
+                break;
+            case LOG_ARG_POINTER:
+                arg->p = va_arg(args, void*);
+                break;
+            case LOG_ARG_STRING: {
+                const char* s = va_arg(args, const char*);
+                if (s == NULL) s = "(null)";
+                // Whatever doesn't fit is cut, the last byte stays a NUL
+                usize room = LOG_ASYNC_TEXT_SIZE - 1 - text;
+                if (room == 0) {
+                    arg->u = LOG_ASYNC_TEXT_SIZE - 1;
+                    break;
+                }
+                usize max = room - 1;
+                if (precision >= 0 && (usize)precision < max) {
+                    max = (usize)precision;
+                }
+                usize len = strnlen(s, max);
+                memcpy(record->text + text, s, len);
+                record->text[text + len] = '\0';
+                arg->u = text;
+                text += len + 1;
+                break;
+            }
+            case LOG_ARG_NONE:
+            case LOG_ARG_UNSUPPORTED:
+                break;
+        }
+    }
+    return true;
+}
 
-    va_end(args);
+// Appends `len` bytes, cut to fit `size` with room for the NUL
+static inline void log_append(
+    char* out, usize size, usize* at, const char* bytes, usize len
+) {
+    if (*at + 1 >= size) return;
+    if (len > size - 1 - *at) len = size - 1 - *at;
+    memcpy(out + *at, bytes, len);
+    *at += len;
+    out[*at] = '\0';
 }
-static inline void log_trace(const char* format, ...) {
-    const u8 level = 0;
-    if (LOG_LEVEL > level) return;
-    va_list args;
-    va_start(args, format);
-    log_message("TRACE", format, args);
+
+// A string value as is, or in double quotes with \" and \\ escaped when it
+// is empty or holds a space, '=', a quote or a control character
+static inline void log_append_value(
+    char* out, usize size, usize* at, const char* s, usize len
+) {
+    bool quote = len == 0;
+    for (usize i = 0; i < len && !quote; ++i) {
+        quote = s[i] == ' ' || s[i] == '=' || s[i] == '"' || s[i] == '\\' ||
+                (uchar)s[i] < 0x20;
+    }
+    if (!quote) {
+        log_append(out, size, at, s, len);
+        return;
+    }
+    log_append(out, size, at, "\"", 1);
+    for (usize i = 0; i < len; ++i) {
+        if (s[i] == '"' || s[i] == '\\') {
+            log_append(out, size, at, "\\", 1);
+        } else if ((uchar)s[i] < 0x20) {
+            log_append(out, size, at, " ", 1);
+            continue;
+        }
+        log_append(out, size, at, &s[i], 1);
+    }
+    log_append(out, size, at, "\"", 1);
 }
-static inline void log_debug(const char* format, ...) {
-    const u8 level = 1;
-    if (LOG_LEVEL > level) return;
-    va_list args;
-    va_start(args, format);
-    log_message("DEBUG", format, args);
+
+// "message key=value ..." into `out`, cut to fit, and returns its length
+static inline usize log_format_fields(
+    char* out,
+    usize size,
+    const char* message,
+    const LogField* fields,
+    u32 count
+) {
+    usize len = 0;
+    out[0] = '\0';
+    log_append(out, size, &len, message, strlen(message));
+    for (u32 i = 0; i < count; ++i) {
+        const LogField* field = &fields[i];
+        char value[32];
+        int n = 0;
+        log_append(out, size, &len, " ", 1);
+        log_append(out, size, &len, field->key, strlen(field->key));
+        log_append(out, size, &len, "=", 1);
+        switch (field->type) {
+            case LOG_FIELD_U64:
+                n = snprintf(
+                    value,
+                    sizeof(value),
+                    "%llu",
+                    (unsigned long long)field->value.u
+                );
+                break;
+            case LOG_FIELD_I64:
+                n = snprintf(
+                    value, sizeof(value), "%lld", (long long)field->value.i
+                );
+                break;
+            case LOG_FIELD_F64:
+                n = snprintf(value, sizeof(value), "%.6g", field->value.f);
+                break;
+            case LOG_FIELD_STR: {
+                const char* s = field->value.p;
+                if (s == NULL) s = "";
+                usize s_len =
+                    field->len == LOG_STR_NUL ? strlen(s) : field->len;
+                log_append_value(out, size, &len, s, s_len);
+                break;
+            }
+        }
+        if (n > 0) log_append(out, size, &len, value, (usize)n);
+    }
+    return len;
 }
-static inline void log_info(const char* format, ...) {
-    const u8 level = 2;
-    if (LOG_LEVEL > level) return;
-    va_list args;
-    va_start(args, format);
-    log_message("INFO", format, args);
+
+// Formats the message `record` holds into `out`, cut to fit, and returns its
+// length
+static inline usize log_format_record(
+    const LogRecord* record, char* out, usize size
+) {
+    if (record->format == NULL) {
+        int n = snprintf(out, size, "%s", record->text);
+        return n < 0 ? 0 : (usize)n < size ? (usize)n : size - 1;
+    }
+    if (record->field_count > 0) {
+        return log_format_fields(
+            out, size, record->format, record->fields, record->field_count
+        );
+    }
+    usize len = 0;
+    u32 count = 0;
+    const char* c = record->format;
+    out[0] = '\0';
+    while (*c != '\0' && len + 1 < size) {
+        const char* percent = strchr(c, '%');
+        usize literal = percent != NULL ? (usize)(percent - c) : strlen(c);
+        if (literal > size - 1 - len) literal = size - 1 - len;
+        memcpy(out + len, c, literal);
+        len += literal;
+        out[len] = '\0';
+        if (percent == NULL) break;
+
+        LogSpec spec = log_parse_spec(percent + 1);
+        c = spec.end;
+        if (spec.type == LOG_ARG_NONE) {
+            if (len + 1 < size) out[len++] = '%';
+            out[len] = '\0';
+            continue;
+        }
+        char conversion[32];
+        usize spec_len = (usize)(spec.end - percent);
+        if (spec_len >= sizeof(conversion)) break;
+        memcpy(conversion, percent, spec_len);
+        conversion[spec_len] = '\0';
+        int stars[2] = {0, 0};
+        for (u8 i = 0; i < spec.stars; ++i) {
+            stars[i] = (int)record->args[count++].i;
+        }
+        const LogArg* arg = &record->args[count++];
+#define LOG_FORMAT_ARG(value)                                               \
+    (spec.stars == 0                                                        \
+         ? snprintf(out + len, size - len, conversion, value)               \
+     : spec.stars == 1                                                      \
+         ? snprintf(out + len, size - len, conversion, stars[0], value)     \
+         : snprintf(                                                        \
+               out + len, size - len, conversion, stars[0], stars[1], value \
+           ))
+        int n = 0;
+        switch (spec.type) {
+            case LOG_ARG_INT:
+                n = LOG_FORMAT_ARG((int)arg->i);
+                break;
+            case LOG_ARG_LONG:
+                n = LOG_FORMAT_ARG((long)arg->i);
+                break;
+            case LOG_ARG_LLONG:
+                n = LOG_FORMAT_ARG((long long)arg->i);
+                break;
+            case LOG_ARG_SIZE:
+                n = LOG_FORMAT_ARG((size_t)arg->u);
+                break;
+            case LOG_ARG_INTMAX:
+                n = LOG_FORMAT_ARG((intmax_t)arg->i);
+                break;
+            case LOG_ARG_PTRDIFF:
+                n = LOG_FORMAT_ARG((ptrdiff_t)arg->i);
+                break;
+            case LOG_ARG_DOUBLE:
+                n = LOG_FORMAT_ARG(arg->f);
+                break;
+            case LOG_ARG_STRING:
+                n = LOG_FORMAT_ARG(record->text + arg->u);
+                break;
+            case LOG_ARG_POINTER:
+                n = LOG_FORMAT_ARG(arg->p);
+                break;
+            case LOG_ARG_NONE:
+            case LOG_ARG_UNSUPPORTED:
+                break;
+        }
+#undef LOG_FORMAT_ARG
+        if (n > 0) len += (usize)n < size - len ? (usize)n : size - 1 - len;
+    }
+    return len;
 }
-static inline void log_warn(const char* format, ...) {
-    const u8 level = 3;
-    if (LOG_LEVEL > level) return;
-    va_list args;
-    va_start(args, format);
-    log_message("WARN", format, args);
+
+static inline void log_output_flush(LogOutput* output) {
+    if (output->len == 0) return;
+    fwrite(output->data, 1, output->len, output->fp);
+    fflush(output->fp);
+    output->len = 0;
+}
+
+// Appends one "[HH:MM:SS] LEVEL: message" line to the batch going to
+// stderr for errors, stdout for the rest
+static inline void log_output_record(const LogRecord* record) {
+    LogOutput* output =
+        record->level >= LOG_LEVEL_ERROR ? &log_async.err : &log_async.out;
+    if (output->len + LOG_LINE_MAX > LOG_ASYNC_BUFFER_SIZE) {
+        log_output_flush(output);
+    }
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_format(record->time_ns, timestamp, sizeof(timestamp));
+    char* line = output->data + output->len;
+    int header = snprintf(
+        line,
+        LOG_LINE_MAX,
+        "[%s] %s: ",
+        timestamp,
+        log_level_name(record->level)
+    );
+    if (header < 0) return;
+    usize len = (usize)header;
+    len += log_format_record(record, line + len, LOG_LINE_MAX - 1 - len);
+    line[len++] = '\n';
+    output->len += len;
+}
+
+// Writes out everything queued, oldest first across threads, and returns
+// how many messages that was
+static inline u32 log_async_drain(void) {
+    u32 written = 0;
+    u32 ring_count = __atomic_load_n(&log_async.ring_count, __ATOMIC_ACQUIRE);
+    if (ring_count > LOG_ASYNC_THREADS) ring_count = LOG_ASYNC_THREADS;
+    for (;;) {
+        LogRing* oldest = NULL;
+        const LogRecord* record = NULL;
+        for (u32 i = 0; i < ring_count; ++i) {
+            LogRing* ring =
+                __atomic_load_n(&log_async.rings[i], __ATOMIC_ACQUIRE);
+            if (ring == NULL ||
+                ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            const LogRecord* next =
+                &ring->records[ring->tail & (LOG_ASYNC_SLOTS - 1)];
+            if (record == NULL || next->time_ns < record->time_ns) {
+                oldest = ring;
+                record = next;
+            }
+        }
+        if (oldest == NULL) break;
+        log_output_record(record);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+        written++;
+    }
+    for (u32 i = 0; i < ring_count; ++i) {
+        LogRing* ring = __atomic_load_n(&log_async.rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) continue;
+        u64 dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped == ring->reported) continue;
+        static LogRecord report;
+        report.level = LOG_LEVEL_WARN;
+        report.field_count = 0;
+        report.format = NULL;
+        report.time_ns = timestamp_wall_ns();
+        snprintf(
+            report.text,
+            sizeof(report.text),
+            "Log ring %u full, dropped %lu messages",
+            i,
+            (unsigned long)(dropped - ring->reported)
+        );
+        log_output_record(&report);
+        ring->reported = dropped;
+    }
+    log_output_flush(&log_async.out);
+    log_output_flush(&log_async.err);
+    return written;
+}
+
+// Sleeps up to LOG_ASYNC_IDLE_NS, less when a thread asks for a wake
+static inline void log_async_idle(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += LOG_ASYNC_IDLE_NS;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&log_async.lock);
+    if (!log_async.wake) {
+        pthread_cond_timedwait(&log_async.woken, &log_async.lock, &deadline);
+    }
+    __atomic_store_n(&log_async.wake, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log_async.lock);
+}
+
+static inline void* log_async_run(void* arg) {
+    (void)arg;
+    while (__atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE)) {
+        if (log_async_drain() == 0) log_async_idle();
+    }
+    log_async_drain();
+    return NULL;
+}
+
+// This thread's ring, NULL when it has to log synchronously
+static inline LogRing* log_async_ring(void) {
+    if (!__atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE)) return NULL;
+    if (!log_ring_claimed) {
+        log_ring_claimed = true;
+        u32 index =
+            __atomic_fetch_add(&log_async.ring_count, 1, __ATOMIC_ACQ_REL);
+        // Cache line aligned, so head, tail and dropped each get their own
+        void* ring = NULL;
+        if (index < LOG_ASYNC_THREADS &&
+            posix_memalign(&ring, 64, sizeof(LogRing)) == 0) {
+            memset(ring, 0, sizeof(LogRing));
+            log_ring = ring;
+            __atomic_store_n(&log_async.rings[index], ring, __ATOMIC_SEQ_CST);
+        }
+    }
+    return log_ring;
+}
+
+// This thread's ring, marked as being pushed to, or NULL when the message
+// has to be written synchronously.  Either the thread sees the logger
+// stopped or log_async_stop sees the mark and waits for the message before
+// its last drain, so none is left behind in a ring.
+static inline LogRing* log_async_enter(void) {
+    LogRing* ring = log_async_ring();
+    if (ring == NULL) return NULL;
+    __atomic_store_n(&ring->pushing, true, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&log_async.running, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&ring->pushing, false, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    return ring;
+}
+
+static inline void log_async_leave(LogRing* ring) {
+    __atomic_store_n(&ring->pushing, false, __ATOMIC_RELEASE);
+}
+
+// The next free record of `ring`, stamped, or NULL when the ring is full.
+// A full ring drops messages below warnings and counts them, warnings and
+// errors are left to the caller to write synchronously.
+static inline LogRecord* log_async_reserve(LogRing* ring, u8 level) {
+    u64 head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+        LOG_ASYNC_SLOTS) {
+        if (level < LOG_LEVEL_WARN) {
+            __atomic_store_n(
+                &ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED
+            );
+        }
+        return NULL;
+    }
+    LogRecord* record = &ring->records[head & (LOG_ASYNC_SLOTS - 1)];
+    record->time_ns = timestamp_wall_ns();
+    record->level = level;
+    record->field_count = 0;
+    return record;
+}
+
+// Queues the reserved record, waking the log thread once the ring is half
+// full so a burst doesn't wait out its idle sleep
+static inline void log_async_publish(LogRing* ring) {
+    u64 head = ring->head + 1;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) <
+        LOG_ASYNC_WAKE_SLOTS) {
+        return;
+    }
+    if (__atomic_load_n(&log_async.wake, __ATOMIC_RELAXED)) return;
+    pthread_mutex_lock(&log_async.lock);
+    __atomic_store_n(&log_async.wake, true, __ATOMIC_RELAXED);
+    pthread_cond_signal(&log_async.woken);
+    pthread_mutex_unlock(&log_async.lock);
+}
+
+// Queues the message on this thread's ring.  False when it has to be
+// written synchronously instead.
+static inline bool log_async_push(u8 level, const char* format, va_list args) {
+    LogRing* ring = log_async_enter();
+    if (ring == NULL) return false;
+    LogRecord* record = log_async_reserve(ring, level);
+    if (record == NULL) {
+        log_async_leave(ring);
+        return level < LOG_LEVEL_WARN;
+    }
+    record->format = format;
+    va_list copy;
+    va_copy(copy, args);
+    if (!log_capture(record, format, copy)) {
+        record->format = NULL;
+        vsnprintf(record->text, sizeof(record->text), format, args);
+    }
+    va_end(copy);
+    log_async_publish(ring);
+    log_async_leave(ring);
+    return true;
+}
+
+// Queues a structured message, copying string values into the record
+static inline bool log_async_push_fields(
+    u8 level, const char* message, const LogField* fields, u32 count
+) {
+    // More than a record holds, called without the macros
+    if (count > LOG_MAX_FIELDS) return false;
+    LogRing* ring = log_async_enter();
+    if (ring == NULL) return false;
+    LogRecord* record = log_async_reserve(ring, level);
+    if (record == NULL) {
+        log_async_leave(ring);
+        return level < LOG_LEVEL_WARN;
+    }
+    record->format = message;
+    usize text = 0;
+    for (u32 i = 0; i < count; ++i) {
+        LogField* field = &record->fields[i];
+        *field = fields[i];
+        if (field->type != LOG_FIELD_STR) continue;
+        const char* s = field->value.p;
+        if (s == NULL) s = "";
+        usize room = LOG_ASYNC_TEXT_SIZE - text;
+        usize len = field->len == LOG_STR_NUL ? strnlen(s, room) : field->len;
+        if (len > room) len = room;
+        memcpy(record->text + text, s, len);
+        field->value.p = record->text + text;
+        field->len = (u32)len;
+        text += len;
+    }
+    record->field_count = (u8)count;
+    log_async_publish(ring);
+    log_async_leave(ring);
+    return true;
 }
-static inline void log_error(const char* format, ...) {
-    const u8 level = 4;
-    if (LOG_LEVEL > level) return;
+
+static inline void log_message(u8 level, const char* format, va_list args) {
+    if (log_async_push(level, format, args)) {
+        va_end(args);
+        return;
+    }
+    FILE* fp = level >= LOG_LEVEL_ERROR ? stderr : stdout;
+    // One line even when other threads log synchronously too
+    flockfile(fp);
+    fprintf(fp, "[%s] %s: ", get_timestamp(), log_level_name(level));
+    vfprintf(fp, format, args);
+    fprintf(fp, "\n");
+    fflush(fp);
+    funlockfile(fp);
+
+    va_end(args);
+}
+
+// Moves formatting and writing off the threads that log: each copies the
+// format pointer and its arguments into a ring of its own and a background
+// thread formats and writes them in batches.  Formats have to outlive the
+// message, in practice be literals.  A full ring drops debug and info
+// messages and the count is logged, warnings and errors are written
+// synchronously instead.  Stopped at exit.
+static inline void log_async_start(void) {
+    static bool at_exit = false;
+    static bool woken_init = false;
+    if (__atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE)) return;
+    if (!woken_init) {
+        // Timed against CLOCK_MONOTONIC like log_async_idle's deadline
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&log_async.woken, &attr);
+        pthread_condattr_destroy(&attr);
+        woken_init = true;
+    }
+    if (log_async.out.data == NULL) {
+        log_async.out.data = CIMPL_ALLOC(LOG_ASYNC_BUFFER_SIZE);
+    }
+    if (log_async.err.data == NULL) {
+        log_async.err.data = CIMPL_ALLOC(LOG_ASYNC_BUFFER_SIZE);
+    }
+    if (log_async.out.data == NULL || log_async.err.data == NULL) {
+        log_warn("Out of memory for the log thread, logging synchronously");
+        return;
+    }
+    log_async.out.fp = stdout;
+    log_async.err.fp = stderr;
+    __atomic_store_n(&log_async.running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&log_async.thread, NULL, log_async_run, NULL) != 0) {
+        __atomic_store_n(&log_async.running, false, __ATOMIC_RELEASE);
+        log_warn("Failed to start the log thread, logging synchronously");
+        return;
+    }
+    if (!at_exit) {
+        atexit(log_async_stop);
+        at_exit = true;
+    }
+}
+
+// Goes back to logging synchronously and writes out what is queued.  Threads
+// that log from here on write their messages themselves, ones already
+// queueing one are waited for.
+static inline void log_async_stop(void) {
+    if (!__atomic_exchange_n(&log_async.running, false, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    pthread_join(log_async.thread, NULL);
+    u32 ring_count = __atomic_load_n(&log_async.ring_count, __ATOMIC_ACQUIRE);
+    if (ring_count > LOG_ASYNC_THREADS) ring_count = LOG_ASYNC_THREADS;
+    for (u32 i = 0; i < ring_count; ++i) {
+        LogRing* ring = __atomic_load_n(&log_async.rings[i], __ATOMIC_SEQ_CST);
+        if (ring == NULL) continue;
+        while (__atomic_load_n(&ring->pushing, __ATOMIC_SEQ_CST)) {
+            // Queueing a message takes well under a microsecond
+        }
+    }
+    log_async_drain();
+}
+
+static inline void log_emit(u8 level, const char* format, ...) {
     va_list args;
     va_start(args, format);
+    log_message(level, format, args);
+}
 
-    fprintf(stderr, "[%s] %s: ", get_timestamp(), "ERROR");
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
+static inline void log_emit_fields(
+    u8 level, const char* message, const LogField* fields, u32 count
+) {
+    if (log_async_push_fields(level, message, fields, count)) return;
+    char line[LOG_LINE_MAX];
+    log_format_fields(line, sizeof(line), message, fields, count);
+    FILE* fp = level >= LOG_LEVEL_ERROR ? stderr : stdout;
+    fprintf(fp, "[%s] %s: %s\n", get_timestamp(), log_level_name(level), line);
+    fflush(fp);
+}
 
-    fflush(stderr);
-    va_end(args);
+// Only ever named inside sizeof, for the format check
+static inline int log_discard(const char* format, ...) {
+    (void)format;
+    return 0;
 }
 #endif /* CIMPL_IMPLEMENTATION */
 
@@ -391,7 +391,7 @@ CimplReturn Vec3Tree_sort(
     // TODO (mmckenna): if not, reserve
     if (node_arr->capacity < pt_arr->count) {
         log_error(
-            "Node capacity %d must match point count %d",
+            "Node capacity %zu must match point count %zu",
             node_arr->capacity,
             pt_arr->count
         );
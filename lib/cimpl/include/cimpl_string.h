@@ -119,6 +119,7 @@ StringArray* StringArray_default(void) {
     arr->items = items;
     arr->capacity = DEFAULT_ARRAY_CAPACITY;
     arr->count = 0;
+    arr->allocator = NULL;
     return arr;
 }
 
@@ -2,22 +2,241 @@
 #include "nob.h"
 
 #define COMMON_CFLAGS "-std=c99", "-Wall", "-Wextra", "-pedantic", "-ggdb"
+// Benchmarks are only meaningful optimised
+#define BENCH_CFLAGS "-O2"
 #define BUILD_DIR "build/"
 #define SRC_DIR "src/"
+// Machine-readable results of `./nob bench`, one JSON object per scenario
+#define BENCH_RESULTS BUILD_DIR "bench_e2e.json"
+// `./nob replay` replays one synthetic capture at each of these speeds and
+// checks every run wrote the same files
+#define REPLAY_DIR BUILD_DIR "replay/"
+#define REPLAY_CAPTURE REPLAY_DIR "capture.pcap"
+#define REPLAY_ADDR "127.0.0.1:5099"
+static const char* replay_speeds[] = {"0", "20"};
+
+bool build_executable(
+    Nob_Cmd* cmd, const char* src, const char* out, bool bench
+) {
+    nob_cmd_append(cmd, "gcc", COMMON_CFLAGS);
+    if (bench) nob_cmd_append(cmd, BENCH_CFLAGS);
+    nob_cmd_append(cmd, "-Iinclude", "-Ilib/cimpl/include");
+    nob_cmd_append(cmd, src);
+    nob_cmd_append(cmd, "-o", out);
+    nob_cmd_append(cmd, "-lm", "-pthread");
+    return nob_cmd_run_sync_and_reset(cmd);
+}
+
+// Empties `dir`, creating it if need be
+bool clean_dir(const char* dir) {
+    if (!nob_mkdir_if_not_exists(dir)) return false;
+    Nob_File_Paths children = {0};
+    if (!nob_read_entire_dir(dir, &children)) return false;
+    bool result = true;
+    // Not a line per file deleted
+    Nob_Log_Level level = nob_minimal_log_level;
+    nob_minimal_log_level = NOB_WARNING;
+    for (size_t i = 0; i < children.count; ++i) {
+        const char* name = children.items[i];
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (!nob_delete_file(nob_temp_sprintf("%s%s", dir, name))) {
+            result = false;
+        }
+    }
+    nob_minimal_log_level = level;
+    nob_da_free(children);
+    return result;
+}
+
+bool same_file(const char* a, const char* b) {
+    Nob_String_Builder sa = {0};
+    Nob_String_Builder sb = {0};
+    bool result = nob_read_entire_file(a, &sa) &&
+                  nob_read_entire_file(b, &sb) && sa.count == sb.count &&
+                  memcmp(sa.items, sb.items, sa.count) == 0;
+    nob_sb_free(sa);
+    nob_sb_free(sb);
+    return result;
+}
+
+// Replays a 10 s capture with segment, flush and reorder deadlines at every
+// speed in `replay_speeds`, and fails unless all runs wrote the same files
+bool replay_check(Nob_Cmd* cmd) {
+    if (!nob_mkdir_if_not_exists(REPLAY_DIR)) return false;
+    nob_cmd_append(
+        cmd,
+        BUILD_DIR "pgps_gen",
+        REPLAY_ADDR,
+        "--rate",
+        "1000",
+        "--seconds",
+        "10",
+        "--reorder",
+        "0.01",
+        "--capture",
+        REPLAY_CAPTURE
+    );
+    if (!nob_cmd_run_sync_and_reset(cmd)) return false;
+
+    size_t speed_count = NOB_ARRAY_LEN(replay_speeds);
+    for (size_t i = 0; i < speed_count; ++i) {
+        const char* dir =
+            nob_temp_sprintf(REPLAY_DIR "speed_%s/", replay_speeds[i]);
+        if (!clean_dir(dir)) return false;
+        nob_cmd_append(
+            cmd,
+            BUILD_DIR "pgps_listener",
+            REPLAY_ADDR,
+            nob_temp_sprintf("%sout.csv", dir),
+            "--replay",
+            REPLAY_CAPTURE,
+            "--speed",
+            replay_speeds[i],
+            "--count",
+            "0",
+            "--demux",
+            "--reorder",
+            "8",
+            "--segment-sec",
+            "2",
+            "--flush-ms",
+            "100"
+        );
+        if (!nob_cmd_run_sync_and_reset(cmd)) return false;
+    }
+
+    const char* first =
+        nob_temp_sprintf(REPLAY_DIR "speed_%s/", replay_speeds[0]);
+    Nob_File_Paths expected = {0};
+    if (!nob_read_entire_dir(first, &expected)) return false;
+    bool result = true;
+    for (size_t i = 1; i < speed_count; ++i) {
+        const char* dir =
+            nob_temp_sprintf(REPLAY_DIR "speed_%s/", replay_speeds[i]);
+        Nob_File_Paths actual = {0};
+        if (!nob_read_entire_dir(dir, &actual)) return false;
+        if (actual.count != expected.count) {
+            nob_log(
+                NOB_ERROR,
+                "Speed %s wrote %zu files, speed %s %zu",
+                replay_speeds[i],
+                actual.count - 2,
+                replay_speeds[0],
+                expected.count - 2
+            );
+            result = false;
+        }
+        for (size_t j = 0; j < expected.count; ++j) {
+            const char* name = expected.items[j];
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            if (!same_file(
+                    nob_temp_sprintf("%s%s", first, name),
+                    nob_temp_sprintf("%s%s", dir, name)
+                )) {
+                nob_log(
+                    NOB_ERROR,
+                    "%s differs at speed %s",
+                    name,
+                    replay_speeds[i]
+                );
+                result = false;
+            }
+        }
+        nob_da_free(actual);
+    }
+    if (result) {
+        nob_log(
+            NOB_INFO,
+            "Replay wrote the same %zu files at every speed",
+            expected.count - 2
+        );
+    }
+    nob_da_free(expected);
+    return result;
+}
 
 int main(int argc, char** argv) {
     NOB_GO_REBUILD_URSELF(argc, argv);
     Nob_Cmd cmd = {0};
+    const char* program = nob_shift_args(&argc, &argv);
+    bool bench = false;
+    bool replay = false;
+    bool check = false;
+    if (argc > 0) {
+        const char* target = nob_shift_args(&argc, &argv);
+        if (strcmp(target, "bench") == 0) {
+            bench = true;
+        } else if (strcmp(target, "replay") == 0) {
+            replay = true;
+        } else if (strcmp(target, "check") == 0) {
+            check = true;
+            replay = true;
+        } else {
+            nob_log(NOB_ERROR, "Usage: %s [bench|replay|check]", program);
+            return 1;
+        }
+    }
 
     if (!nob_mkdir_if_not_exists(BUILD_DIR)) return 1;
 
-    nob_cmd_append(&cmd, "gcc", COMMON_CFLAGS);
-    nob_cmd_append(&cmd, "-Iinclude", "-Ilib/cimpl/include");
-    nob_cmd_append(&cmd, SRC_DIR "main.c");
-    nob_cmd_append(&cmd, "-o", BUILD_DIR "pgps_listener");
-    nob_cmd_append(&cmd, "-Llib/cimpl", "-lcimpl");
-    nob_cmd_append(&cmd, "-lm");
-    if (!nob_cmd_run_sync_and_reset(&cmd)) return 1;
+    if (!build_executable(
+            &cmd, SRC_DIR "main.c", BUILD_DIR "pgps_listener", false
+        )) {
+        return 1;
+    }
+    if (!build_executable(
+            &cmd, SRC_DIR "bin2csv.c", BUILD_DIR "pgps_bin2csv", false
+        )) {
+        return 1;
+    }
+    if (!build_executable(&cmd, SRC_DIR "gen.c", BUILD_DIR "pgps_gen", true)) {
+        return 1;
+    }
+    if (!build_executable(
+            &cmd, SRC_DIR "stat.c", BUILD_DIR "pgps_stat", false
+        )) {
+        return 1;
+    }
+    // Optimised, so inlining lets -Warray-bounds see through the allocators
+    if (!build_executable(
+            &cmd, SRC_DIR "check_alloc.c", BUILD_DIR "check_alloc", true
+        )) {
+        return 1;
+    }
+    if (!build_executable(
+            &cmd, SRC_DIR "bench_recv.c", BUILD_DIR "bench_recv", true
+        )) {
+        return 1;
+    }
+    if (!build_executable(
+            &cmd, SRC_DIR "bench_format.c", BUILD_DIR "bench_format", true
+        )) {
+        return 1;
+    }
+    if (!build_executable(
+            &cmd,
+            SRC_DIR "bench_timestamp.c",
+            BUILD_DIR "bench_timestamp",
+            true
+        )) {
+        return 1;
+    }
+    if (!build_executable(
+            &cmd, SRC_DIR "bench_e2e.c", BUILD_DIR "bench_e2e", true
+        )) {
+        return 1;
+    }
+
+    if (bench) {
+        nob_cmd_append(&cmd, BUILD_DIR "bench_e2e", "--json", BENCH_RESULTS);
+        if (!nob_cmd_run_sync_and_reset(&cmd)) return 1;
+        nob_log(NOB_INFO, "Results written to %s", BENCH_RESULTS);
+    }
+    if (check) {
+        nob_cmd_append(&cmd, BUILD_DIR "check_alloc");
+        if (!nob_cmd_run_sync_and_reset(&cmd)) return 1;
+    }
+    if (replay && !replay_check(&cmd)) return 1;
 
     return 0;
 }
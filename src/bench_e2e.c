@@ -0,0 +1,346 @@
+// End-to-end benchmark: a forked pgps_gen generator sends to the listener's
+// receive path, which decodes the poses and writes them to a scratch file
+// with receive timestamps on.  Each scenario reports packets/sec, listener
+// CPU per packet and kernel->flushed latency percentiles, and with --json
+// writes one JSON object per scenario, per-stage percentiles included, for
+// comparing runs across versions.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+#include "cimpl_network.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_demux.h"
+#include "pgps_gen.h"
+#include "pgps_intern.h"
+#include "pgps_latency.h"
+#include "pgps_listener.h"
+#include "pgps_receiver.h"
+#include "pgps_time.h"
+#include "pgps_writer.h"
+
+#define BENCH_DEFAULT_ADDR "127.0.0.1:5098"
+#define BENCH_DEFAULT_SECONDS 2
+#define BENCH_BODIES 8
+#define BENCH_RCVBUF (8 * 1024 * 1024)
+// The receiver considers the run over after this much silence
+#define BENCH_IDLE_USEC 200000
+#define BENCH_PATH_MAX 256
+
+typedef struct BenchScenario {
+    const char* name;
+    // Poses/s, 0 flat out
+    f64 rate;
+    u32 burst;
+    OutputFormat format;
+} BenchScenario;
+
+// Paced runs show latency under a steady load, flat out shows throughput
+static const BenchScenario scenarios[] = {
+    {"csv-10k", 10000.0, 1, OUTPUT_FORMAT_CSV},
+    {"csv-100k", 100000.0, 8, OUTPUT_FORMAT_CSV},
+    {"csv-max", 0.0, 64, OUTPUT_FORMAT_CSV},
+    {"binary-100k", 100000.0, 8, OUTPUT_FORMAT_BINARY},
+    {"binary-max", 0.0, 64, OUTPUT_FORMAT_BINARY},
+};
+
+typedef struct BenchResult {
+    u64 sent;
+    u64 received;
+    u64 written;
+    f64 seconds;
+    f64 cpu_seconds;
+    LatencyStats latency;
+} BenchResult;
+
+static f64 rusage_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (f64)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           (f64)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+// Runs the generator for `seconds` and returns how many poses it sent
+static u64 bench_send(
+    const BenchScenario* scenario, IpV4Addr ip, u32 seconds
+) {
+    GenConfig config = {
+        .dst = ip,
+        .rate = scenario->rate,
+        .bodies = BENCH_BODIES,
+        .burst = scenario->burst,
+        .seconds = (f64)seconds,
+    };
+    Generator gen;
+    if (Generator_init(&gen, config) != RETURN_OK) return 0;
+    Generator_run(&gen, NULL);
+    u64 sent = gen.stats.sent;
+    Generator_free(&gen);
+    return sent;
+}
+
+static CimplReturn bench_scenario(
+    const BenchScenario* scenario,
+    IpV4Addr ip,
+    u32 seconds,
+    BenchResult* result
+) {
+    memset(result, 0, sizeof(*result));
+    char path[BENCH_PATH_MAX];
+    snprintf(
+        path,
+        sizeof(path),
+        "/tmp/pgps_bench_e2e_%d.%s",
+        (int)getpid(),
+        scenario->format == OUTPUT_FORMAT_CSV ? "csv" : "bin"
+    );
+
+    isize socket_fd = -1;
+    if (udp_listener_open(
+            &socket_fd, ip, 0, BENCH_IDLE_USEC, false, NULL
+        ) != EXIT_SUCCESS) {
+        return RETURN_ERR;
+    }
+    int rcvbuf = BENCH_RCVBUF;
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    static IdTable ids;
+    if (IdTable_init(&ids) != RETURN_OK) {
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+    Receiver rx = {0};
+    if (Receiver_init(
+            &rx,
+            RECV_BACKEND_RECVMMSG,
+            socket_fd,
+            &ids,
+            PGPS_BATCH_SIZE,
+            BENCH_IDLE_USEC,
+            true,
+            (RcvBufConfig){0}
+        ) != RETURN_OK) {
+        IdTable_free(&ids);
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+    // No flush budget with timestamps on flushes every batch, so the latency
+    // covers the whole way to the file
+    WriterConfig writer_config = {
+        .format = scenario->format,
+        .timestamps = true,
+    };
+    static PoseDemux output;
+    if (PoseDemux_open(&output, path, writer_config, &ids, false) !=
+        RETURN_OK) {
+        Receiver_free(&rx);
+        IdTable_free(&ids);
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+
+    int sent_pipe[2];
+    if (pipe(sent_pipe) < 0) {
+        perror("pipe");
+        PoseDemux_close(&output);
+        Receiver_free(&rx);
+        IdTable_free(&ids);
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sent_pipe[0]);
+        close(sent_pipe[1]);
+        PoseDemux_close(&output);
+        Receiver_free(&rx);
+        IdTable_free(&ids);
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+    if (pid == 0) {
+        close(sent_pipe[0]);
+        u64 sent = bench_send(scenario, ip, seconds);
+        if (write(sent_pipe[1], &sent, sizeof(sent)) != sizeof(sent)) _exit(1);
+        _exit(0);
+    }
+    close(sent_pipe[1]);
+
+    u64 first_ns = 0;
+    u64 last_ns = 0;
+    f64 cpu_start = 0.0;
+    bool reaped = false;
+    for (;;) {
+        isize received = Receiver_recv(&rx, rx.batch.capacity);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            // Nothing before the sender starts is fine, unless it has
+            // already given up.  Silence after is the end of the run.
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && first_ns == 0) {
+                reaped = waitpid(pid, NULL, WNOHANG) == pid;
+                if (reaped) break;
+                continue;
+            }
+            break;
+        }
+        u64 now = monotonic_ns();
+        for (u32 i = 0; i < rx.batch.count; ++i) {
+            PoseDemux_write(
+                &output,
+                &rx.batch.samples[i],
+                rx.batch.kernel_ns[i],
+                rx.batch.user_ns[i],
+                now
+            );
+        }
+        last_ns = monotonic_ns();
+        PoseDemux_tick(&output, last_ns);
+        if (first_ns == 0) {
+            first_ns = last_ns;
+            cpu_start = rusage_seconds();
+        }
+    }
+    for (u32 i = 0; i < output.count; ++i) {
+        PoseWriter_flush(&output.writers[i], last_ns);
+    }
+    result->cpu_seconds = rusage_seconds() - cpu_start;
+    result->seconds = (f64)(last_ns - first_ns) * 1e-9;
+    result->received = rx.stats.packets;
+    for (u32 i = 0; i < output.count; ++i) {
+        result->written += output.writers[i].total_poses;
+    }
+    PoseDemux_latency(&output, &result->latency);
+
+    if (!reaped) waitpid(pid, NULL, 0);
+    if (read(sent_pipe[0], &result->sent, sizeof(result->sent)) !=
+        sizeof(result->sent)) {
+        result->sent = 0;
+    }
+    close(sent_pipe[0]);
+    PoseDemux_close(&output);
+    unlink(path);
+    Receiver_free(&rx);
+    IdTable_free(&ids);
+    close(socket_fd);
+    if (first_ns == 0) {
+        log_error("%s: nothing received from the sender", scenario->name);
+        return RETURN_ERR;
+    }
+    return RETURN_OK;
+}
+
+static void bench_print_json(
+    const BenchScenario* scenario, const BenchResult* r, FILE* fp
+) {
+    f64 pps = r->seconds > 0.0 ? (f64)r->written / r->seconds : 0.0;
+    f64 ns_per_pkt =
+        r->written == 0 ? 0.0 : r->cpu_seconds * 1e9 / (f64)r->written;
+    fprintf(
+        fp,
+        "{\"scenario\":\"%s\",\"format\":\"%s\",\"rate\":%.0f,"
+        "\"sent\":%lu,\"received\":%lu,\"written\":%lu,\"seconds\":%.6f,"
+        "\"pkts_per_sec\":%.0f,\"cpu_seconds\":%.6f,\"cpu_ns_per_pkt\":%.1f,"
+        "\"latency_ns\":",
+        scenario->name,
+        OutputFormat_name(scenario->format),
+        scenario->rate,
+        r->sent,
+        r->received,
+        r->written,
+        r->seconds,
+        pps,
+        r->cpu_seconds,
+        ns_per_pkt
+    );
+    LatencyStats_print_json(&r->latency, fp);
+    fprintf(fp, "}\n");
+}
+
+int main(int argc, char** argv) {
+    char* addr_str = BENCH_DEFAULT_ADDR;
+    u32 seconds = BENCH_DEFAULT_SECONDS;
+    char* json_path = NULL;
+    u32 positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (positional == 0) {
+            addr_str = argv[i];
+            positional++;
+        } else {
+            seconds = (u32)strtoul(argv[i], NULL, 10);
+            positional++;
+        }
+    }
+    IpV4Addr ip = {0};
+    if (IpV4Addr_from_str(&ip, addr_str) != 0 || seconds == 0) {
+        printf("Usage: %s [IP_ADDR] [SECONDS] [--json PATH]\n", argv[0]);
+        return 1;
+    }
+    FILE* json = NULL;
+    if (json_path != NULL) {
+        json = fopen(json_path, "w");
+        if (json == NULL) {
+            perror(json_path);
+            return 1;
+        }
+    }
+
+    printf(
+        "%-12s %10s %10s %8s %10s %8s %8s %10s %10s %10s %10s\n",
+        "scenario",
+        "sent",
+        "written",
+        "loss%",
+        "pkts/sec",
+        "ns/pkt",
+        "cpu%",
+        "p50 ns",
+        "p99 ns",
+        "p99.9 ns",
+        "max ns"
+    );
+    static BenchResult r;
+    i32 status = 0;
+    for (u32 i = 0; i < ARRAY_COUNT(scenarios); ++i) {
+        const BenchScenario* scenario = &scenarios[i];
+        if (bench_scenario(scenario, ip, seconds, &r) != RETURN_OK) {
+            printf("%-12s failed\n", scenario->name);
+            status = 1;
+            continue;
+        }
+        f64 loss = r.sent == 0 || r.written > r.sent
+                       ? 0.0
+                       : 100.0 * (f64)(r.sent - r.written) / (f64)r.sent;
+        f64 pps = r.seconds > 0.0 ? (f64)r.written / r.seconds : 0.0;
+        f64 cpu = r.seconds > 0.0 ? 100.0 * r.cpu_seconds / r.seconds : 0.0;
+        f64 ns_per_pkt =
+            r.written == 0 ? 0.0 : r.cpu_seconds * 1e9 / (f64)r.written;
+        const LatencyHist* total = &r.latency.stages[LATENCY_TOTAL];
+        printf(
+            "%-12s %10lu %10lu %8.2f %10.0f %8.1f %8.1f %10lu %10lu %10lu "
+            "%10lu\n",
+            scenario->name,
+            r.sent,
+            r.written,
+            loss,
+            pps,
+            ns_per_pkt,
+            cpu,
+            LatencyHist_percentile(total, 50.0),
+            LatencyHist_percentile(total, 99.0),
+            LatencyHist_percentile(total, 99.9),
+            total->max
+        );
+        if (json != NULL) bench_print_json(scenario, &r, json);
+    }
+    if (json != NULL) fclose(json);
+    return status;
+}
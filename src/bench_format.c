@@ -0,0 +1,220 @@
+// Compares the fixed-precision CSV formatter against fprintf.  Every value
+// is first checked byte for byte against "%12.6f", then both paths format
+// the same poses into /dev/null and report ns/pose.
+#define _GNU_SOURCE
+#include <stdbool.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_format.h"
+#include "pgps_intern.h"
+#include "pgps_pose.h"
+#include "pgps_time.h"
+
+#define BENCH_DEFAULT_POSES 1000000
+#define BENCH_POSE_SET 4096
+// Random bit patterns checked against snprintf, on top of the edge cases
+#define BENCH_CHECK_VALUES 2000000
+#define BENCH_BUFFER_SIZE (64 * 1024)
+
+static IdTable bench_ids;
+
+static u64 bench_rng = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*, good enough to spread values over the whole f32 range
+static u64 bench_random(void) {
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return bench_rng * 0x2545f4914f6cdd1dull;
+}
+
+static f32 bench_random_range(f32 lo, f32 hi) {
+    return lo + (hi - lo) * (f32)((bench_random() >> 40) / (f64)(1 << 24));
+}
+
+static bool check_value(f32 value) {
+    char expected[FORMAT_F32_FIXED6_MAX];
+    char actual[FORMAT_F32_FIXED6_MAX];
+    i32 expected_len = snprintf(expected, sizeof(expected), "%12.6f", value);
+    usize actual_len = format_f32_fixed6(actual, value);
+    if ((usize)expected_len != actual_len ||
+        memcmp(expected, actual, actual_len) != 0) {
+        log_error(
+            "Mismatch for %a: \"%s\" vs \"%.*s\"",
+            value,
+            expected,
+            (int)actual_len,
+            actual
+        );
+        return false;
+    }
+    return true;
+}
+
+// Edge cases, random bit patterns and realistic poses
+static CimplReturn check_formatter(
+    const Pose* poses, const PoseSample* samples, u32 pose_count
+) {
+    const f32 edges[] = {
+        0.0f,
+        -0.0f,
+        1.0f,
+        -1.0f,
+        0.0000005f,
+        -0.0000005f,
+        0.0000015f,
+        0.0000025f,
+        1e-7f,
+        -1e-7f,
+        1e-45f,
+        -1e-45f,
+        0.9999995f,
+        9.9999995f,
+        123456.789f,
+        -98765.4321f,
+        // Either side of the fast path limit
+        1099511562240.0f,
+        1099511627776.0f,
+        -1e12f,
+        3.4028235e38f,
+        1.0f / 0.0f,
+        -1.0f / 0.0f,
+        0.0f / 0.0f,
+    };
+    for (u32 i = 0; i < ARRAY_COUNT(edges); ++i) {
+        if (!check_value(edges[i])) return RETURN_ERR;
+    }
+    for (u32 i = 0; i < BENCH_CHECK_VALUES; ++i) {
+        u32 bits = (u32)bench_random();
+        f32 value;
+        memcpy(&value, &bits, sizeof(value));
+        if (!check_value(value)) return RETURN_ERR;
+        // Random bits are mostly tiny or huge, also cover the usual range
+        if (!check_value(bench_random_range(-1000.0f, 1000.0f))) {
+            return RETURN_ERR;
+        }
+    }
+    for (u32 i = 0; i < pose_count; ++i) {
+        char expected[256];
+        char actual[256];
+        const Pose* pose = &poses[i];
+        i32 expected_len = snprintf(
+            expected,
+            sizeof(expected),
+            "%s,%d,%12.6f,%12.6f,%12.6f,%12.6f,%12.6f,%12.6f,%12.6f\n",
+            pose->id,
+            i,
+            pose->position.x,
+            pose->position.y,
+            pose->position.z,
+            pose->rotation.x,
+            pose->rotation.y,
+            pose->rotation.z,
+            pose->rotation.w
+        );
+        const PoseSample* sample = &samples[i];
+        usize actual_len = PoseSample_format_csv(
+            actual, sample, IdTable_name(&bench_ids, sample->id), i
+        );
+        if ((usize)expected_len != actual_len ||
+            memcmp(expected, actual, actual_len) != 0) {
+            log_error(
+                "Row mismatch: \"%s\" vs \"%.*s\"",
+                expected,
+                (int)actual_len,
+                actual
+            );
+            return RETURN_ERR;
+        }
+    }
+    return RETURN_OK;
+}
+
+static f64 bench_fprintf(FILE* fp, const Pose* poses, u32 count) {
+    u64 start = monotonic_ns();
+    for (u32 i = 0; i < count; ++i) {
+        Pose_write_csv(fp, &poses[i % BENCH_POSE_SET], i);
+    }
+    fflush(fp);
+    return (f64)(monotonic_ns() - start) / (f64)count;
+}
+
+static f64 bench_buffered(FILE* fp, const PoseSample* samples, u32 count) {
+    static char buffer[BENCH_BUFFER_SIZE];
+    usize len = 0;
+    u64 start = monotonic_ns();
+    for (u32 i = 0; i < count; ++i) {
+        const PoseSample* sample = &samples[i % BENCH_POSE_SET];
+        if (len + POSE_CSV_ROW_MAX > sizeof(buffer)) {
+            fwrite(buffer, 1, len, fp);
+            len = 0;
+        }
+        len += PoseSample_format_csv(
+            buffer + len, sample, IdTable_name(&bench_ids, sample->id), i
+        );
+    }
+    fwrite(buffer, 1, len, fp);
+    fflush(fp);
+    return (f64)(monotonic_ns() - start) / (f64)count;
+}
+
+int main(int argc, char** argv) {
+    u32 count = argc > 1 ? (u32)strtoul(argv[1], NULL, 10)
+                         : BENCH_DEFAULT_POSES;
+    if (count == 0) {
+        printf("Usage: %s [POSES]\n", argv[0]);
+        return 1;
+    }
+
+    if (IdTable_init(&bench_ids) != RETURN_OK) return 1;
+    static Pose poses[BENCH_POSE_SET];
+    static PoseSample samples[BENCH_POSE_SET];
+    for (u32 i = 0; i < BENCH_POSE_SET; ++i) {
+        snprintf(poses[i].id, sizeof(poses[i].id), "body%u", i % 8);
+        poses[i].position = (Vec3){
+            bench_random_range(-10.0f, 10.0f),
+            bench_random_range(-10.0f, 10.0f),
+            bench_random_range(0.0f, 3.0f),
+        };
+        poses[i].rotation = (Quat){
+            bench_random_range(-1.0f, 1.0f),
+            bench_random_range(-1.0f, 1.0f),
+            bench_random_range(-1.0f, 1.0f),
+            bench_random_range(-1.0f, 1.0f),
+        };
+        // The same pose in the handle form the writer formats
+        samples[i].id = IdTable_intern(&bench_ids, poses[i].id);
+        samples[i].position = poses[i].position;
+        samples[i].rotation = poses[i].rotation;
+    }
+
+    if (check_formatter(poses, samples, BENCH_POSE_SET) != RETURN_OK) {
+        return 1;
+    }
+    printf(
+        "Formatter matches %%12.6f on %u values and %u rows\n",
+        (u32)(2 * BENCH_CHECK_VALUES),
+        BENCH_POSE_SET
+    );
+
+    FILE* fp = fopen("/dev/null", "w");
+    if (fp == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    f64 fprintf_ns = bench_fprintf(fp, poses, count);
+    f64 buffered_ns = bench_buffered(fp, samples, count);
+    fclose(fp);
+
+    printf("%-10s %10s %12s\n", "path", "ns/pose", "poses/sec");
+    printf("%-10s %10.1f %12.0f\n", "fprintf", fprintf_ns, 1e9 / fprintf_ns);
+    printf(
+        "%-10s %10.1f %12.0f\n", "buffered", buffered_ns, 1e9 / buffered_ns
+    );
+    printf("Speedup: %.2fx\n", fprintf_ns / buffered_ns);
+    return 0;
+}
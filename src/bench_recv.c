@@ -0,0 +1,230 @@
+// Compares the receive backends on loopback.  A forked sender floods the
+// listener with Pose datagrams for a fixed time while the parent drains them
+// through each backend in turn, measuring packets/sec and CPU usage.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+#include "cimpl_network.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_intern.h"
+#include "pgps_listener.h"
+#include "pgps_pose.h"
+#include "pgps_receiver.h"
+#include "pgps_shard.h"
+#include "pgps_time.h"
+#include "pgps_wire.h"
+
+#define BENCH_DEFAULT_ADDR "127.0.0.1:5099"
+#define BENCH_DEFAULT_SECONDS 2
+#define BENCH_SEND_BATCH 64
+#define BENCH_RCVBUF (8 * 1024 * 1024)
+// The receiver considers the run over after this much silence
+#define BENCH_IDLE_USEC 200000
+
+typedef struct BenchResult {
+    u64 sent;
+    u64 received;
+    u64 syscalls;
+    f64 seconds;
+    f64 cpu_seconds;
+} BenchResult;
+
+static f64 rusage_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (f64)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           (f64)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+// Floods `ip` with sendmmsg for `seconds` and returns how many were sent
+static u64 bench_send(IpV4Addr ip, u32 seconds) {
+    i32 fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in dst = {0};
+    dst.sin_family = AF_INET;
+    dst.sin_addr.s_addr = htonl(ip.addr);
+    dst.sin_port = htons(ip.port);
+    if (connect(fd, (struct sockaddr*)&dst, sizeof(dst)) < 0) {
+        perror("connect");
+        return 0;
+    }
+
+    u8 wire[BENCH_SEND_BATCH][POSE_WIRE_SIZE];
+    struct iovec iovecs[BENCH_SEND_BATCH];
+    struct mmsghdr msgs[BENCH_SEND_BATCH] = {0};
+    for (u32 i = 0; i < BENCH_SEND_BATCH; ++i) {
+        Pose pose = {0};
+        snprintf(pose.id, sizeof(pose.id), "body%u", i % 8);
+        snprintf(
+            pose.timestamp,
+            sizeof(pose.timestamp),
+            "2026-01-01T00:00:00.000000Z"
+        );
+        pose.position = (Vec3){(f32)i, 2.0f, 3.0f};
+        pose.rotation = (Quat){0.0f, 0.0f, 0.0f, 1.0f};
+        Pose_encode(&pose, wire[i]);
+        iovecs[i].iov_base = wire[i];
+        iovecs[i].iov_len = POSE_WIRE_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    u64 sent = 0;
+    u64 end_ns = monotonic_ns() + (u64)seconds * NS_PER_SEC;
+    while (monotonic_ns() < end_ns) {
+        int n = sendmmsg(fd, msgs, BENCH_SEND_BATCH, 0);
+        if (n > 0) sent += (u64)n;
+    }
+    close(fd);
+    return sent;
+}
+
+static CimplReturn bench_backend(
+    RecvBackend backend, IpV4Addr ip, u32 seconds, BenchResult* result
+) {
+    memset(result, 0, sizeof(*result));
+    isize socket_fd = -1;
+    if (udp_listener_open(
+            &socket_fd, ip, 0, BENCH_IDLE_USEC, false, NULL
+        ) != EXIT_SUCCESS) {
+        return RETURN_ERR;
+    }
+    int rcvbuf = BENCH_RCVBUF;
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    static IdTable ids;
+    if (IdTable_init(&ids) != RETURN_OK) {
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+    Receiver rx = {0};
+    if (Receiver_init(
+            &rx,
+            backend,
+            socket_fd,
+            &ids,
+            PGPS_BATCH_SIZE,
+            BENCH_IDLE_USEC,
+            false,
+            (RcvBufConfig){0}
+        ) != RETURN_OK) {
+        IdTable_free(&ids);
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+
+    int sent_pipe[2];
+    if (pipe(sent_pipe) < 0) {
+        perror("pipe");
+        Receiver_free(&rx);
+        IdTable_free(&ids);
+        close(socket_fd);
+        return RETURN_ERR;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sent_pipe[0]);
+        u64 sent = bench_send(ip, seconds);
+        if (write(sent_pipe[1], &sent, sizeof(sent)) != sizeof(sent)) _exit(1);
+        _exit(0);
+    }
+    close(sent_pipe[1]);
+
+    u64 first_ns = 0;
+    u64 last_ns = 0;
+    f64 cpu_start = 0.0;
+    for (;;) {
+        isize received = Receiver_recv(&rx, rx.batch.capacity);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            // Nothing before the sender starts is fine, silence after is
+            // the end of the run
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && first_ns == 0) {
+                continue;
+            }
+            break;
+        }
+        last_ns = monotonic_ns();
+        if (first_ns == 0) {
+            first_ns = last_ns;
+            cpu_start = rusage_seconds();
+        }
+    }
+    result->cpu_seconds = rusage_seconds() - cpu_start;
+    result->seconds = (f64)(last_ns - first_ns) * 1e-9;
+    result->received = rx.stats.packets;
+    result->syscalls = rx.stats.syscalls;
+
+    waitpid(pid, NULL, 0);
+    if (read(sent_pipe[0], &result->sent, sizeof(result->sent)) !=
+        sizeof(result->sent)) {
+        result->sent = 0;
+    }
+    close(sent_pipe[0]);
+    Receiver_free(&rx);
+    IdTable_free(&ids);
+    close(socket_fd);
+    return RETURN_OK;
+}
+
+int main(int argc, char** argv) {
+    char* addr_str = argc > 1 ? argv[1] : BENCH_DEFAULT_ADDR;
+    u32 seconds = argc > 2 ? (u32)strtoul(argv[2], NULL, 10)
+                           : BENCH_DEFAULT_SECONDS;
+    IpV4Addr ip = {0};
+    if (IpV4Addr_from_str(&ip, addr_str) != 0) {
+        printf("Usage: %s [IP_ADDR] [SECONDS]\n", argv[0]);
+        return 1;
+    }
+
+    const RecvBackend backends[] = {
+        RECV_BACKEND_RECVFROM,
+        RECV_BACKEND_RECVMMSG,
+        RECV_BACKEND_URING,
+    };
+    printf(
+        "%-10s %12s %12s %8s %12s %8s %10s %10s\n",
+        "backend",
+        "sent",
+        "received",
+        "loss%",
+        "pkts/sec",
+        "cpu%",
+        "ns/pkt",
+        "pkts/call"
+    );
+    for (u32 i = 0; i < ARRAY_COUNT(backends); ++i) {
+        BenchResult r = {0};
+        if (bench_backend(backends[i], ip, seconds, &r) != RETURN_OK) {
+            printf("%-10s failed\n", RecvBackend_name(backends[i]));
+            continue;
+        }
+        f64 loss = r.sent == 0 ? 0.0
+                               : 100.0 * (f64)(r.sent - r.received) /
+                                     (f64)r.sent;
+        f64 pps = r.seconds > 0.0 ? (f64)r.received / r.seconds : 0.0;
+        f64 cpu = r.seconds > 0.0 ? 100.0 * r.cpu_seconds / r.seconds : 0.0;
+        f64 ns_per_pkt =
+            r.received == 0 ? 0.0 : r.cpu_seconds * 1e9 / (f64)r.received;
+        f64 per_call =
+            r.syscalls == 0 ? 0.0 : (f64)r.received / (f64)r.syscalls;
+        printf(
+            "%-10s %12lu %12lu %8.2f %12.0f %8.1f %10.1f %10.2f\n",
+            RecvBackend_name(backends[i]),
+            r.sent,
+            r.received,
+            loss,
+            pps,
+            cpu,
+            ns_per_pkt,
+            per_call
+        );
+    }
+    return 0;
+}
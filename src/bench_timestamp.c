@@ -0,0 +1,260 @@
+// Compares the fixed-layout ISO-8601 parser against strptime and sscanf.
+// Every path is first checked against strptime + timegm on random and
+// malformed timestamps, and the formatter against strftime, then each path
+// parses the same set and reports ns per timestamp.
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_iso8601.h"
+#include "pgps_time.h"
+
+#define BENCH_DEFAULT_PARSES 2000000
+#define BENCH_TIMESTAMP_SET 4096
+// 1970-01-01 .. 2099-12-31
+#define BENCH_MAX_SECONDS 4102444799ull
+
+static u64 bench_rng = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*
+static u64 bench_random(void) {
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return bench_rng * 0x2545f4914f6cdd1dull;
+}
+
+// Formats `ns` the way senders do, into ISO8601_SIZE bytes
+static void bench_format(char* out, i64 ns) {
+    time_t seconds = (time_t)(ns / 1000000000);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    memset(out, 0, ISO8601_SIZE);
+    usize len = strftime(out, ISO8601_SIZE, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(
+        out + len,
+        ISO8601_SIZE - len,
+        ".%06uZ",
+        (u32)(ns / 1000 % 1000000)
+    );
+}
+
+// Copies a literal into a field, truncating it like a sender would
+static void bench_fill(char* text, const char* literal) {
+    usize len = strlen(literal);
+    if (len > ISO8601_SIZE) len = ISO8601_SIZE;
+    memset(text, 0, ISO8601_SIZE);
+    memcpy(text, literal, len);
+}
+
+static bool parse_strptime(const char* text, i64* ns) {
+    struct tm tm = {0};
+    const char* rest = strptime(text, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (rest == NULL || rest[0] != '.') return false;
+    char* end;
+    long micros = strtol(rest + 1, &end, 10);
+    if (end != rest + 7 || end[0] != 'Z' || end[1] != '\0') return false;
+    *ns = ((i64)timegm(&tm) * 1000000 + micros) * 1000;
+    return true;
+}
+
+static bool parse_sscanf(const char* text, i64* ns) {
+    struct tm tm = {0};
+    int micros;
+    char zone;
+    int used = 0;
+    if (sscanf(
+            text,
+            "%4d-%2d-%2dT%2d:%2d:%2d.%6d%c%n",
+            &tm.tm_year,
+            &tm.tm_mon,
+            &tm.tm_mday,
+            &tm.tm_hour,
+            &tm.tm_min,
+            &tm.tm_sec,
+            &micros,
+            &zone,
+            &used
+        ) != 8 ||
+        zone != 'Z' || used != ISO8601_LENGTH) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *ns = ((i64)timegm(&tm) * 1000000 + micros) * 1000;
+    return true;
+}
+
+typedef struct BenchPath {
+    const char* name;
+    Iso8601Parser parse;
+    // strptime and sscanf leave range checks to timegm, which normalises
+    // out-of-range fields instead of rejecting them
+    bool strict;
+    bool supported;
+} BenchPath;
+
+// Runs every path over the same random timestamps and checks it agrees with
+// strptime, and that the strict paths reject malformed ones
+static CimplReturn check_paths(const BenchPath* paths, u32 path_count) {
+    static const char* malformed[] = {
+        "2026-10-16 12:00:00.000000Z",
+        "2026-10-16T12:00:00.000000",
+        "2026-10-16T12:00:00,000000Z",
+        "2026-13-16T12:00:00.000000Z",
+        "2026-00-16T12:00:00.000000Z",
+        "2026-02-29T12:00:00.000000Z",
+        "2026-04-31T12:00:00.000000Z",
+        "2026-10-16T24:00:00.000000Z",
+        "2026-10-16T12:60:00.000000Z",
+        "2026-10-16T12:00:61.000000Z",
+        "2026-10-16T12:00:00.00000aZ",
+        "2026-1O-16T12:00:00.000000Z",
+        "2026-10-16T12:00:00.000000Zx",
+        "2026-10-16T12:00:00.0000Z",
+        "",
+    };
+    static const char* edges[] = {
+        "1970-01-01T00:00:00.000000Z",
+        "2000-02-29T23:59:59.999999Z",
+        "2024-02-29T00:00:00.000001Z",
+        "2100-03-01T00:00:00.000000Z",
+        "2026-12-31T23:59:60.500000Z",
+        "1969-12-31T23:59:59.000000Z",
+    };
+    char text[ISO8601_SIZE];
+    for (u32 p = 0; p < path_count; ++p) {
+        if (!paths[p].supported) continue;
+        u32 malformed_count =
+            paths[p].strict ? sizeof(malformed) / sizeof(malformed[0]) : 0;
+        for (u32 i = 0; i < malformed_count; ++i) {
+            bench_fill(text, malformed[i]);
+            i64 ns;
+            if (paths[p].parse(text, &ns)) {
+                log_error("%s accepted \"%s\"", paths[p].name, malformed[i]);
+                return RETURN_ERR;
+            }
+        }
+        for (u32 i = 0; i < 2 * BENCH_TIMESTAMP_SET; ++i) {
+            i64 expected;
+            if (i < sizeof(edges) / sizeof(edges[0])) {
+                bench_fill(text, edges[i]);
+                parse_strptime(text, &expected);
+            } else {
+                u64 micros = bench_random() % (BENCH_MAX_SECONDS * 1000000);
+                expected = (i64)micros * 1000;
+                bench_format(text, expected);
+            }
+            i64 ns = 0;
+            if (!paths[p].parse(text, &ns) || ns != expected) {
+                log_error(
+                    "%s: \"%s\" gave %ld, expected %ld",
+                    paths[p].name,
+                    text,
+                    ns,
+                    expected
+                );
+                return RETURN_ERR;
+            }
+        }
+    }
+    return RETURN_OK;
+}
+
+// The formatter has to produce exactly what senders do
+static CimplReturn check_format(void) {
+    char expected[ISO8601_SIZE];
+    char text[ISO8601_SIZE];
+    for (u32 i = 0; i < BENCH_TIMESTAMP_SET; ++i) {
+        u64 micros = bench_random() % (BENCH_MAX_SECONDS * 1000000);
+        bench_format(expected, (i64)micros * 1000);
+        iso8601_format_ns(text, (i64)micros * 1000);
+        if (memcmp(text, expected, ISO8601_SIZE) != 0) {
+            log_error("Formatted \"%s\", expected \"%s\"", text, expected);
+            return RETURN_ERR;
+        }
+    }
+    return RETURN_OK;
+}
+
+static f64 bench_path(
+    const BenchPath* path, const char (*texts)[ISO8601_SIZE], u32 count
+) {
+    i64 sum = 0;
+    u64 start = monotonic_ns();
+    for (u32 i = 0; i < count; ++i) {
+        i64 ns = 0;
+        path->parse(texts[i % BENCH_TIMESTAMP_SET], &ns);
+        sum += ns;
+    }
+    u64 elapsed = monotonic_ns() - start;
+    // Keep the results live
+    if (sum == 42) printf("\n");
+    return (f64)elapsed / (f64)count;
+}
+
+int main(int argc, char** argv) {
+    u32 count = argc > 1 ? (u32)strtoul(argv[1], NULL, 10)
+                         : BENCH_DEFAULT_PARSES;
+    if (count == 0) {
+        printf("Usage: %s [PARSES]\n", argv[0]);
+        return 1;
+    }
+
+    __builtin_cpu_init();
+    BenchPath paths[] = {
+        {"strptime", parse_strptime, false, true},
+        {"sscanf", parse_sscanf, false, true},
+        {"scalar", iso8601_parse_ns_scalar, true, true},
+#ifdef ISO8601_X86
+        {"sse4.1",
+         iso8601_parse_ns_sse41,
+         true,
+         __builtin_cpu_supports("sse4.1") != 0},
+        {"avx2",
+         iso8601_parse_ns_avx2,
+         true,
+         __builtin_cpu_supports("avx2") != 0},
+#endif
+    };
+    u32 path_count = sizeof(paths) / sizeof(paths[0]);
+    if (check_paths(paths, path_count) != RETURN_OK) return 1;
+    if (check_format() != RETURN_OK) return 1;
+    printf(
+        "All paths agree on %u timestamps, runtime pick is %s\n",
+        2 * BENCH_TIMESTAMP_SET,
+        iso8601_parser_name()
+    );
+
+    static char texts[BENCH_TIMESTAMP_SET][ISO8601_SIZE];
+    for (u32 i = 0; i < BENCH_TIMESTAMP_SET; ++i) {
+        u64 micros = bench_random() % (BENCH_MAX_SECONDS * 1000000);
+        bench_format(texts[i], (i64)micros * 1000);
+    }
+
+    printf("%-10s %10s %12s\n", "path", "ns/parse", "parses/sec");
+    f64 baseline_ns = 0.0;
+    for (u32 p = 0; p < path_count; ++p) {
+        if (!paths[p].supported) {
+            printf("%-10s %10s\n", paths[p].name, "n/a");
+            continue;
+        }
+        f64 ns = bench_path(
+            &paths[p], (const char (*)[ISO8601_SIZE])texts, count
+        );
+        if (p == 0) baseline_ns = ns;
+        printf(
+            "%-10s %10.1f %12.0f %6.1fx\n",
+            paths[p].name,
+            ns,
+            1e9 / ns,
+            baseline_ns / ns
+        );
+    }
+    return 0;
+}
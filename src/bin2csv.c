@@ -0,0 +1,65 @@
+// Converts a binary pose log written with `--format binary` into the CSV the
+// listener would have written for the same poses.
+#define _GNU_SOURCE
+#include <stdbool.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_binlog.h"
+#include "pgps_pose.h"
+
+#define BIN2CSV_BUFFER_SIZE (1024 * 1024)
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s [INPUT_LOG] [OUTPUT_PATH]\n", argv[0]);
+        return 1;
+    }
+
+    PoseLog log = {0};
+    if (PoseLog_open_read(&log, argv[1]) != RETURN_OK) return 1;
+    FILE* fp = fopen(argv[2], "w");
+    char* buffer = malloc(BIN2CSV_BUFFER_SIZE);
+    if (fp == NULL || buffer == NULL) {
+        log_error("Failed to open %s", argv[2]);
+        if (fp != NULL) fclose(fp);
+        free(buffer);
+        PoseLog_close(&log);
+        return 1;
+    }
+
+    fputs(POSE_CSV_HEADER, fp);
+    usize len = 0;
+    u64 count = log.header->record_count;
+    for (u64 i = 0; i < count; ++i) {
+        const PoseSample* sample = &log.records[i];
+        if (len + POSE_CSV_ROW_MAX > BIN2CSV_BUFFER_SIZE) {
+            fwrite(buffer, 1, len, fp);
+            len = 0;
+        }
+        len += PoseSample_format_csv(
+            buffer + len, sample, PoseLog_id(&log, sample->id), (u32)i
+        );
+    }
+    fwrite(buffer, 1, len, fp);
+
+    i32 result = 0;
+    if (fclose(fp) != 0) {
+        perror("fclose");
+        result = 1;
+    }
+    // Handles this file never saw leave gaps in the id table
+    u32 bodies = 0;
+    for (u32 i = 0; i < log.header->id_count; ++i) {
+        if (log.ids[i][0] != '\0') bodies++;
+    }
+    log_info(
+        "Converted %lu poses of %u bodies to %s", count, bodies, argv[2]
+    );
+    free(buffer);
+    PoseLog_close(&log);
+    return result;
+}
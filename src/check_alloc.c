@@ -0,0 +1,115 @@
+// Pushes into dynamic arrays on an Arena and on a Pool until they run out,
+// checking each array keeps everything pushed before the push that failed
+// and that a reset or release makes the memory usable again.  Every refused
+// push prints the usual ARRAY_RESERVE message.
+#include <stdbool.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+
+#define CHECK_ARENA_SIZE 1024
+#define CHECK_POOL_BLOCK_SIZE 40
+#define CHECK_POOL_BLOCKS 2
+
+DEFINE_DYNAMIC_ARRAY(u32, CheckArray)
+
+static u32 check_failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL: %s\n", what);
+    check_failures++;
+}
+
+// Pushes 0, 1, 2... until a push fails and returns how many went in
+static u32 check_fill(CheckArray* arr) {
+    u32 pushed = 0;
+    while (CheckArray_push(arr, pushed) == RETURN_OK) pushed++;
+    return pushed;
+}
+
+static bool check_intact(const CheckArray* arr, u32 count) {
+    if (arr->count != count || arr->capacity < count) return false;
+    for (u32 i = 0; i < count; ++i) {
+        if (arr->items[i] != i) return false;
+    }
+    return true;
+}
+
+static void check_arena(void) {
+    Arena arena;
+    if (Arena_init(&arena, CHECK_ARENA_SIZE) != RETURN_OK) {
+        check(false, "Arena_init");
+        return;
+    }
+    u32 fits = CHECK_ARENA_SIZE / sizeof(u32);
+
+    // On its own, the array grows in place up to the whole arena
+    CheckArray arr;
+    CheckArray_init_with(&arr, &arena.allocator);
+    u32 pushed = check_fill(&arr);
+    check(pushed == fits, "arena array fills the arena");
+    check(check_intact(&arr, pushed), "arena array intact once full");
+    check(arena.high_water == CHECK_ARENA_SIZE, "arena high water");
+
+    // Everything back at once, then two arrays share it
+    Arena_reset(&arena);
+    CheckArray a;
+    CheckArray b;
+    CheckArray_init_with(&a, &arena.allocator);
+    CheckArray_init_with(&b, &arena.allocator);
+    check(CheckArray_push(&a, 0) == RETURN_OK, "push after reset");
+    check(CheckArray_push(&b, 0) == RETURN_OK, "second array on arena");
+    u32 a_pushed = 1;
+    while (CheckArray_push(&a, a_pushed) == RETURN_OK) a_pushed++;
+    check(a_pushed < fits, "shared arena runs out sooner");
+    check(check_intact(&a, a_pushed), "shared arena array intact");
+    Arena_free(&arena);
+}
+
+static void check_pool(void) {
+    Pool pool;
+    if (Pool_init(&pool, CHECK_POOL_BLOCK_SIZE, CHECK_POOL_BLOCKS) !=
+        RETURN_OK) {
+        check(false, "Pool_init");
+        return;
+    }
+    // Blocks are rounded up to the alignment
+    u32 fits = (u32)(pool.block_size / sizeof(u32));
+
+    CheckArray arrays[CHECK_POOL_BLOCKS];
+    for (u32 i = 0; i < CHECK_POOL_BLOCKS; ++i) {
+        CheckArray_init_with(&arrays[i], &pool.allocator);
+        u32 pushed = check_fill(&arrays[i]);
+        check(pushed == fits, "pool array fills one block");
+        check(check_intact(&arrays[i], pushed), "pool array intact once full");
+    }
+    check(pool.in_use == CHECK_POOL_BLOCKS, "one block per array");
+
+    // Every block taken, the next array can't start
+    CheckArray extra;
+    CheckArray_init_with(&extra, &pool.allocator);
+    check(CheckArray_push(&extra, 0) != RETURN_OK, "exhausted pool refuses");
+    check(extra.items == NULL && extra.count == 0, "refused array empty");
+
+    // A freed array's block goes to the next one
+    CheckArray_free(&arrays[0]);
+    check(pool.in_use == CHECK_POOL_BLOCKS - 1, "free releases the block");
+    check(check_fill(&extra) == fits, "released block reused");
+    check(check_intact(&arrays[1], fits), "other array untouched");
+
+    Pool_reset(&pool);
+    check(pool.in_use == 0, "pool reset");
+    Pool_free(&pool);
+}
+
+int main(void) {
+    check_arena();
+    check_pool();
+    if (check_failures > 0) {
+        printf("%u allocator checks failed\n", check_failures);
+        return 1;
+    }
+    printf("Allocator checks passed\n");
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Synthetic PGPS traffic for load testing the listener.  Sends Pose
+// datagrams to one address at a set rate, round-robin over a number of
+// bodies, in bursts, with optional deliberate loss and reordering.
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdbool.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+#include "cimpl_glm.h"
+#include "cimpl_network.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_gen.h"
+#include "pgps_iso8601.h"
+#include "pgps_pose.h"
+#include "pgps_time.h"
+#include "pgps_wire.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int signal) {
+    (void)signal;
+    stop_requested = 1;
+}
+
+void help(char** argv) {
+    printf("Usage: %s [IP_ADDR] [OPTIONS]\n", argv[0]);
+    printf("Options:\n");
+    printf(
+        "  --rate R     Send R poses/s over all bodies, 0 as fast as "
+        "possible (default %.0f)\n",
+        GEN_DEFAULT_RATE
+    );
+    printf(
+        "  --bodies N   Round-robin over N body ids (default %d)\n",
+        GEN_DEFAULT_BODIES
+    );
+    printf(
+        "  --burst B    Send B poses per sendmmsg, pausing in between "
+        "(1-%d, default 1)\n",
+        GEN_BURST_MAX
+    );
+    printf("  --loss P     Skip a fraction P of poses (default 0)\n");
+    printf(
+        "  --reorder P  Send a fraction P of poses after the next one "
+        "(default 0)\n"
+    );
+    printf("  --count N    Stop after N poses, 0 for no limit (default 0)\n");
+    printf("  --seconds S  Stop after S seconds, 0 for no limit (default 0)\n");
+    printf("  --seed X     Seed loss and reorder decisions (default fixed)\n");
+    printf(
+        "  --capture PCAP     Write the datagrams to a capture instead of "
+        "sending them, as fast as they can be written\n"
+    );
+    return;
+}
+
+i32 parse_args(GenConfig* config, int argc, char** argv) {
+    if (argc < 2) return EXIT_FAILURE;
+    if (parse_ip_str(&config->dst, argv[1]) != 0) return EXIT_FAILURE;
+    config->rate = GEN_DEFAULT_RATE;
+    config->bodies = GEN_DEFAULT_BODIES;
+    config->burst = 1;
+    for (i32 i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            config->rate = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+            config->bodies = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) {
+            config->burst = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            config->loss = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            config->reorder = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            config->count = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            config->seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            config->seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            config->capture_path = argv[++i];
+        } else {
+            log_error("Unknown option %s", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (config->rate < 0.0 || config->loss < 0.0 || config->loss > 1.0 ||
+        config->reorder < 0.0 || config->reorder > 1.0) {
+        log_error("Rate must be positive, loss and reorder within [0, 1]");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    GenConfig config = {0};
+    if (parse_args(&config, argc, argv) != EXIT_SUCCESS) {
+        help(argv);
+        return -1;
+    }
+
+    // No SA_RESTART, so a pacing sleep returns early and sees the flag
+    struct sigaction stop_action = {0};
+    stop_action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    Generator gen;
+    if (Generator_init(&gen, config) != RETURN_OK) return 1;
+    log_info(
+        "%s %s: %.0f poses/s over %u bodies, bursts of %u, "
+        "%.1f%% loss, %.1f%% reordered",
+        config.capture_path != NULL ? "Capturing for" : "Sending to",
+        argv[1],
+        config.rate,
+        gen.config.bodies,
+        gen.config.burst,
+        config.loss * 100.0,
+        config.reorder * 100.0
+    );
+    CimplReturn result = Generator_run(&gen, &stop_requested);
+    GenStats_print(&gen.stats, stdout);
+    Generator_free(&gen);
+    return result == RETURN_OK ? 0 : 1;
+}
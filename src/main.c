@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include <errno.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <sys/time.h>
 
@@ -7,122 +9,555 @@
 #include "cimpl_glm.h"
 #include "cimpl_network.h"
 
-typedef struct Pose {
-    char id[32];
-    char timestamp[28];
-    Vec3 position;
-    Quat rotation;
-    uint8_t confidence;
-    bool trigger_activated;
-} Pose;
-
-i32 udp_listener_setup_with_timeout(
-    isize* socket_fd, IpV4Addr ip, uint32_t timeout_sec
-) {
-    struct sockaddr_in listen_addr = {0};
-    listen_addr.sin_family = AF_INET;
-    listen_addr.sin_addr.s_addr = htonl(ip.addr);
-    listen_addr.sin_port = htons(ip.port);
-
-    char ip_addr_str[INET_ADDRSTRLEN] = {0};
-    if (inet_ntop(
-            listen_addr.sin_family,
-            &(listen_addr.sin_addr),
-            ip_addr_str,
-            INET_ADDRSTRLEN
-        ) == NULL) {
-        log_error("Malformed IP address.\n");
+#define PGPS_IMPLEMENTATION
+#include "pgps_dashboard.h"
+#include "pgps_demux.h"
+#include "pgps_endpoint.h"
+#include "pgps_intern.h"
+#include "pgps_latency.h"
+#include "pgps_listener.h"
+#include "pgps_pcap.h"
+#include "pgps_pose.h"
+#include "pgps_receiver.h"
+#include "pgps_recv.h"
+#include "pgps_reorder.h"
+#include "pgps_ring.h"
+#include "pgps_shard.h"
+#include "pgps_stats.h"
+#include "pgps_time.h"
+#include "pgps_uring.h"
+#include "pgps_writer.h"
+
+#define DEFAULT_POSE_LIMIT 165
+#define DEFAULT_TIMEOUT_SEC 5
+
+typedef struct Config {
+    // IP_ADDR first, then every --listen
+    EndpointSpec endpoints[ENDPOINT_MAX];
+    u32 endpoint_count;
+    char* output_path;
+    RecvBackend backend;
+    // Datagrams drained per syscall by the recvmmsg and uring backends
+    u32 batch_size;
+    // >1 binds that many SO_REUSEPORT sockets, each with its own thread
+    u32 shards;
+    // Non-zero hands poses from the receive thread(s) to the writer through
+    // SPSC rings of this many records.  Always on with shards.
+    u64 ring_capacity;
+    // Stop after this many poses, 0 records until interrupted
+    u32 pose_limit;
+    // Keep recording through idle periods instead of stopping on timeout
+    bool stream;
+    // One output stream per body id
+    bool demux;
+    // Put each body back in sender order before writing
+    ReorderConfig reorder;
+    // Bounds for growing each socket's receive buffer
+    RcvBufConfig rcvbuf;
+    // What the sockets let through in-kernel
+    SocketFilter filter;
+    WriterConfig writer;
+    // Read datagrams from this capture instead of the sockets
+    char* replay_path;
+    // Replay pace, 0 as fast as possible, 1 as captured
+    f64 replay_speed;
+    // Shared memory object the per-stage counters are published in
+    char* stats_name;
+    // Console dashboard redraws per second, 0 for none
+    u32 dashboard_hz;
+} Config;
+
+static volatile sig_atomic_t stop_requested = 0;
+// Set once a pose couldn't be written, which ends the capture
+static bool output_failed = false;
+
+static void on_stop_signal(int signal) {
+    (void)signal;
+    stop_requested = 1;
+}
+
+// Counted by whichever thread writes, drawn by its own thread
+static Dashboard dashboard;
+
+void help(char** argv) {
+    printf("Usage: %s [IP_ADDR] [OUTPUT_PATH] [OPTIONS]\n", argv[0]);
+    printf(
+        "IP_ADDR is ADDR:PORT, a multicast ADDR is joined, on the interface "
+        "with local address IFACE if given as ADDR:PORT@IFACE\n"
+    );
+    printf("Options:\n");
+    printf(
+        "  --listen IP_ADDR   Also receive on IP_ADDR, repeatable (up to %d "
+        "in all, one thread, not with --ring)\n",
+        ENDPOINT_MAX
+    );
+    printf(
+        "  --backend B  Receive with recvfrom, recvmmsg or uring "
+        "(default recvfrom, or recvmmsg when --batch > 1)\n"
+    );
+    printf(
+        "  --batch N    Receive up to N datagrams per syscall (1-%d, "
+        "default 1, or %d with uring)\n",
+        PGPS_BATCH_MAX,
+        PGPS_BATCH_SIZE
+    );
+    printf(
+        "  --shards K   Receive on K SO_REUSEPORT sockets, one pinned thread "
+        "each (1-%d, default 1)\n",
+        SHARD_MAX
+    );
+    printf(
+        "  --ring N     Receive on a separate thread, queueing up to N poses "
+        "for the writer (default %d with --shards)\n",
+        POSE_RING_DEFAULT_CAPACITY
+    );
+    printf(
+        "  --timestamps Record kernel receive timestamps and report "
+        "per-stage latency\n"
+    );
+    printf(
+        "  --count N    Stop after N poses, 0 for no limit (default %d)\n",
+        DEFAULT_POSE_LIMIT
+    );
+    printf(
+        "  --stream     Record until SIGINT/SIGTERM, idle periods don't end "
+        "the capture\n"
+    );
+    printf(
+        "  --format F   Write csv (default) or a binary log, see "
+        "pgps_bin2csv\n"
+    );
+    printf(
+        "  --demux      Write each body id to its own file, "
+        "OUTPUT_PATH_<id>.ext\n"
+    );
+    printf(
+        "  --reorder N  Hold up to N poses per body to restore sender order "
+        "(default off)\n"
+    );
+    printf(
+        "  --reorder-ms T     Hold a pose at most T ms (default %llu)\n",
+        REORDER_DEFAULT_BUDGET_NS / 1000000
+    );
+    printf(
+        "  --filter     Drop datagrams that aren't %d bytes in the kernel\n",
+        POSE_WIRE_SIZE
+    );
+    printf(
+        "  --allow CIDR Only accept datagrams from this subnet, repeatable "
+        "(implies --filter)\n"
+    );
+    printf(
+        "  --rcvbuf-min B     Start each socket's SO_RCVBUF at B bytes or more "
+        "(default system)\n"
+    );
+    printf(
+        "  --rcvbuf-max B     Grow SO_RCVBUF with bursts and drops up to B "
+        "bytes, 0 to keep it fixed (default %d)\n",
+        RCVBUF_DEFAULT_MAX
+    );
+    printf(
+        "  --replay PCAP      Feed the datagrams for IP_ADDR (and --listen) "
+        "in a capture through the pipeline instead of receiving\n"
+    );
+    printf(
+        "  --speed X          Replay at X times the captured pace, 0 as fast "
+        "as possible (default 0)\n"
+    );
+    printf(
+        "  --stats NAME       Publish per-stage counters in shared memory "
+        "object NAME, see pgps_stat\n"
+    );
+    printf(
+        "  --dashboard HZ     Redraw live counters HZ times a second, 0 for "
+        "none (default %d on a terminal, otherwise 0)\n",
+        DASHBOARD_DEFAULT_HZ
+    );
+    printf("  --flush-bytes B    Flush the output after B buffered bytes\n");
+    printf("  --flush-ms T       Flush the output at least every T ms\n");
+    printf("  --segment-poses N  Start a new output file every N poses\n");
+    printf("  --segment-sec S    Start a new output file every S seconds\n");
+    return;
+}
+
+i32 parse_args(Config* config, int argc, char** argv) {
+    if (argc < 3) return EXIT_FAILURE;
+    if (EndpointSpec_from_str(&config->endpoints[0], argv[1]) != RETURN_OK) {
         return EXIT_FAILURE;
     }
-
-    *socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (*socket_fd < 0) {
-        log_error("Failed to create socket for %s:%d.", ip_addr_str, ip.port);
+    config->endpoint_count = 1;
+    config->output_path = argv[2];
+    config->batch_size = 0;
+    config->shards = 1;
+    config->pose_limit = DEFAULT_POSE_LIMIT;
+    config->reorder.budget_ns = REORDER_DEFAULT_BUDGET_NS;
+    config->rcvbuf.max_bytes = RCVBUF_DEFAULT_MAX;
+    config->dashboard_hz = isatty(STDOUT_FILENO) ? DASHBOARD_DEFAULT_HZ : 0;
+    SocketFilter_init(&config->filter);
+    bool backend_set = false;
+    bool limit_set = false;
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            if (config->endpoint_count == ENDPOINT_MAX) {
+                log_error("At most %d endpoints", ENDPOINT_MAX);
+                return EXIT_FAILURE;
+            }
+            if (EndpointSpec_from_str(
+                    &config->endpoints[config->endpoint_count++], argv[++i]
+                ) != RETURN_OK) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (RecvBackend_from_str(&config->backend, argv[++i]) !=
+                RETURN_OK) {
+                log_error("Unknown backend %s", argv[i]);
+                return EXIT_FAILURE;
+            }
+            backend_set = true;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            config->batch_size = (u32)strtoul(argv[++i], NULL, 10);
+            if (config->batch_size == 0 ||
+                config->batch_size > PGPS_BATCH_MAX) {
+                log_error("Invalid batch size %s", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            config->shards = (u32)strtoul(argv[++i], NULL, 10);
+            if (config->shards == 0 || config->shards > SHARD_MAX) {
+                log_error("Invalid shard count %s", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+            config->ring_capacity = strtoull(argv[++i], NULL, 10);
+            if (config->ring_capacity == 0) {
+                log_error("Invalid ring capacity %s", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--timestamps") == 0) {
+            config->writer.timestamps = true;
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            config->pose_limit = (u32)strtoul(argv[++i], NULL, 10);
+            limit_set = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            config->stream = true;
+        } else if (strcmp(argv[i], "--demux") == 0) {
+            config->demux = true;
+        } else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            config->reorder.window = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--reorder-ms") == 0 && i + 1 < argc) {
+            config->reorder.budget_ns =
+                strtoull(argv[++i], NULL, 10) * 1000000ull;
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            config->filter.enabled = true;
+        } else if (strcmp(argv[i], "--allow") == 0 && i + 1 < argc) {
+            if (SocketFilter_allow(&config->filter, argv[++i]) != RETURN_OK) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--rcvbuf-min") == 0 && i + 1 < argc) {
+            config->rcvbuf.min_bytes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rcvbuf-max") == 0 && i + 1 < argc) {
+            config->rcvbuf.max_bytes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            config->replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            char* end;
+            config->replay_speed = strtod(argv[++i], &end);
+            if (*end != '\0' || config->replay_speed < 0.0) {
+                log_error("Invalid replay speed %s", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--dashboard") == 0 && i + 1 < argc) {
+            config->dashboard_hz = (u32)strtoul(argv[++i], NULL, 10);
+            if (config->dashboard_hz > DASHBOARD_MAX_HZ) {
+                log_error("At most %d redraws a second", DASHBOARD_MAX_HZ);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            config->stats_name = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (OutputFormat_from_str(&config->writer.format, argv[++i]) !=
+                RETURN_OK) {
+                log_error("Unknown output format %s", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--flush-bytes") == 0 && i + 1 < argc) {
+            config->writer.flush_bytes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) {
+            config->writer.flush_interval_ns =
+                strtoull(argv[++i], NULL, 10) * 1000000ull;
+        } else if (strcmp(argv[i], "--segment-poses") == 0 && i + 1 < argc) {
+            config->writer.segment_poses = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--segment-sec") == 0 && i + 1 < argc) {
+            config->writer.segment_interval_ns =
+                strtoull(argv[++i], NULL, 10) * NS_PER_SEC;
+        } else {
+            log_error("Unknown option %s", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!backend_set) {
+        config->backend = config->batch_size > 1 ? RECV_BACKEND_RECVMMSG
+                                                 : RECV_BACKEND_RECVFROM;
+    }
+    if (config->replay_path != NULL) {
+        if (config->shards > 1 || config->ring_capacity > 0) {
+            log_error("A replay runs on one thread, no --shards or --ring");
+            return EXIT_FAILURE;
+        }
+        // A capture has an end, and there is no syscall to amortise
+        if (!limit_set) config->pose_limit = 0;
+        if (config->batch_size == 0) config->batch_size = PGPS_BATCH_SIZE;
+        return EXIT_SUCCESS;
+    }
+    if (config->batch_size == 0) {
+        config->batch_size =
+            config->backend == RECV_BACKEND_URING ? PGPS_BATCH_SIZE : 1;
+    }
+    if (config->stream && !limit_set) config->pose_limit = 0;
+    if (config->shards > 1 && config->ring_capacity == 0) {
+        config->ring_capacity = POSE_RING_DEFAULT_CAPACITY;
+    }
+    if (config->endpoint_count > 1 && config->ring_capacity > 0) {
+        log_error("Several endpoints are received on one thread, no --ring");
         return EXIT_FAILURE;
     }
+    config->rcvbuf.filtered = config->filter.enabled;
+    return EXIT_SUCCESS;
+}
+
+// How long a receive may block.  Streaming wakes up often enough to honour
+// the flush and segment budgets while idle.
+u64 recv_timeout_usec(const Config* config) {
+    u64 timeout = DEFAULT_TIMEOUT_SEC * 1000000ull;
+    if (!config->stream) return timeout;
+    u64 flush = config->writer.flush_interval_ns / 1000;
+    u64 segment = config->writer.segment_interval_ns / 1000;
+    u64 reorder =
+        config->reorder.window != 0 ? config->reorder.budget_ns / 1000 : 0;
+    if (flush != 0 && flush < timeout) timeout = flush;
+    if (segment != 0 && segment < timeout) timeout = segment;
+    if (reorder != 0 && reorder < timeout) timeout = reorder;
+    return timeout < 1000 ? 1000 : timeout;
+}
 
-    int reuse = 1;
-    if (setsockopt(
-            *socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)
-        ) < 0) {
-        log_error("Failed to set SO_REUSEADDR");
+// Poses left before the limit, `fallback` when there is no limit
+u32 poses_left(const Config* config, u64 pose_count, u32 fallback) {
+    if (config->pose_limit == 0) return fallback;
+    return config->pose_limit - (u32)pose_count;
+}
+
+bool below_limit(const Config* config, u64 pose_count) {
+    return config->pose_limit == 0 || pose_count < config->pose_limit;
+}
+
+bool keep_running(const Config* config, u64 pose_count) {
+    return !stop_requested && !output_failed && below_limit(config, pose_count);
+}
+
+// Writes a pose at `now` and counts it on the dashboard
+void emit(PoseDemux* output, const PoseRecord* record, u64 now) {
+    if (PoseDemux_write(
+            output,
+            &record->sample,
+            record->kernel_ns,
+            record->user_ns,
+            now
+        ) != RETURN_OK) {
+        output_failed = true;
+        return;
     }
+    Dashboard_written(&dashboard, record->sample.id, record->recv_ns);
+}
 
-    struct timeval timeout_tv = {
-        .tv_sec = timeout_sec,
-    };
-    if (setsockopt(
-            *socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout_tv, sizeof(timeout_tv)
-        ) < 0) {
-        log_error("Failed to set SO_RCVTIMEO");
+// Applies the output's flush and segment budgets at `now`, monotonic ns
+void tick(PoseDemux* output, u64 now) {
+    if (PoseDemux_tick(output, now) != RETURN_OK) output_failed = true;
+}
+
+// Passes a pose received by `now` on to the output, through the reorder
+// stage when there is one
+void deliver(
+    PoseDemux* output,
+    PoseReorder* reorder,
+    PoseRecordArray* ready,
+    const PoseRecord* record,
+    u64 now
+) {
+    if (reorder == NULL) {
+        emit(output, record, now);
+        return;
+    }
+    if (PoseReorder_push(reorder, record, ready) != RETURN_OK) {
+        log_error("Reorder stage failed, pose lost");
     }
+}
 
-    int bind_err = bind(
-        *socket_fd, (const struct sockaddr*)&listen_addr, sizeof(listen_addr)
-    );
-    if (bind_err < 0) {
-        log_error(
-            "[%d] Failed to bind to %s:%d.", bind_err, ip_addr_str, ip.port
-        );
-        return EXIT_FAILURE;
+// Writes whatever the reorder stage is done holding, or everything it holds
+// with `flush`.  `now` is monotonic ns.
+void release(
+    PoseDemux* output,
+    PoseReorder* reorder,
+    PoseRecordArray* ready,
+    u64 now,
+    bool flush
+) {
+    if (reorder == NULL) return;
+    CimplReturn result = flush ? PoseReorder_flush(reorder, ready)
+                               : PoseReorder_tick(reorder, now, ready);
+    if (result != RETURN_OK) log_error("Reorder stage failed, poses lost");
+    for (usize i = 0; i < ready->count; ++i) {
+        emit(output, &ready->items[i], now);
     }
-    log_info("Listening at %s:%d\n", ip_addr_str, ip.port);
-    return EXIT_SUCCESS;
+    ready->count = 0;
 }
 
-void help(char** argv) {
-    printf("Usage: %s [IP_ADDR] [OUTPUT_PATH]", argv[0]);
-    return;
+// Delivers every pose of a batch received at `now`, monotonic ns
+void deliver_batch(
+    PoseDemux* output,
+    PoseReorder* reorder,
+    PoseRecordArray* ready,
+    const PoseBatch* batch,
+    u64 now
+) {
+    Dashboard_received(&dashboard, batch->count);
+    for (u32 i = 0; i < batch->count; ++i) {
+        PoseRecord record = {
+            .recv_ns = now,
+            .kernel_ns = batch->timestamps ? batch->kernel_ns[i] : 0,
+            .user_ns = batch->timestamps ? batch->user_ns[i] : 0,
+            .len = batch->msgs[i].msg_len,
+            .sample = batch->samples[i],
+        };
+        deliver(output, reorder, ready, &record, now);
+    }
 }
 
-int main(int argc, char** argv) {
-    if (argc < 3) {
-        help(argv);
-        return -1;
+// Feeds a capture through the decode, reorder and write path from the
+// calling thread.  Deadlines run on the capture's clock, so with the same
+// capture and options the output is the same at any --speed.
+i32 run_replay(
+    const Config* config,
+    IdTable* ids,
+    PoseReorder* reorder,
+    PoseDemux* output
+) {
+    static PcapReplay replay;
+    if (PcapReplay_open(
+            &replay,
+            config->replay_path,
+            config->endpoints,
+            config->endpoint_count,
+            config->replay_speed
+        ) != RETURN_OK) {
+        return EXIT_FAILURE;
+    }
+    replay.timing = config->writer.timing;
+    PoseBatch batch = {0};
+    if (PoseBatch_init(&batch, config->batch_size, config->writer.timestamps) !=
+        RETURN_OK) {
+        PcapReplay_close(&replay);
+        return EXIT_FAILURE;
     }
-    IpV4Addr server_addr = {0};
-    IpV4Addr_from_str(&server_addr, argv[1]);
-    isize socket_fd = -1;
 
-    udp_listener_setup_with_timeout(&socket_fd, server_addr, 5);
+    RecvStats stats = {0};
+    PoseRecordArray ready = {0};
+    u64 pose_count = 0;
+    u64 start_ns = monotonic_ns();
+    while (keep_running(config, pose_count) && !replay.finished) {
+        isize received = PcapReplay_recv(
+            &replay,
+            &batch,
+            ids,
+            poses_left(config, pose_count, batch.capacity),
+            &stats
+        );
+        if (received == -1) {
+            if (errno == EINTR) continue;
+            perror("replay");
+            break;
+        }
 
-    struct sockaddr_in client_info = {0};
-    socklen_t client_len = sizeof(client_info);
+        u64 now = PcapReplay_now(&replay);
+        deliver_batch(output, reorder, &ready, &batch, now);
+        Dashboard_recv_stats(&dashboard, &stats);
+        pose_count += batch.count;
+        release(output, reorder, &ready, now, false);
+        tick(output, now);
+    }
+    release(output, reorder, &ready, PcapReplay_now(&replay), true);
+    f64 elapsed = (f64)(monotonic_ns() - start_ns) / 1e9;
+    Dashboard_stop(&dashboard);
 
-    FILE* fp = fopen(argv[2], "w");
-    if (fp == NULL) {
-        perror("fopen");
-        return 1;
+    PcapReplay_print(&replay, stdout);
+    RecvStats_print(&stats, stdout);
+    printf(
+        "Replayed %lu poses in %.3f s (%.0f poses/s)\n",
+        pose_count,
+        elapsed,
+        elapsed > 0.0 ? (f64)pose_count / elapsed : 0.0
+    );
+
+    PoseRecordArray_free(&ready);
+    PoseBatch_free(&batch);
+    PcapReplay_close(&replay);
+    return EXIT_SUCCESS;
+}
+
+// Receives on a single socket from the calling thread
+i32 run_single(
+    const Config* config,
+    IdTable* ids,
+    PoseReorder* reorder,
+    PoseDemux* output
+) {
+    const EndpointSpec* endpoint = &config->endpoints[0];
+    isize socket_fd = -1;
+    u64 timeout_usec = recv_timeout_usec(config);
+    if (udp_listener_open(
+            &socket_fd,
+            endpoint->addr,
+            (u32)(timeout_usec / 1000000),
+            (u32)(timeout_usec % 1000000),
+            false,
+            &config->filter
+        ) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (EndpointSpec_join(endpoint, socket_fd) != RETURN_OK) {
+        close(socket_fd);
+        return EXIT_FAILURE;
+    }
+
+    Receiver rx = {0};
+    if (Receiver_init(
+            &rx,
+            config->backend,
+            socket_fd,
+            ids,
+            config->batch_size,
+            timeout_usec,
+            config->writer.timestamps,
+            config->rcvbuf
+        ) != RETURN_OK) {
+        close(socket_fd);
+        return EXIT_FAILURE;
     }
-    fprintf(fp, "id,px,py,pz,qx,qy,qz,qw\n");
-    Pose recv_pose = {0};
-    u32 pose_count = 0;
-    while (pose_count < 165) {
+    rx.timing = config->writer.timing;
+    PoseRecordArray ready = {0};
+    u64 pose_count = 0;
+    while (keep_running(config, pose_count)) {
         // Don't use timeout until the first message has been received
-        isize recv_bytes;
-        if (pose_count == 0) {
-            recv_bytes = recvfrom(
-                socket_fd,
-                &recv_pose,
-                sizeof(Pose),
-                0,
-                (struct sockaddr*)&client_info,
-                &client_len
-            );
-        } else {
-            recv_bytes = recvfrom(
-                socket_fd,
-                &recv_pose,
-                sizeof(Pose),
-                0,
-                (struct sockaddr*)&client_info,
-                &client_len
-            );
-        }
+        isize received = Receiver_recv(
+            &rx, poses_left(config, pose_count, rx.batch.capacity)
+        );
 
-        if (recv_bytes == -1) {
+        if (received == -1) {
+            if (errno == EINTR) continue;
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (pose_count > 0) {
+                u64 now = monotonic_ns();
+                release(output, reorder, &ready, now, false);
+                tick(output, now);
+                if (pose_count > 0 && !config->stream) {
                     fprintf(
                         stderr, "Timout reached trying to receive packet.\n"
                     );
@@ -131,32 +566,336 @@ int main(int argc, char** argv) {
                 continue;
             } else {
                 fprintf(stderr, "Failed to receive packet\n");
-                perror("recvfrom");
+                perror(RecvBackend_name(config->backend));
                 break;
             }
         }
 
-        printf("Bytes received: %ld\n", recv_bytes);
-        fprintf(
-            fp,
-            "%s"
-            ",%d"
-            ",%12.6f,%12.6f,%12.6f"
-            ",%12.6f,%12.6f,%12.6f,%12.6f\n",
-            recv_pose.id,
-            pose_count,
-            recv_pose.position.x,
-            recv_pose.position.y,
-            recv_pose.position.z,
-            recv_pose.rotation.x,
-            recv_pose.rotation.y,
-            recv_pose.rotation.z,
-            recv_pose.rotation.w
-        );
-        pose_count++;
+        u64 now = monotonic_ns();
+        deliver_batch(output, reorder, &ready, &rx.batch, now);
+        Dashboard_recv_stats(&dashboard, &rx.stats);
+        pose_count += rx.batch.count;
+        release(output, reorder, &ready, now, false);
+        tick(output, now);
     }
+    release(output, reorder, &ready, monotonic_ns(), true);
+    PoseRecordArray_free(&ready);
+    Dashboard_stop(&dashboard);
+    RecvStats_print(&rx.stats, stdout);
 
+    Receiver_free(&rx);
     close(socket_fd);
-    fclose(fp);
-    return 0;
+    return EXIT_SUCCESS;
+}
+
+// Receives on every endpoint from the calling thread, waiting on all of
+// their sockets at once with epoll
+i32 run_multi(
+    const Config* config,
+    IdTable* ids,
+    PoseReorder* reorder,
+    PoseDemux* output
+) {
+    EndpointConfig endpoint_config = {
+        .backend = config->backend,
+        .batch_size = config->batch_size,
+        .timestamps = config->writer.timestamps,
+        .rcvbuf = config->rcvbuf,
+        .filter = &config->filter,
+        .ids = ids,
+        .timing = config->writer.timing,
+    };
+    static EndpointSet set;
+    if (EndpointSet_open(
+            &set, config->endpoints, config->endpoint_count, endpoint_config
+        ) != RETURN_OK) {
+        return EXIT_FAILURE;
+    }
+
+    i32 timeout_ms = (i32)(recv_timeout_usec(config) / 1000);
+    Endpoint* active[ENDPOINT_MAX];
+    PoseRecordArray ready = {0};
+    u64 pose_count = 0;
+    while (keep_running(config, pose_count) && set.active > 0) {
+        i32 count = EndpointSet_wait(&set, timeout_ms, active);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        u64 now = monotonic_ns();
+        if (count == 0) {
+            release(output, reorder, &ready, now, false);
+            tick(output, now);
+            if (pose_count > 0 && !config->stream) {
+                fprintf(stderr, "Timout reached trying to receive packet.\n");
+                break;
+            }
+            continue;
+        }
+
+        for (i32 i = 0; i < count && below_limit(config, pose_count); ++i) {
+            Receiver* rx = &active[i]->rx;
+            isize received = Receiver_recv(
+                rx, poses_left(config, pose_count, rx->batch.capacity)
+            );
+            if (received == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    continue;
+                }
+                // Left in the set it would be readable again straight away
+                char name[ENDPOINT_STR_SIZE];
+                EndpointSpec_format(&active[i]->spec, name, sizeof(name));
+                log_error_fields(
+                    "Failed to receive, dropping the endpoint",
+                    LOG_STR("endpoint", name),
+                    LOG_STR("error", strerror(errno))
+                );
+                if (EndpointSet_remove(&set, active[i]) == 0) break;
+                continue;
+            }
+            deliver_batch(output, reorder, &ready, &rx->batch, now);
+            pose_count += rx->batch.count;
+        }
+        if (dashboard.enabled) {
+            RecvStats total = {0};
+            for (u32 i = 0; i < set.count; ++i) {
+                RecvStats_merge(&total, &set.endpoints[i].rx.stats);
+            }
+            Dashboard_recv_stats(&dashboard, &total);
+        }
+        release(output, reorder, &ready, now, false);
+        tick(output, now);
+    }
+    release(output, reorder, &ready, monotonic_ns(), true);
+    PoseRecordArray_free(&ready);
+    Dashboard_stop(&dashboard);
+    EndpointSet_print(&set, stdout);
+    // Every endpoint failed, not a finished capture
+    i32 result = set.active == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    EndpointSet_close(&set);
+    return result;
+}
+
+// Receives on `config->shards` SO_REUSEPORT sockets, one pinned thread each.
+// The calling thread is the sink: it drains the shard rings in receive
+// timestamp order and writes the result, so a slow disk never stalls a
+// receive thread.  With one shard this is just a receive/write thread split.
+// Each shard publishes its timing in its own slot of `stats`, if given.
+i32 run_threaded(
+    const Config* config,
+    IdTable* ids,
+    PoseReorder* reorder,
+    PoseDemux* output,
+    StatsPage* stats
+) {
+    isize socket_fds[SHARD_MAX];
+    if (udp_listener_setup_sharded(
+            socket_fds,
+            config->shards,
+            config->endpoints[0].addr,
+            0,
+            SHARD_RECV_TIMEOUT_USEC,
+            &config->filter
+        ) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    for (u32 i = 0; i < config->shards; ++i) {
+        if (EndpointSpec_join(&config->endpoints[0], socket_fds[i]) !=
+            RETURN_OK) {
+            for (u32 j = 0; j < config->shards; ++j) close(socket_fds[j]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ShardConfig shard_config = {
+        .backend = config->backend,
+        .batch_size = config->batch_size,
+        .timestamps = config->writer.timestamps,
+        .rcvbuf = config->rcvbuf,
+        .ids = ids,
+        .ring_capacity = config->ring_capacity,
+        .stats = stats,
+    };
+    ShardSet set = {0};
+    if (ShardSet_start(&set, socket_fds, config->shards, shard_config) !=
+        RETURN_OK) {
+        for (u32 i = 0; i < config->shards; ++i) close(socket_fds[i]);
+        return EXIT_FAILURE;
+    }
+
+    PoseRecordArray merged = {0};
+    PoseRecordArray ready = {0};
+    u64 pose_count = 0;
+    u64 last_pose_ns = 0;
+    bool timed_out = false;
+    for (;;) {
+        // Once stopped, one last merge drains everything the shards queued
+        bool done = timed_out || !keep_running(config, pose_count);
+        if (done) {
+            ShardSet_stop(&set);
+        } else {
+            // Sink poll interval, well under the shard receive timeout
+            struct timespec nap = {.tv_nsec = 1000000};
+            nanosleep(&nap, NULL);
+        }
+        if (ShardSet_merge(&set, &merged, done) != RETURN_OK) break;
+
+        u64 now = monotonic_ns();
+        for (u32 i = 0; i < merged.count && below_limit(config, pose_count);
+             ++i) {
+            deliver(output, reorder, &ready, &merged.items[i], now);
+            Dashboard_received(&dashboard, 1);
+            pose_count++;
+        }
+        u64 overflows = 0;
+        for (u32 i = 0; i < set.count; ++i) {
+            overflows += PoseRing_overflows(&set.shards[i].ring);
+        }
+        Dashboard_ring_overflows(&dashboard, overflows);
+        if (merged.count > 0) last_pose_ns = now;
+        merged.count = 0;
+        release(output, reorder, &ready, now, done);
+        tick(output, now);
+
+        if (done) break;
+        // Don't use timeout until the first message has been received
+        if (pose_count > 0 && !config->stream &&
+            now - last_pose_ns > DEFAULT_TIMEOUT_SEC * NS_PER_SEC) {
+            fprintf(stderr, "Timout reached trying to receive packet.\n");
+            timed_out = true;
+        }
+    }
+    ShardSet_stop(&set);
+    Dashboard_stop(&dashboard);
+
+    RecvStats total = {0};
+    for (u32 i = 0; i < set.count; ++i) {
+        const Shard* shard = &set.shards[i];
+        const RecvStats* stats = &shard->stats;
+        printf("Shard %u (CPU %d): ", i, shard->cpu);
+        RecvStats_print(stats, stdout);
+        printf(
+            "  ring high water %lu/%lu, overflows %lu\n",
+            PoseRing_high_water(&shard->ring),
+            shard->ring.capacity,
+            PoseRing_overflows(&shard->ring)
+        );
+        RecvStats_merge(&total, stats);
+    }
+    printf("All shards: ");
+    RecvStats_print(&total, stdout);
+
+    PoseRecordArray_free(&merged);
+    PoseRecordArray_free(&ready);
+    ShardSet_free(&set);
+    for (u32 i = 0; i < config->shards; ++i) close(socket_fds[i]);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    Config config = {0};
+    if (parse_args(&config, argc, argv) != EXIT_SUCCESS) {
+        help(argv);
+        return -1;
+    }
+
+    // No SA_RESTART, so a blocked receive returns EINTR and sees the flag
+    struct sigaction stop_action = {0};
+    stop_action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+    // Receive threads log without formatting or taking stdio locks
+    log_async_start();
+
+    // The calling thread writes, and receives too unless there are shards
+    StatsPage* stats = NULL;
+    if (config.stats_name != NULL) {
+        if (StatsPage_create(&stats, config.stats_name) != RETURN_OK) {
+            return 1;
+        }
+        config.writer.timing = StatsPage_thread(
+            stats, config.ring_capacity > 0 ? "writer" : "main"
+        );
+    }
+
+    // Every receive thread interns into the same table
+    static IdTable ids;
+    if (IdTable_init(&ids) != RETURN_OK) {
+        StatsPage_destroy(stats, config.stats_name);
+        return 1;
+    }
+    static PoseDemux output;
+    if (PoseDemux_open(
+            &output, config.output_path, config.writer, &ids, config.demux
+        ) != RETURN_OK) {
+        IdTable_free(&ids);
+        StatsPage_destroy(stats, config.stats_name);
+        return 1;
+    }
+
+    static PoseReorder reorder;
+    PoseReorder* stage = NULL;
+    if (config.reorder.window > 0) {
+        if (PoseReorder_init(&reorder, config.reorder) != RETURN_OK) {
+            PoseDemux_close(&output);
+            IdTable_free(&ids);
+            StatsPage_destroy(stats, config.stats_name);
+            return 1;
+        }
+        stage = &reorder;
+    }
+
+    UdpCounters udp_start;
+    if (config.filter.enabled && config.replay_path == NULL) {
+        SocketFilter_print(&config.filter, stdout);
+        UdpCounters_read(&udp_start);
+    }
+    // Best effort, the capture goes on without it
+    Dashboard_start(&dashboard, &ids, config.dashboard_hz, stdout);
+    i32 result;
+    if (config.replay_path != NULL) {
+        result = run_replay(&config, &ids, stage, &output);
+    } else if (config.ring_capacity > 0) {
+        result = run_threaded(&config, &ids, stage, &output, stats);
+    } else if (config.endpoint_count > 1) {
+        result = run_multi(&config, &ids, stage, &output);
+    } else {
+        result = run_single(&config, &ids, stage, &output);
+    }
+    // The modes stop it before their summaries, this covers early failures
+    Dashboard_stop(&dashboard);
+    log_async_stop();
+    if (config.filter.enabled && config.replay_path == NULL) {
+        UdpCounters udp_end;
+        UdpCounters_read(&udp_end);
+        printf(
+            "Filtered in kernel: %lu (system-wide UDP input errors that "
+            "weren't overflows)\n",
+            UdpCounters_filtered(&udp_start, &udp_end)
+        );
+    }
+    if (stage != NULL) {
+        PoseReorder_print(stage, &ids, stdout);
+        PoseReorder_free(stage);
+    }
+
+    // Closing flushes, so the last poses' latency is only known after
+    for (u32 i = 0; i < output.count; ++i) {
+        if (PoseWriter_flush(&output.writers[i], monotonic_ns()) !=
+            RETURN_OK) {
+            output_failed = true;
+        }
+    }
+    if (output_failed) {
+        log_error("Stopped, the output could not be written");
+        result = EXIT_FAILURE;
+    }
+    static LatencyStats latency;
+    PoseDemux_latency(&output, &latency);
+    PoseDemux_close(&output);
+    IdTable_free(&ids);
+    StatsPage_destroy(stats, config.stats_name);
+    if (config.writer.timestamps) LatencyStats_print(&latency, stdout);
+    return result == EXIT_SUCCESS ? 0 : 1;
 }
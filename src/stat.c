@@ -0,0 +1,149 @@
+// Reads the per-stage counters a listener started with --stats publishes.
+// Prints totals since the listener started, or with an interval the
+// per-second figures of every interval until the listener exits.
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdbool.h>
+
+#define CIMPL_IMPLEMENTATION
+#include "cimpl_core.h"
+
+#define PGPS_IMPLEMENTATION
+#include "pgps_stats.h"
+#include "pgps_time.h"
+
+typedef struct StatSnapshot {
+    u64 taken_ns;
+    u32 thread_count;
+    StageCounter stages[STATS_THREAD_MAX][STAGE_COUNT];
+} StatSnapshot;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int signal) {
+    (void)signal;
+    stop_requested = 1;
+}
+
+void help(char** argv) {
+    printf("Usage: %s NAME [INTERVAL_MS]\n", argv[0]);
+    printf(
+        "NAME is the shared memory object given to pgps_listener --stats.  "
+        "With INTERVAL_MS, prints each interval until the listener exits.\n"
+    );
+}
+
+static void StatSnapshot_take(StatSnapshot* snap, const StatsPage* page) {
+    snap->taken_ns = monotonic_ns();
+    snap->thread_count =
+        __atomic_load_n(&page->thread_count, __ATOMIC_ACQUIRE);
+    for (u32 t = 0; t < snap->thread_count; ++t) {
+        for (u32 s = 0; s < STAGE_COUNT; ++s) {
+            const StageCounter* src = &page->threads[t].stages[s];
+            StageCounter* dst = &snap->stages[t][s];
+            dst->calls = __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+            dst->items = __atomic_load_n(&src->items, __ATOMIC_RELAXED);
+            dst->ticks = __atomic_load_n(&src->ticks, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Prints what happened between `prev` and `cur`.  Rates are per second of
+// `seconds`, busy is the share of it spent in the stage.
+static void stat_print(
+    const StatsPage* page,
+    const StatSnapshot* prev,
+    const StatSnapshot* cur,
+    f64 seconds
+) {
+    printf(
+        "%-10s %-7s %12s %14s %10s %10s %10s %7s\n",
+        "thread",
+        "stage",
+        "calls/s",
+        "items/s",
+        "items/call",
+        "ns/call",
+        "ns/item",
+        "busy%"
+    );
+    f64 ns_per_tick = 1e9 / (f64)page->tick_hz;
+    for (u32 t = 0; t < cur->thread_count; ++t) {
+        for (u32 s = 0; s < STAGE_COUNT; ++s) {
+            const StageCounter* now = &cur->stages[t][s];
+            StageCounter before = {0};
+            if (prev != NULL && t < prev->thread_count) {
+                before = prev->stages[t][s];
+            }
+            u64 calls = now->calls - before.calls;
+            if (calls == 0) continue;
+            u64 items = now->items - before.items;
+            f64 ns = (f64)(now->ticks - before.ticks) * ns_per_tick;
+            printf(
+                "%-10s %-7s %12.0f %14.0f %10.2f %10.0f %10.1f %7.2f\n",
+                page->threads[t].name,
+                Stage_name(s),
+                (f64)calls / seconds,
+                (f64)items / seconds,
+                (f64)items / (f64)calls,
+                ns / (f64)calls,
+                items == 0 ? 0.0 : ns / (f64)items,
+                100.0 * ns / (seconds * 1e9)
+            );
+        }
+    }
+}
+
+static bool listener_alive(const StatsPage* page) {
+    return kill(page->pid, 0) == 0 || errno == EPERM;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        help(argv);
+        return -1;
+    }
+    u64 interval_ms = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+
+    const StatsPage* page;
+    if (StatsPage_attach(&page, argv[1]) != RETURN_OK) return 1;
+
+    static StatSnapshot snaps[2];
+    StatSnapshot_take(&snaps[0], page);
+    if (interval_ms == 0) {
+        f64 seconds = (f64)(snaps[0].taken_ns - page->start_ns) / 1e9;
+        printf(
+            "pid %d, %.3f s, %u threads\n",
+            page->pid,
+            seconds,
+            snaps[0].thread_count
+        );
+        stat_print(page, NULL, &snaps[0], seconds);
+        StatsPage_detach(page);
+        return 0;
+    }
+
+    struct sigaction stop_action = {0};
+    stop_action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    u32 current = 0;
+    while (!stop_requested && listener_alive(page)) {
+        struct timespec nap = {
+            .tv_sec = (time_t)(interval_ms / 1000),
+            .tv_nsec = (long)(interval_ms % 1000) * 1000000,
+        };
+        nanosleep(&nap, NULL);
+        u32 next = current ^ 1;
+        StatSnapshot_take(&snaps[next], page);
+        f64 seconds =
+            (f64)(snaps[next].taken_ns - snaps[current].taken_ns) / 1e9;
+        printf("\n");
+        stat_print(page, &snaps[current], &snaps[next], seconds);
+        fflush(stdout);
+        current = next;
+    }
+    StatsPage_detach(page);
+    return 0;
+}